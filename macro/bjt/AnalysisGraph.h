@@ -0,0 +1,378 @@
+/*
+ * Grafo delle grandezze estratte da una curva, valutato su richiesta.
+ *
+ * Ogni uscita dell'analisi (V_A, conduttanza, i loro errori, beta, residui,
+ * intervalli bootstrap, diagnostica di influenza, figura) e' un nodo con le
+ * sue dipendenze (kNodeDeps). CurveAnalysis calcola un nodo solo quando viene
+ * chiesto, dopo le sue dipendenze, e lo memorizza: chiedere V_A esegue solo
+ * finestra e fit, senza bootstrap, influenza, residui, beta e figure.
+ *
+ * Utenti tipici (AnalysisRequest): il controllo statistico di processo vuole
+ * solo V_A, la selezione in classi V_A e beta, il resoconto tutto.
+ *
+ * AnalyzeBatchGraph applica una richiesta a tutte le curve di un archivio con
+ * il driver di AnalyzeBatch; la GraphTable ricorda i nodi gia' calcolati per
+ * ogni curva, quindi una seconda richiesta sulla stessa tabella calcola solo
+ * i nodi mancanti (il fit gia' fatto non e' ripetuto).
+ */
+
+#ifndef BJT_ANALYSISGRAPH_H
+#define BJT_ANALYSISGRAPH_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <vector>
+
+#include "Arena.h"
+#include "Batch.h"
+#include "Beta.h"
+#include "CurveStore.h"
+#include "EarlyFit.h"
+
+namespace bjt
+{
+
+enum AnalysisNode
+{
+    kNodeWindow = 0,   // punti nella finestra di fit
+    kNodeFit,          // fit V = a + b*I
+    kNodeVA,           // V_A
+    kNodeCond,         // conduttanza
+    kNodeErrors,       // errori di V_A e conduttanza
+    kNodeBeta,         // beta con la curva compagna
+    kNodeResiduals,    // residui normalizzati
+    kNodeBootstrap,    // intervalli bootstrap
+    kNodeInfluence,    // leverage, Cook, jackknife
+    kNodeFigure,       // figura (GraphConfig::figure)
+    kNNodes
+};
+
+constexpr unsigned NodeBit(int node) { return 1u << node; }
+
+// Dipendenze dirette di ogni nodo; l'ordine dell'enum e' topologico
+constexpr unsigned kNodeDeps[kNNodes] = {
+    0,                                                          // kNodeWindow
+    NodeBit(kNodeWindow),                                       // kNodeFit
+    NodeBit(kNodeFit),                                          // kNodeVA
+    NodeBit(kNodeFit),                                          // kNodeCond
+    NodeBit(kNodeVA) | NodeBit(kNodeCond),                      // kNodeErrors
+    0,                                                          // kNodeBeta: sui punti
+    NodeBit(kNodeWindow) | NodeBit(kNodeFit),                   // kNodeResiduals
+    NodeBit(kNodeWindow) | NodeBit(kNodeFit),                   // kNodeBootstrap
+    NodeBit(kNodeWindow) | NodeBit(kNodeErrors),                // kNodeInfluence
+    NodeBit(kNodeFit),                                          // kNodeFigure
+};
+
+inline const char *NodeName(int node)
+{
+    static const char *const names[kNNodes] = {"finestra", "fit", "V_A", "conduttanza", "errori", "beta",
+                                               "residui", "bootstrap", "influenza", "figura"};
+    return node >= 0 && node < kNNodes ? names[node] : "?";
+}
+
+// Nodi richiesti con tutte le loro dipendenze
+inline unsigned NodeClosure(unsigned request)
+{
+    unsigned m = request & (NodeBit(kNNodes) - 1);
+    for (int node = kNNodes - 1; node >= 0; --node)
+        if (m & NodeBit(node)) m |= kNodeDeps[node];
+    return m;
+}
+
+// Richieste tipiche
+enum AnalysisRequest : unsigned
+{
+    kRequestSPC = NodeBit(kNodeVA),
+    kRequestBinning = NodeBit(kNodeVA) | NodeBit(kNodeBeta),
+    kRequestReport = NodeBit(kNNodes) - 1
+};
+
+struct GraphConfig
+{
+    double betaVce = 3.0;          // tensione di beta [V]
+    int nBootstrap = 200;          // repliche del nodo bootstrap
+    // Disegno della curva index con il suo fit. In AnalyzeBatchGraph e'
+    // chiamata dai thread di lavoro: con ROOT usare nThreads = 1.
+    std::function<void(int index, const EarlyResult &r)> figure;
+};
+
+// -----------------------------------------------------
+// Nodi di una curva, calcolati al primo accesso. La finestra, i residui e
+// il bootstrap usano l'arena: la CurveAnalysis deve vivere dentro un
+// ArenaScope.
+// -----------------------------------------------------
+template <typename Real>
+class CurveAnalysis
+{
+public:
+    CurveAnalysis(const CurveView<Real> &c, const BatchConfig &bc, const GraphConfig &gc, MonotonicArena &arena,
+                  int index = 0)
+        : fCurve(c), fBatch(bc), fGraph(gc), fArena(arena), fIndex(index)
+    {
+    }
+
+    // Curva con la Ib successiva, per beta
+    void SetPartner(const CurveView<Real> &p)
+    {
+        fPartner = p;
+        fHasPartner = true;
+    }
+
+    // Fit gia' calcolato (ad es. in una richiesta precedente): non e' rifatto
+    void SeedFit(const EarlyResult &r)
+    {
+        fFit = r;
+        fDone |= NodeBit(kNodeFit) | NodeBit(kNodeVA) | NodeBit(kNodeCond) | NodeBit(kNodeErrors);
+    }
+
+    // Calcola i nodi richiesti e le loro dipendenze
+    void Evaluate(unsigned request)
+    {
+        for (int node = 0; node < kNNodes; ++node)
+            if (request & NodeBit(node)) Need(node);
+    }
+
+    bool Has(int node) const { return fDone & NodeBit(node); }
+    unsigned GetEvaluated() const { return fDone; }
+
+    const FitWindow<Real> &Window()
+    {
+        Need(kNodeWindow);
+        return fWindow;
+    }
+
+    const EarlyResult &Fit()
+    {
+        Need(kNodeFit);
+        return fFit;
+    }
+
+    double VA()
+    {
+        Need(kNodeVA);
+        return fFit.V_A;
+    }
+
+    double Cond()
+    {
+        Need(kNodeCond);
+        return fFit.cond;
+    }
+
+    double ErrVA()
+    {
+        Need(kNodeErrors);
+        return fFit.err_V_A;
+    }
+
+    double ErrCond()
+    {
+        Need(kNodeErrors);
+        return fFit.err_cond;
+    }
+
+    const BetaResult &Beta()
+    {
+        Need(kNodeBeta);
+        return fBeta;
+    }
+
+    // Window().n valori, nullptr se il fit non e' riuscito
+    const double *Residuals()
+    {
+        Need(kNodeResiduals);
+        return fResiduals;
+    }
+
+    const BootstrapInterval &Bootstrap()
+    {
+        Need(kNodeBootstrap);
+        return fBootstrap;
+    }
+
+    const InfluenceResult &Influence()
+    {
+        Need(kNodeInfluence);
+        return fInfluence;
+    }
+
+    void Figure() { Need(kNodeFigure); }
+
+private:
+    void Need(int node)
+    {
+        if (fDone & NodeBit(node)) return;
+        for (int d = 0; d < node; ++d)
+            if (kNodeDeps[node] & NodeBit(d)) Need(d);
+        Compute(node);
+        fDone |= NodeBit(node);
+    }
+
+    void Compute(int node)
+    {
+        switch (node){
+        case kNodeWindow:
+            fWindow = SelectWindow(fCurve, fBatch.vMin, fBatch.vMax, fArena);
+            break;
+        case kNodeFit:
+            fFit = FitWindowEarly(fWindow);
+            break;
+        case kNodeVA:
+        case kNodeCond:
+        case kNodeErrors:
+            break;   // parti di EarlyResult (FillDerived): nessun calcolo in piu'
+        case kNodeBeta:
+            if (fHasPartner) fBeta = ComputeBeta(fCurve, fPartner, fGraph.betaVce);
+            break;
+        case kNodeResiduals:
+            if (fFit.ok) fResiduals = bjt::Residuals(fWindow, fFit, fArena);
+            break;
+        case kNodeBootstrap:
+            if (fFit.ok)
+                fBootstrap = BootstrapEarly(fWindow, fGraph.nBootstrap,
+                                            fBatch.seed ^ (uint64_t(fIndex) * 0x9E3779B97F4A7C15ULL), fArena);
+            break;
+        case kNodeInfluence:
+            fInfluence = InfluenceEarly(fWindow, fFit);
+            break;
+        case kNodeFigure:
+            if (fGraph.figure) fGraph.figure(fIndex, fFit);
+            break;
+        }
+    }
+
+    CurveView<Real> fCurve, fPartner;
+    bool fHasPartner = false;
+    const BatchConfig &fBatch;
+    const GraphConfig &fGraph;
+    MonotonicArena &fArena;
+    int fIndex;
+    unsigned fDone = 0;
+
+    FitWindow<Real> fWindow;
+    EarlyResult fFit;
+    BetaResult fBeta;
+    double *fResiduals = nullptr;
+    BootstrapInterval fBootstrap;
+    InfluenceResult fInfluence;
+};
+
+// Per ogni curva, la curva dello stesso dispositivo con la Ib successiva
+// (-1 se non c'e'): la compagna per beta
+template <typename Store>
+std::vector<int> PairByDevice(const Store &store)
+{
+    int n = store.GetNCurves();
+    std::vector<int> partner(n, -1);
+    std::map<unsigned, std::vector<int>> byDevice;
+    for (int i = 0; i < n; ++i) byDevice[store.GetDevice(i)].push_back(i);
+    for (auto &kv : byDevice){
+        std::vector<int> &v = kv.second;
+        std::sort(v.begin(), v.end(), [&](int x, int y){ return store.GetIb(x) < store.GetIb(y); });
+        for (size_t k = 0; k + 1 < v.size(); ++k)
+            if (store.GetIb(v[k + 1]) != store.GetIb(v[k])) partner[v[k]] = v[k + 1];
+    }
+    return partner;
+}
+
+// Uscite per curva; evaluated[i] ha i bit dei nodi calcolati
+struct GraphTable
+{
+    ResultTable res;               // fit, bootstrap e influenza
+    std::vector<double> beta, err_beta;
+    std::vector<double> maxResidual, vceMaxResidual;   // residuo normalizzato piu' grande
+    std::vector<unsigned> evaluated;
+
+    int GetN() const { return int(evaluated.size()); }
+
+    void Resize(int n)
+    {
+        res.Resize(n);
+        for (auto *c : {&beta, &err_beta, &maxResidual, &vceMaxResidual}) c->assign(n, 0.0);
+        evaluated.assign(n, 0u);
+    }
+
+    // Curve in cui il nodo e' stato calcolato
+    int CountEvaluated(int node) const
+    {
+        int k = 0;
+        for (unsigned e : evaluated) k += (e & NodeBit(node)) != 0;
+        return k;
+    }
+};
+
+// -----------------------------------------------------
+// Richiesta su tutte le curve dell'archivio. Se out ha gia' le curve
+// dell'archivio i nodi calcolati in precedenza non sono ripetuti; altrimenti
+// e' azzerata. partner (PairByDevice) serve solo per beta; se e' nullptr lo
+// si costruisce quando beta e' richiesto. Di bc contano finestra, seed,
+// nThreads e passthrough; bootstrap e influenza si chiedono con la richiesta.
+// -----------------------------------------------------
+template <typename Store>
+void AnalyzeBatchGraph(const Store &store, const BatchConfig &bc, const GraphConfig &gc, unsigned request,
+                       GraphTable &out, const std::vector<int> *partner = nullptr)
+{
+    using Real = typename Store::value_type;
+    int n = store.GetNCurves();
+    if (out.GetN() != n) out.Resize(n);
+    std::vector<int> pairs;
+    if ((request & NodeBit(kNodeBeta)) && !partner){
+        pairs = PairByDevice(store);
+        partner = &pairs;
+    }
+    unsigned need = NodeClosure(request);
+
+    ParallelChunks(n, bc.nThreads, kChunk, bc.passthrough, [&](int i, MonotonicArena &arena){
+        unsigned done = out.evaluated[i];
+        unsigned todo = need & ~done;
+        if (!todo) return;
+        ArenaScope scope(arena);
+        CurveAnalysis<Real> ca(store.Curve(i), bc, gc, arena, i);
+        if (done & NodeBit(kNodeFit)) ca.SeedFit(out.res.Get(i));
+        if (partner && (*partner)[i] >= 0) ca.SetPartner(store.Curve((*partner)[i]));
+        ca.Evaluate(todo);
+
+        if (todo & NodeBit(kNodeFit)) out.res.Set(i, ca.Fit());
+        bool fitOk = ca.Has(kNodeFit) && ca.Fit().ok;
+        if (todo & NodeBit(kNodeBeta)){
+            out.beta[i] = ca.Beta().beta;
+            out.err_beta[i] = ca.Beta().err_beta;
+        }
+        if ((todo & NodeBit(kNodeResiduals)) && fitOk){
+            const double *res = ca.Residuals();
+            const FitWindow<Real> &w = ca.Window();
+            int k = 0;
+            for (int j = 1; j < w.n; ++j)
+                if (std::fabs(res[j]) > std::fabs(res[k])) k = j;
+            out.maxResidual[i] = w.n > 0 ? res[k] : 0;
+            out.vceMaxResidual[i] = w.n > 0 ? w.V[k] : 0;
+        }
+        if ((todo & NodeBit(kNodeBootstrap)) && fitOk){
+            const BootstrapInterval &bi = ca.Bootstrap();
+            out.res.VA_lo[i] = bi.VA_lo;
+            out.res.VA_hi[i] = bi.VA_hi;
+            out.res.cond_lo[i] = bi.cond_lo;
+            out.res.cond_hi[i] = bi.cond_hi;
+        }
+        if (todo & NodeBit(kNodeInfluence)){
+            const InfluenceResult &ir = ca.Influence();
+            if (ir.ok){
+                const FitWindow<Real> &w = ca.Window();
+                out.res.maxCook[i] = ir.maxCook;
+                out.res.vceMaxCook[i] = w.V[ir.iMaxCook];
+                out.res.maxShiftVA[i] = ir.maxShiftVA;
+                out.res.vceMaxShiftVA[i] = w.V[ir.iMaxShiftVA];
+                out.res.jack_err_V_A[i] = ir.jack_err_V_A;
+                out.res.jack_err_cond[i] = ir.jack_err_cond;
+            }
+        }
+        out.evaluated[i] = done | ca.GetEvaluated();
+    });
+}
+
+} // namespace bjt
+
+#endif
@@ -0,0 +1,477 @@
+/*
+ * Analisi come servizio: protocollo, esecuzione dei lavori e client del
+ * server strumenti/server_analisi.cpp, che resta avviato e tiene pronti
+ * motore di fit e arene, senza pagare l'avvio di ROOT a ogni dispositivo.
+ *
+ * Il collegamento e' un socket Unix (stream). Ogni richiesta e' una riga di
+ * parole chiave=valore, eventualmente seguita da un corpo binario:
+ *   FIT id=7 ib=50 vmin=1 vmax=3.5 boot=0 infl=0 seed=1 file=/percorso/50.txt
+ *   FIT id=8 ib=100 n=25            seguita da 4 * 25 double (ordine della
+ *                                   macchina): Vce[25], Ic[25], errVce[25],
+ *                                   errIc[25]
+ *   STATS                           numero di lavori e latenza di servizio
+ * n va da 1 a kMaxJobPoints; con un n non valido il server risponde ERR e
+ * chiude il collegamento, perche' non sa quanti byte di corpo saltare.
+ * file= e' l'ultima chiave e prende il resto della riga (spazi compresi); il
+ * percorso e' letto dal server, quindi va dato assoluto. Le chiavi mancanti
+ * hanno i valori di BatchConfig.
+ *
+ * Risposte, una riga per richiesta e nello stesso ordine (le richieste di un
+ * client si possono mandare in pipeline):
+ *   OK id=7 us=8.1 ok=1 n=14 a=... err_a=... b=... err_b=... cov_ab=...
+ *      V_A=... err_V_A=... cond=... err_cond=... chi2=... ndf=...
+ *      [VA_lo= VA_hi= cond_lo= cond_hi=]   con boot > 0
+ *      [maxCook= maxShiftVA= jack_err_V_A= jack_err_cond=]   con infl=1
+ *   ERR id=7 messaggio
+ * us e' il tempo di servizio del lavoro nel server, dalla richiesta completa
+ * alla risposta pronta.
+ */
+
+#ifndef BJT_ANALYSISSERVICE_H
+#define BJT_ANALYSISSERVICE_H
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Arena.h"
+#include "Batch.h"
+#include "CurveStore.h"
+#include "EarlyFit.h"
+
+namespace bjt
+{
+
+constexpr const char *kDefaultServicePath = "/tmp/bjt_analisi.sock";
+constexpr int kMaxJobPoints = 1 << 20;   // limite del corpo binario
+
+struct AnalysisJob
+{
+    uint64_t id = 0;
+    double ib = 0;                 // [uA]
+    BatchConfig cfg;               // vMin, vMax, nBootstrap, influence, seed
+    std::string file;              // curva da file, oppure
+    int n = 0;                     // n punti nel corpo binario
+};
+
+struct JobReply
+{
+    uint64_t id = 0;
+    bool ok = false;               // lavoro eseguito (il fit puo' non essere riuscito: r.ok)
+    std::string error;
+    double serviceUs = 0;
+    EarlyResult r;
+    BootstrapInterval bi;
+    InfluenceResult ir;
+};
+
+// Valore della chiave key= nella riga, o nullptr
+inline const char *FindKey(const std::string &line, const char *key)
+{
+    size_t k = std::strlen(key);
+    for (size_t p = line.find(' '); p != std::string::npos; p = line.find(' ', p + 1)){
+        if (line.compare(p + 1, k, key) == 0 && line.size() > p + 1 + k && line[p + 1 + k] == '=')
+            return line.c_str() + p + 2 + k;
+        if (line.compare(p + 1, 5, "file=") == 0) break;   // il resto e' il percorso
+    }
+    return nullptr;
+}
+
+// Punti del corpo binario dichiarati con n=: 0 senza la chiave, -1 se il
+// valore non e' un intero in [1, kMaxJobPoints]. Server e ParseJob usano
+// questo stesso valore, cosi' la lunghezza del corpo e' letta una volta sola.
+inline int BodyPoints(const std::string &line)
+{
+    const char *v = FindKey(line, "n");
+    if (!v) return 0;
+    char *end = nullptr;
+    errno = 0;
+    long n = std::strtol(v, &end, 10);
+    if (end == v || (*end != '\0' && *end != ' ') || errno == ERANGE || n < 1 || n > kMaxJobPoints) return -1;
+    return int(n);
+}
+
+// -----------------------------------------------------
+// Riga FIT -> lavoro; false con il messaggio in error se non e' valida
+// -----------------------------------------------------
+inline bool ParseJob(const std::string &line, AnalysisJob &job, std::string &error)
+{
+    job = AnalysisJob();
+    if (line.compare(0, 4, "FIT ") != 0){
+        error = "richiesta sconosciuta";
+        return false;
+    }
+    const char *v;
+    if ((v = FindKey(line, "id"))) job.id = std::strtoull(v, nullptr, 10);
+    if ((v = FindKey(line, "ib"))) job.ib = std::atof(v);
+    if ((v = FindKey(line, "vmin"))) job.cfg.vMin = std::atof(v);
+    if ((v = FindKey(line, "vmax"))) job.cfg.vMax = std::atof(v);
+    if ((v = FindKey(line, "boot"))) job.cfg.nBootstrap = std::atoi(v);
+    if ((v = FindKey(line, "infl"))) job.cfg.influence = std::atoi(v) != 0;
+    if ((v = FindKey(line, "seed"))) job.cfg.seed = std::strtoull(v, nullptr, 10);
+    job.n = BodyPoints(line);
+    size_t f = line.find(" file=");
+    if (f != std::string::npos) job.file = line.substr(f + 6);
+
+    if (job.n < 0){
+        error = "n fuori dai limiti";
+        return false;
+    }
+    if (job.file.empty() == (job.n == 0)){
+        error = "serve file= oppure n=";
+        return false;
+    }
+    if (job.cfg.nBootstrap < 0 || job.cfg.nBootstrap > 100000){
+        error = "boot fuori dai limiti";
+        return false;
+    }
+    return true;
+}
+
+inline std::string FormatJob(const AnalysisJob &job)
+{
+    char buf[256];
+    std::snprintf(buf, sizeof(buf), "FIT id=%llu ib=%.17g vmin=%.17g vmax=%.17g boot=%d infl=%d seed=%llu",
+                  (unsigned long long)job.id, job.ib, job.cfg.vMin, job.cfg.vMax, job.cfg.nBootstrap,
+                  int(job.cfg.influence), (unsigned long long)job.cfg.seed);
+    std::string s = buf;
+    if (job.file.empty())
+        s += " n=" + std::to_string(job.n);
+    else
+        s += " file=" + job.file;
+    return s + "\n";
+}
+
+// -----------------------------------------------------
+// Esecuzione di un lavoro sulla curva c (gia' letta) con l'arena del thread
+// -----------------------------------------------------
+template <typename Real>
+JobReply RunJob(const AnalysisJob &job, const CurveView<Real> &c, MonotonicArena &arena)
+{
+    JobReply rep;
+    rep.id = job.id;
+    rep.ok = true;
+    ArenaScope scope(arena);
+    FitWindow<Real> w = SelectWindow(c, job.cfg.vMin, job.cfg.vMax, arena);
+    rep.r = FitWindowEarly(w);
+    if (rep.r.ok && job.cfg.nBootstrap > 0)
+        rep.bi = BootstrapEarly(w, job.cfg.nBootstrap, job.cfg.seed, arena);
+    if (rep.r.ok && job.cfg.influence) rep.ir = InfluenceEarly(w, rep.r);
+    return rep;
+}
+
+inline std::string FormatReply(const JobReply &rep, const AnalysisJob &job)
+{
+    char buf[1024];
+    if (!rep.ok){
+        std::snprintf(buf, sizeof(buf), "ERR id=%llu %s\n", (unsigned long long)rep.id, rep.error.c_str());
+        return buf;
+    }
+    const EarlyResult &r = rep.r;
+    int k = std::snprintf(buf, sizeof(buf),
+                          "OK id=%llu us=%.3f ok=%d n=%d a=%.17g err_a=%.17g b=%.17g err_b=%.17g cov_ab=%.17g "
+                          "V_A=%.17g err_V_A=%.17g cond=%.17g err_cond=%.17g chi2=%.17g ndf=%d",
+                          (unsigned long long)rep.id, rep.serviceUs, int(r.ok), r.nPoints, r.a, r.err_a, r.b,
+                          r.err_b, r.cov_ab, r.V_A, r.err_V_A, r.cond, r.err_cond, r.chi2, r.ndf);
+    if (job.cfg.nBootstrap > 0)
+        k += std::snprintf(buf + k, sizeof(buf) - k, " VA_lo=%.17g VA_hi=%.17g cond_lo=%.17g cond_hi=%.17g",
+                           rep.bi.VA_lo, rep.bi.VA_hi, rep.bi.cond_lo, rep.bi.cond_hi);
+    if (job.cfg.influence)
+        k += std::snprintf(buf + k, sizeof(buf) - k, " maxCook=%.17g maxShiftVA=%.17g jack_err_V_A=%.17g "
+                           "jack_err_cond=%.17g", rep.ir.maxCook, rep.ir.maxShiftVA, rep.ir.jack_err_V_A,
+                           rep.ir.jack_err_cond);
+    return std::string(buf, size_t(std::min<int>(k, sizeof(buf) - 1))) + "\n";
+}
+
+inline bool ParseReply(const std::string &line, JobReply &rep)
+{
+    rep = JobReply();
+    const char *v;
+    if ((v = FindKey(line, "id"))) rep.id = std::strtoull(v, nullptr, 10);
+    if (line.compare(0, 3, "OK ") != 0){
+        size_t p = line.find(' ', line.find("id="));
+        rep.error = p == std::string::npos ? line : line.substr(p + 1);
+        return false;
+    }
+    rep.ok = true;
+    auto num = [&](const char *key){
+        const char *x = FindKey(line, key);
+        return x ? std::strtod(x, nullptr) : 0.0;
+    };
+    rep.serviceUs = num("us");
+    EarlyResult &r = rep.r;
+    r.ok = num("ok") != 0;
+    r.nPoints = int(num("n"));
+    r.a = num("a");
+    r.err_a = num("err_a");
+    r.b = num("b");
+    r.err_b = num("err_b");
+    r.cov_ab = num("cov_ab");
+    r.V_A = num("V_A");
+    r.err_V_A = num("err_V_A");
+    r.cond = num("cond");
+    r.err_cond = num("err_cond");
+    r.chi2 = num("chi2");
+    r.ndf = int(num("ndf"));
+    rep.bi.VA_lo = num("VA_lo");
+    rep.bi.VA_hi = num("VA_hi");
+    rep.bi.cond_lo = num("cond_lo");
+    rep.bi.cond_hi = num("cond_hi");
+    rep.ir.maxCook = num("maxCook");
+    rep.ir.maxShiftVA = num("maxShiftVA");
+    rep.ir.jack_err_V_A = num("jack_err_V_A");
+    rep.ir.jack_err_cond = num("jack_err_cond");
+    rep.ir.ok = FindKey(line, "maxCook") != nullptr;
+    return true;
+}
+
+// -----------------------------------------------------
+// Latenze di servizio: le ultime kKeep, per mediana e percentili
+// -----------------------------------------------------
+class LatencyStats
+{
+public:
+    static constexpr size_t kKeep = 1 << 16;
+
+    void Add(double us, bool error)
+    {
+        std::lock_guard<std::mutex> lock(fMutex);
+        if (fLast.size() < kKeep)
+            fLast.push_back(us);
+        else
+            fLast[fJobs % kKeep] = us;
+        ++fJobs;
+        fErrors += error;
+        fSum += us;
+        fMax = std::max(fMax, us);
+    }
+
+    // Riga di risposta a STATS
+    std::string Report()
+    {
+        std::vector<double> v;
+        unsigned long long jobs, errors;
+        double sum, mx;
+        {
+            std::lock_guard<std::mutex> lock(fMutex);
+            v = fLast;
+            jobs = fJobs;
+            errors = fErrors;
+            sum = fSum;
+            mx = fMax;
+        }
+        auto q = [&](double p){
+            if (v.empty()) return 0.0;
+            size_t k = std::min(v.size() - 1, size_t(p * (v.size() - 1) + 0.5));
+            std::nth_element(v.begin(), v.begin() + k, v.end());
+            return v[k];
+        };
+        char buf[256];
+        std::snprintf(buf, sizeof(buf), "OK jobs=%llu errors=%llu mean_us=%.3f p50_us=%.3f p99_us=%.3f max_us=%.3f\n",
+                      jobs, errors, jobs ? sum / jobs : 0.0, q(0.5), q(0.99), mx);
+        return buf;
+    }
+
+private:
+    std::mutex fMutex;
+    std::vector<double> fLast;
+    unsigned long long fJobs = 0, fErrors = 0;
+    double fSum = 0, fMax = 0;
+};
+
+// -----------------------------------------------------
+// Client del server di analisi
+// -----------------------------------------------------
+class AnalysisClient
+{
+public:
+    AnalysisClient() = default;
+    AnalysisClient(const AnalysisClient &) = delete;
+    AnalysisClient &operator=(const AnalysisClient &) = delete;
+    ~AnalysisClient() { Close(); }
+
+    bool Connect(const char *path = kDefaultServicePath)
+    {
+        Close();
+        fBuf.clear();
+        fPos = 0;
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (std::strlen(path) >= sizeof(addr.sun_path)) return Fail("percorso del socket troppo lungo");
+        std::strcpy(addr.sun_path, path);
+        fFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fFd < 0) return Fail("socket non disponibile");
+        if (::connect(fFd, (sockaddr *)&addr, sizeof(addr)) != 0){
+            Close();
+            return Fail("server non raggiungibile");
+        }
+        return true;
+    }
+
+    void Close()
+    {
+        if (fFd >= 0) ::close(fFd);
+        fFd = -1;
+    }
+
+    bool IsOpen() const { return fFd >= 0; }
+    const std::string &GetError() const { return fError; }
+
+    // Invia un lavoro senza attendere la risposta (pipeline). Per i lavori
+    // senza file, c sono i punti da mandare nel corpo.
+    template <typename Real>
+    bool Send(AnalysisJob job, const CurveView<Real> *c = nullptr)
+    {
+        if (!c) return Write(FormatJob(job));
+        if (c->n < 1 || c->n > kMaxJobPoints) return Fail("numero di punti fuori dai limiti del protocollo");
+        job.n = c->n;
+        job.file.clear();
+        std::string msg = FormatJob(job);
+        size_t head = msg.size();
+        msg.resize(head + 4 * sizeof(double) * c->n);
+        char *body = &msg[head];
+        const Real *cols[4] = {c->vce, c->ic, c->errVce, c->errIc};
+        for (int k = 0; k < 4; ++k)
+            for (int i = 0; i < c->n; ++i){
+                double x = cols[k][i];
+                std::memcpy(body + (size_t(k) * c->n + i) * sizeof(double), &x, sizeof(double));
+            }
+        return Write(msg);
+    }
+
+    bool Send(const AnalysisJob &job) { return Send<double>(job, nullptr); }
+
+    // Risposta al prossimo lavoro inviato; false se il collegamento e'
+    // caduto. Se il server ha risposto ERR, rep.ok e' false e il messaggio
+    // e' in rep.error.
+    bool Receive(JobReply &rep, int timeoutMs = 10000)
+    {
+        std::string line;
+        if (!ReadLine(line, timeoutMs)) return false;
+        ParseReply(line, rep);
+        return true;
+    }
+
+    template <typename Real>
+    bool Call(const AnalysisJob &job, const CurveView<Real> *c, JobReply &rep)
+    {
+        return Send(job, c) && Receive(rep);
+    }
+
+    bool Call(const AnalysisJob &job, JobReply &rep) { return Send(job) && Receive(rep); }
+
+    // Statistiche del server (riga di risposta a STATS)
+    bool Stats(std::string &reply) { return Write("STATS\n") && ReadLine(reply, 10000); }
+
+private:
+    bool Fail(const char *what)
+    {
+        fError = what;
+        return false;
+    }
+
+    bool Write(const std::string &msg)
+    {
+        const char *p = msg.data();
+        size_t left = msg.size();
+        while (left > 0){
+            ssize_t w = ::send(fFd, p, left, MSG_NOSIGNAL);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) return Fail("scrittura fallita");
+            p += w;
+            left -= size_t(w);
+        }
+        return true;
+    }
+
+    bool ReadLine(std::string &line, int timeoutMs)
+    {
+        for (;;){
+            size_t nl = fBuf.find('\n', fPos);
+            if (nl != std::string::npos){
+                line.assign(fBuf, fPos, nl - fPos);
+                fPos = nl + 1;
+                if (fPos > 65536){
+                    fBuf.erase(0, fPos);
+                    fPos = 0;
+                }
+                return true;
+            }
+            pollfd pfd{fFd, POLLIN, 0};
+            int r = ::poll(&pfd, 1, timeoutMs);
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) return Fail("nessuna risposta entro il tempo limite");
+            char tmp[65536];
+            ssize_t n = ::read(fFd, tmp, sizeof(tmp));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return Fail("collegamento chiuso");
+            fBuf.append(tmp, size_t(n));
+        }
+    }
+
+    int fFd = -1;
+    std::string fBuf;
+    size_t fPos = 0;
+    std::string fError;
+};
+
+// -----------------------------------------------------
+// Tutte le curve dell'archivio sul server, con al piu' depth lavori in
+// volo; risultati in out come AnalyzeBatch. Restituisce il numero di
+// risposte ERR, -1 se il collegamento cade o la risposta non corrisponde a
+// un lavoro inviato.
+// -----------------------------------------------------
+template <typename Store>
+int AnalyzeRemote(AnalysisClient &client, const Store &store, const BatchConfig &cfg, ResultTable &out,
+                  int depth = 64)
+{
+    int n = store.GetNCurves();
+    out.Resize(n);
+    AnalysisJob job;
+    job.cfg = cfg;
+    int sent = 0, received = 0, errors = 0;
+    while (received < n){
+        while (sent < n && sent - received < depth){
+            auto c = store.Curve(sent);
+            job.id = uint64_t(sent);
+            job.ib = c.ib;
+            job.cfg.seed = cfg.seed ^ (uint64_t(sent) * 0x9E3779B97F4A7C15ULL);   // come AnalyzeBatch
+            if (!client.Send(job, &c)) return -1;
+            ++sent;
+        }
+        JobReply rep;
+        if (!client.Receive(rep)) return -1;
+        if (rep.id >= uint64_t(sent)) return -1;   // risposta a un lavoro mai inviato
+        if (!rep.ok)
+            ++errors;
+        else{
+            int i = int(rep.id);
+            out.Set(i, rep.r);
+            out.VA_lo[i] = rep.bi.VA_lo;
+            out.VA_hi[i] = rep.bi.VA_hi;
+            out.cond_lo[i] = rep.bi.cond_lo;
+            out.cond_hi[i] = rep.bi.cond_hi;
+            out.maxCook[i] = rep.ir.maxCook;
+            out.maxShiftVA[i] = rep.ir.maxShiftVA;
+            out.jack_err_V_A[i] = rep.ir.jack_err_V_A;
+            out.jack_err_cond[i] = rep.ir.jack_err_cond;
+        }
+        ++received;
+    }
+    return errors;
+}
+
+} // namespace bjt
+
+#endif
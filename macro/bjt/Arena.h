@@ -0,0 +1,174 @@
+/*
+ * Allocatore monotono per i buffer temporanei dell'analisi.
+ *
+ * Ogni curva ha bisogno di memoria di lavoro (punti nella finestra di fit,
+ * residui, repliche bootstrap) che vive solo fino alla curva successiva.
+ * Con new/malloc l'allocatore globale diventa un punto di contesa quando
+ * l'analisi gira su molti thread; qui ogni thread ha la sua arena
+ * (ScratchArena()) e allocare costa un incremento di puntatore.
+ *
+ * Reset() riporta l'arena all'inizio in O(1) senza restituire memoria: i
+ * blocchi gia' ottenuti sono riusati dal batch successivo. ArenaScope
+ * ripristina la posizione (ed eventualmente la modalita') all'uscita da un
+ * blocco di codice.
+ *
+ * In modalita' passthrough ogni allocazione passa a malloc e viene liberata
+ * a Reset()/fine scope: serve solo per confrontare le prestazioni.
+ */
+
+#ifndef BJT_ARENA_H
+#define BJT_ARENA_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+namespace bjt
+{
+
+class MonotonicArena
+{
+public:
+    explicit MonotonicArena(size_t blockBytes = size_t(1) << 20) : fBlockBytes(blockBytes) {}
+    ~MonotonicArena()
+    {
+        Release();
+        for (auto &b : fBlocks) std::free(b.data);
+    }
+    MonotonicArena(const MonotonicArena &) = delete;
+    MonotonicArena &operator=(const MonotonicArena &) = delete;
+
+    // Posizione corrente, per ArenaScope
+    struct Marker
+    {
+        size_t block, used, heap;
+    };
+
+    void *Allocate(size_t bytes, size_t align = 64)
+    {
+        if (fPassthrough){
+            void *p = std::aligned_alloc(align, (bytes + align - 1) / align * align);
+            if (!p) throw std::bad_alloc();
+            fHeap.push_back(p);
+            return p;
+        }
+        while (fBlock < fBlocks.size()){
+            Block &b = fBlocks[fBlock];
+            size_t start = (fUsed + align - 1) / align * align;
+            if (start + bytes <= b.size){
+                fUsed = start + bytes;
+                return b.data + start;
+            }
+            ++fBlock;
+            fUsed = 0;
+        }
+        size_t size = bytes + align > fBlockBytes ? bytes + align : fBlockBytes;
+        char *data = static_cast<char *>(std::aligned_alloc(64, (size + 63) / 64 * 64));
+        if (!data) throw std::bad_alloc();
+        fBlocks.push_back({data, size});
+        fBlock = fBlocks.size() - 1;
+        fUsed = bytes;
+        return data;
+    }
+
+    // Array non inizializzato di n elementi (solo tipi banali)
+    template <typename T>
+    T *Allocate(size_t n)
+    {
+        return static_cast<T *>(Allocate(n * sizeof(T), alignof(T) > 64 ? alignof(T) : 64));
+    }
+
+    Marker GetMarker() const { return {fBlock, fUsed, fHeap.size()}; }
+
+    void Rewind(const Marker &m)
+    {
+        while (fHeap.size() > m.heap){
+            std::free(fHeap.back());
+            fHeap.pop_back();
+        }
+        fBlock = m.block;
+        fUsed = m.used;
+    }
+
+    // O(1): i blocchi restano disponibili per il batch successivo
+    void Reset()
+    {
+        Release();
+        fBlock = 0;
+        fUsed = 0;
+    }
+
+    void SetPassthrough(bool on)
+    {
+        Reset();
+        fPassthrough = on;
+    }
+    bool IsPassthrough() const { return fPassthrough; }
+
+    // Cambia modalita' senza azzerare: le allocazioni gia' fatte restano
+    // valide e un Rewind a un marker precedente libera anche le nuove
+    void SwitchPassthrough(bool on) { fPassthrough = on; }
+
+    size_t GetCapacity() const
+    {
+        size_t s = 0;
+        for (auto &b : fBlocks) s += b.size;
+        return s;
+    }
+
+private:
+    struct Block
+    {
+        char *data;
+        size_t size;
+    };
+
+    void Release()
+    {
+        for (void *p : fHeap) std::free(p);
+        fHeap.clear();
+    }
+
+    size_t fBlockBytes;
+    std::vector<Block> fBlocks;
+    size_t fBlock = 0;             // blocco corrente
+    size_t fUsed = 0;              // byte usati nel blocco corrente
+    bool fPassthrough = false;
+    std::vector<void *> fHeap;     // allocazioni in modalita' passthrough
+};
+
+// Arena di lavoro del thread corrente
+inline MonotonicArena &ScratchArena()
+{
+    thread_local MonotonicArena arena;
+    return arena;
+}
+
+// Ripristina la posizione dell'arena all'uscita dallo scope; con il secondo
+// argomento lo scope usa quella modalita' e all'uscita rimette la precedente
+class ArenaScope
+{
+public:
+    explicit ArenaScope(MonotonicArena &arena)
+        : fArena(arena), fMarker(arena.GetMarker()), fPassthrough(arena.IsPassthrough())
+    {
+    }
+    ArenaScope(MonotonicArena &arena, bool passthrough) : ArenaScope(arena) { arena.SwitchPassthrough(passthrough); }
+    ~ArenaScope()
+    {
+        fArena.Rewind(fMarker);
+        fArena.SwitchPassthrough(fPassthrough);
+    }
+    ArenaScope(const ArenaScope &) = delete;
+    ArenaScope &operator=(const ArenaScope &) = delete;
+
+private:
+    MonotonicArena &fArena;
+    MonotonicArena::Marker fMarker;
+    bool fPassthrough;
+};
+
+} // namespace bjt
+
+#endif
@@ -0,0 +1,238 @@
+/*
+ * Analisi in blocco di tutte le curve di un archivio, su piu' thread.
+ * L'archivio puo' essere un CurveStore o una vista CurveColumns su array
+ * esterni (ad es. numpy, vedi bjt_numpy.py).
+ *
+ * Le curve sono distribuite ai thread a blocchi di kChunk; ogni thread usa la
+ * propria arena (ScratchArena()) e la azzera in O(1) alla fine di ogni blocco.
+ * I risultati vanno in una ResultTable per colonne, indicizzata come le curve
+ * dell'archivio.
+ */
+
+#ifndef BJT_BATCH_H
+#define BJT_BATCH_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "Arena.h"
+#include "CurveStore.h"
+#include "EarlyFit.h"
+
+namespace bjt
+{
+
+struct BatchConfig
+{
+    double vMin = 1.0;             // finestra di fit [V]
+    double vMax = 3.5;
+    int nThreads = 1;              // 0 = std::thread::hardware_concurrency()
+    int nBootstrap = 0;            // repliche bootstrap per curva (0 = nessuna)
+    bool influence = false;        // leverage, Cook e jackknife (InfluenceEarly)
+    uint64_t seed = 1;
+    bool passthrough = false;      // scratch con malloc (solo per confronto)
+};
+
+// Risultati per curva, una colonna per grandezza
+struct ResultTable
+{
+    std::vector<double> a, err_a, b, err_b, cov_ab;
+    std::vector<double> V_A, err_V_A, cond, err_cond, chi2;
+    std::vector<int> ndf, nPoints;
+    std::vector<int> ok;
+    std::vector<double> VA_lo, VA_hi, cond_lo, cond_hi;   // bootstrap
+    std::vector<double> maxCook, vceMaxCook;              // influenza: punto con Cook massimo
+    std::vector<double> maxShiftVA, vceMaxShiftVA;        // e punto che sposta di piu' V_A [err_V_A]
+    std::vector<double> jack_err_V_A, jack_err_cond;
+
+    int GetN() const { return int(a.size()); }
+
+    void Resize(int n)
+    {
+        for (auto *c : {&a, &err_a, &b, &err_b, &cov_ab, &V_A, &err_V_A, &cond, &err_cond, &chi2,
+                        &VA_lo, &VA_hi, &cond_lo, &cond_hi, &maxCook, &vceMaxCook, &maxShiftVA,
+                        &vceMaxShiftVA, &jack_err_V_A, &jack_err_cond})
+            c->assign(n, 0.0);
+        ndf.assign(n, 0);
+        nPoints.assign(n, 0);
+        ok.assign(n, 0);
+    }
+
+    // Aggiunge una riga in fondo (analisi incrementale); restituisce l'indice
+    int Append(const EarlyResult &r)
+    {
+        int i = GetN();
+        for (auto *c : {&a, &err_a, &b, &err_b, &cov_ab, &V_A, &err_V_A, &cond, &err_cond, &chi2,
+                        &VA_lo, &VA_hi, &cond_lo, &cond_hi, &maxCook, &vceMaxCook, &maxShiftVA,
+                        &vceMaxShiftVA, &jack_err_V_A, &jack_err_cond})
+            c->push_back(0.0);
+        ndf.push_back(0);
+        nPoints.push_back(0);
+        ok.push_back(0);
+        Set(i, r);
+        return i;
+    }
+
+    void Set(int i, const EarlyResult &r)
+    {
+        a[i] = r.a;
+        err_a[i] = r.err_a;
+        b[i] = r.b;
+        err_b[i] = r.err_b;
+        cov_ab[i] = r.cov_ab;
+        V_A[i] = r.V_A;
+        err_V_A[i] = r.err_V_A;
+        cond[i] = r.cond;
+        err_cond[i] = r.err_cond;
+        chi2[i] = r.chi2;
+        ndf[i] = r.ndf;
+        nPoints[i] = r.nPoints;
+        ok[i] = r.ok;
+    }
+
+    EarlyResult Get(int i) const
+    {
+        EarlyResult r;
+        r.a = a[i];
+        r.err_a = err_a[i];
+        r.b = b[i];
+        r.err_b = err_b[i];
+        r.cov_ab = cov_ab[i];
+        r.V_A = V_A[i];
+        r.err_V_A = err_V_A[i];
+        r.cond = cond[i];
+        r.err_cond = err_cond[i];
+        r.chi2 = chi2[i];
+        r.ndf = ndf[i];
+        r.nPoints = nPoints[i];
+        r.ok = ok[i];
+        return r;
+    }
+};
+
+inline int ResolveThreads(int n)
+{
+    if (n > 0) return n;
+    unsigned h = std::thread::hardware_concurrency();
+    return h > 0 ? int(h) : 1;
+}
+
+// Esegue fn(i) per ogni i in [0, n) su nThreads thread, a blocchi di chunk;
+// dopo ogni blocco l'arena del thread torna alla posizione iniziale. Con un
+// thread solo l'arena e' quella del chiamante: le sue allocazioni restano
+template <typename Fn>
+void ParallelChunks(int n, int nThreads, int chunk, bool passthrough, Fn fn)
+{
+    std::atomic<int> next(0);
+    auto worker = [&](){
+        MonotonicArena &arena = ScratchArena();
+        ArenaScope scope(arena, passthrough);
+        MonotonicArena::Marker start = arena.GetMarker();
+        for (;;){
+            int begin = next.fetch_add(chunk);
+            if (begin >= n) break;
+            int end = std::min(n, begin + chunk);
+            for (int i = begin; i < end; ++i) fn(i, arena);
+            arena.Rewind(start);
+        }
+    };
+    nThreads = std::max(1, std::min(ResolveThreads(nThreads), (n + chunk - 1) / chunk));
+    if (nThreads == 1){
+        worker();
+        return;
+    }
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nThreads; ++t) threads.emplace_back(worker);
+    for (auto &t : threads) t.join();
+}
+
+// Come ParallelChunks, con uno stato per thread (copia di init) passato a
+// fn(i, arena, state); alla fine gli stati sono combinati in init con
+// merge(init, state), nell'ordine dei thread
+template <typename State, typename Fn, typename Merge>
+void ParallelReduce(int n, int nThreads, int chunk, bool passthrough, State &init, Fn fn, Merge merge)
+{
+    nThreads = std::max(1, std::min(ResolveThreads(nThreads), (n + chunk - 1) / chunk));
+    std::vector<State> states(nThreads, init);
+    std::atomic<int> next(0);
+    auto worker = [&](int t){
+        MonotonicArena &arena = ScratchArena();
+        ArenaScope scope(arena, passthrough);
+        MonotonicArena::Marker start = arena.GetMarker();
+        for (;;){
+            int begin = next.fetch_add(chunk);
+            if (begin >= n) break;
+            int end = std::min(n, begin + chunk);
+            for (int i = begin; i < end; ++i) fn(i, arena, states[t]);
+            arena.Rewind(start);
+        }
+    };
+    if (nThreads == 1)
+        worker(0);
+    else {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < nThreads; ++t) threads.emplace_back(worker, t);
+        for (auto &t : threads) t.join();
+    }
+    for (const State &s : states) merge(init, s);
+}
+
+constexpr int kChunk = 64;
+
+// -----------------------------------------------------
+// Fit (ed eventualmente bootstrap) di tutte le curve dell'archivio
+// -----------------------------------------------------
+template <typename Store>
+void AnalyzeBatch(const Store &store, const BatchConfig &cfg, ResultTable &out)
+{
+    using Real = typename Store::value_type;
+    int n = store.GetNCurves();
+    out.Resize(n);
+    ParallelChunks(n, cfg.nThreads, kChunk, cfg.passthrough, [&](int i, MonotonicArena &arena){
+        ArenaScope scope(arena);
+        FitWindow<Real> w = SelectWindow(store.Curve(i), cfg.vMin, cfg.vMax, arena);
+        EarlyResult r = FitWindowEarly(w);
+        out.Set(i, r);
+        if (r.ok && cfg.nBootstrap > 0){
+            BootstrapInterval bi = BootstrapEarly(w, cfg.nBootstrap, cfg.seed ^ (uint64_t(i) * 0x9E3779B97F4A7C15ULL), arena);
+            out.VA_lo[i] = bi.VA_lo;
+            out.VA_hi[i] = bi.VA_hi;
+            out.cond_lo[i] = bi.cond_lo;
+            out.cond_hi[i] = bi.cond_hi;
+        }
+        if (r.ok && cfg.influence){
+            InfluenceResult ir = InfluenceEarly(w, r);
+            if (ir.ok){
+                out.maxCook[i] = ir.maxCook;
+                out.vceMaxCook[i] = w.V[ir.iMaxCook];
+                out.maxShiftVA[i] = ir.maxShiftVA;
+                out.vceMaxShiftVA[i] = w.V[ir.iMaxShiftVA];
+                out.jack_err_V_A[i] = ir.jack_err_V_A;
+                out.jack_err_cond[i] = ir.jack_err_cond;
+            }
+        }
+    });
+}
+
+// Versioni non template per PyROOT: colonne contigue, offset e (facoltativo)
+// numero di punti per curva, come in CurveColumns
+inline void AnalyzeColumnsD(const double *vce, const double *ic, const double *errVce, const double *errIc,
+                            const int64_t *offsets, const int32_t *counts, int nCurves,
+                            const BatchConfig &cfg, ResultTable &out)
+{
+    AnalyzeBatch(CurveColumns<double>(vce, ic, errVce, errIc, offsets, nCurves, counts), cfg, out);
+}
+
+inline void AnalyzeColumnsF(const float *vce, const float *ic, const float *errVce, const float *errIc,
+                            const int64_t *offsets, const int32_t *counts, int nCurves,
+                            const BatchConfig &cfg, ResultTable &out)
+{
+    AnalyzeBatch(CurveColumns<float>(vce, ic, errVce, errIc, offsets, nCurves, counts), cfg, out);
+}
+
+} // namespace bjt
+
+#endif
@@ -0,0 +1,76 @@
+/*
+ * Stima del guadagno di corrente beta = Delta Ic / Delta Ib a Vce fissata.
+ *
+ * Come nella relazione si confrontano le correnti di collettore di due curve
+ * (due correnti di base) alla stessa tensione Vce. Se la tensione richiesta non
+ * e' tra i punti misurati, Ic e' interpolata linearmente tra i due punti
+ * adiacenti.
+ */
+
+#ifndef BJT_BETA_H
+#define BJT_BETA_H
+
+#include <cmath>
+
+#include "CurveStore.h"
+
+namespace bjt
+{
+
+struct BetaResult
+{
+    double vce = 0;                 // [V]
+    double icA = 0, errIcA = 0;     // [mA]
+    double icB = 0, errIcB = 0;     // [mA]
+    double beta = 0, err_beta = 0;
+    bool ok = false;
+};
+
+// -----------------------------------------------------
+// Ic alla tensione v. Le curve possono essere in ordine crescente o
+// decrescente di Vce. L'errore dell'interpolazione combina quelli dei due
+// punti con i rispettivi pesi. Restituisce false se v e' fuori dalla curva.
+// -----------------------------------------------------
+template <typename Real>
+bool InterpolateIc(const CurveView<Real> &c, double v, double &ic, double &err)
+{
+    int lo = -1, hi = -1;
+    for (int i = 0; i < c.n; ++i){
+        double x = c.vce[i];
+        if (std::fabs(x - v) < 1e-9){
+            ic = c.ic[i];
+            err = c.errIc[i];
+            return true;
+        }
+        if (x < v && (lo < 0 || x > c.vce[lo])) lo = i;
+        if (x > v && (hi < 0 || x < c.vce[hi])) hi = i;
+    }
+    if (lo < 0 || hi < 0) return false;
+
+    double w = (v - c.vce[lo]) / (double(c.vce[hi]) - c.vce[lo]);
+    ic = (1 - w) * c.ic[lo] + w * c.ic[hi];
+    err = std::sqrt((1 - w) * (1 - w) * double(c.errIc[lo]) * c.errIc[lo] +
+                    w * w * double(c.errIc[hi]) * c.errIc[hi]);
+    return true;
+}
+
+// beta tra le curve a e b alla tensione vce (Ib in uA, Ic in mA)
+template <typename Real>
+BetaResult ComputeBeta(const CurveView<Real> &a, const CurveView<Real> &b, double vce)
+{
+    BetaResult r;
+    r.vce = vce;
+    double dIb = b.ib - a.ib;
+    if (dIb == 0) return r;
+    if (!InterpolateIc(a, vce, r.icA, r.errIcA)) return r;
+    if (!InterpolateIc(b, vce, r.icB, r.errIcB)) return r;
+
+    r.beta = (r.icB - r.icA) / dIb * 1e3;
+    r.err_beta = std::sqrt(r.errIcA * r.errIcA + r.errIcB * r.errIcB) / std::fabs(dIb) * 1e3;
+    r.ok = true;
+    return r;
+}
+
+} // namespace bjt
+
+#endif
@@ -0,0 +1,188 @@
+/*
+ * Archivio delle calibrazioni degli strumenti, con validita' nel tempo.
+ *
+ * L'appendice della relazione tratta oscilloscopio e multimetro come ideali a
+ * parte le specifiche del costruttore; le tarature periodiche misurano invece
+ * una correzione di guadagno e di offset per ogni strumento:
+ *   x_vero = gain * x_letto + offset
+ * Ogni taratura vale per un intervallo di tempo [validFrom, validTo) ed e'
+ * identificata dal numero di serie dello strumento. All'acquisizione si
+ * correggono Vce con la taratura dell'oscilloscopio e Ic con quella del
+ * multimetro valide all'istante della misura, aggiornando gli errori nello
+ * stesso ciclo:
+ *   sigma'^2 = (gain * sigma)^2 + (x * err_gain)^2 + err_offset^2
+ * Gli archivi su disco (bjt/SweepArchive.h) conservano i dati grezzi, quindi
+ * per rianalizzare con tarature nuove basta rileggere l'archivio.
+ *
+ * Nota: l'incertezza della taratura e' comune a tutti i punti di una curva;
+ * sommarla in quadratura agli errori dei singoli punti la tratta come
+ * indipendente, come gia' avviene per il 3% del costruttore nei dati.
+ *
+ * Formato del file di tarature (una per riga, '#' per i commenti):
+ *   serie  dal(AAAA-MM-GG)  al(AAAA-MM-GG)  gain  err_gain  offset  err_offset
+ * con offset in V per l'oscilloscopio e in mA per il multimetro; la data
+ * finale e' esclusa, "-" indica una taratura ancora valida.
+ */
+
+#ifndef BJT_CALIBRATION_H
+#define BJT_CALIBRATION_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+#include "CurveStore.h"
+
+namespace bjt
+{
+
+struct CalibrationRecord
+{
+    unsigned serial = 0;
+    int64_t validFrom = 0;                                      // [s], tempo Unix
+    int64_t validTo = std::numeric_limits<int64_t>::max();      // escluso
+    double gain = 1, errGain = 0;
+    double offset = 0, errOffset = 0;
+};
+
+// Giorni dal 1970-01-01 della data civile (calendario gregoriano)
+inline int64_t DaysFromCivil(int64_t y, unsigned m, unsigned d)
+{
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    unsigned yoe = unsigned(y - era * 400);
+    unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + int64_t(doe) - 719468;
+}
+
+// "AAAA-MM-GG" -> tempo Unix della mezzanotte UTC; false se non e' una data
+inline bool ParseDate(const char *s, int64_t &t)
+{
+    int y, m, d;
+    if (std::sscanf(s, "%d-%d-%d", &y, &m, &d) != 3 || m < 1 || m > 12 || d < 1 || d > 31) return false;
+    t = DaysFromCivil(y, unsigned(m), unsigned(d)) * 86400;
+    return true;
+}
+
+// -----------------------------------------------------
+// Correzione di una colonna e del suo errore, in un solo passaggio
+// -----------------------------------------------------
+template <typename Real>
+void ApplyCalibration(const CalibrationRecord &c, Real *x, Real *err, int n)
+{
+    const double g = c.gain, eg2 = c.errGain * c.errGain, o = c.offset, eo2 = c.errOffset * c.errOffset;
+    for (int i = 0; i < n; ++i){
+        double xi = x[i], ei = err[i];
+        x[i] = Real(g * xi + o);
+        err[i] = Real(std::sqrt(g * g * ei * ei + xi * xi * eg2 + eo2));
+    }
+}
+
+class CalibrationDB
+{
+public:
+    // Aggiunge una taratura; false se l'intervallo e' vuoto o si sovrappone a
+    // un'altra taratura dello stesso strumento
+    bool Add(const CalibrationRecord &r)
+    {
+        if (r.validTo <= r.validFrom || !(r.gain > 0)) return false;
+        std::vector<CalibrationRecord> &v = fBySerial[r.serial];
+        auto it = std::lower_bound(v.begin(), v.end(), r.validFrom, [](const CalibrationRecord &a, int64_t t){
+            return a.validFrom < t;
+        });
+        if (it != v.end() && it->validFrom < r.validTo) return false;
+        if (it != v.begin() && std::prev(it)->validTo > r.validFrom) return false;
+        v.insert(it, r);
+        ++fN;
+        return true;
+    }
+
+    // Legge un file di tarature; restituisce il numero di righe accettate o
+    // -1 se il file non esiste. Le righe non valide sono contate in nBad.
+    int LoadFile(const char *path, int *nBad = nullptr)
+    {
+        FILE *f = std::fopen(path, "r");
+        if (!f) return -1;
+        int n = 0, bad = 0;
+        char line[512];
+        while (std::fgets(line, sizeof(line), f)){
+            char *hash = std::strchr(line, '#');
+            if (hash) *hash = 0;
+            unsigned serial;
+            char from[32], to[32];
+            CalibrationRecord r;
+            int k = std::sscanf(line, "%u %31s %31s %lg %lg %lg %lg", &serial, from, to, &r.gain, &r.errGain,
+                                &r.offset, &r.errOffset);
+            if (k <= 0) continue;   // riga vuota
+            r.serial = serial;
+            bool ok = k == 7 && ParseDate(from, r.validFrom) &&
+                      (std::strcmp(to, "-") == 0 || ParseDate(to, r.validTo)) && Add(r);
+            if (ok)
+                ++n;
+            else
+                ++bad;
+        }
+        std::fclose(f);
+        if (nBad) *nBad = bad;
+        return n;
+    }
+
+    // Taratura dello strumento valida all'istante t, nullptr se non c'e'
+    const CalibrationRecord *Find(unsigned serial, int64_t t) const
+    {
+        auto s = fBySerial.find(serial);
+        if (s == fBySerial.end()) return nullptr;
+        const std::vector<CalibrationRecord> &v = s->second;
+        auto it = std::upper_bound(v.begin(), v.end(), t, [](int64_t t, const CalibrationRecord &r){
+            return t < r.validFrom;
+        });
+        if (it == v.begin()) return nullptr;
+        --it;
+        return t < it->validTo ? &*it : nullptr;
+    }
+
+    // Corregge le colonne di una curva secondo i metadati (strumenti e
+    // istante della misura). Restituisce true se entrambe le tarature sono
+    // state trovate; le colonne senza taratura restano come lette.
+    template <typename Real>
+    bool Apply(const CurveMeta &meta, Real *vce, Real *ic, Real *errVce, Real *errIc, int n) const
+    {
+        const CalibrationRecord *scope = Find(meta.scopeSerial, meta.time);
+        const CalibrationRecord *meter = Find(meta.meterSerial, meta.time);
+        if (scope) ApplyCalibration(*scope, vce, errVce, n);
+        if (meter) ApplyCalibration(*meter, ic, errIc, n);
+        return scope && meter;
+    }
+
+    int GetN() const { return fN; }
+
+private:
+    std::unordered_map<unsigned, std::vector<CalibrationRecord>> fBySerial;   // ordinate per validFrom
+    int fN = 0;
+};
+
+// Legge un file di misura applicando le tarature; indice della curva o -1.
+// *calibrated dice se entrambe le tarature sono state trovate.
+template <typename Real>
+int LoadFileCalibrated(CurveStore<Real> &store, const char *path, const CurveMeta &meta, const CalibrationDB &cal,
+                       bool *calibrated = nullptr)
+{
+    std::vector<double> vce, ic, evce, eic;
+    int n = ReadSweepFile(path, vce, ic, evce, eic);
+    if (n == 0) return -1;
+    bool ok = cal.Apply(meta, vce.data(), ic.data(), evce.data(), eic.data(), n);
+    if (calibrated) *calibrated = ok;
+    return store.AddCurve(vce.data(), ic.data(), evce.data(), eic.data(), n, meta);
+}
+
+} // namespace bjt
+
+#endif
@@ -0,0 +1,312 @@
+/*
+ * Archivio in memoria delle caratteristiche di uscita Ic(Vce).
+ *
+ * Le curve sono memorizzate per colonne (Vce, Ic, errVce, errIc), una dopo
+ * l'altra, con una tabella di offset per curva. Ogni colonna e' allineata a
+ * 64 byte e ogni curva inizia su una linea di cache, cosi' i cicli sui punti
+ * di una curva sono vettorizzabili senza prologo. I metadati (Ib, dispositivo,
+ * temperatura, lotto, strumenti, istante) stanno in array paralleli. Un TGraphErrors va costruito solo
+ * quando una curva deve essere disegnata (bjt/Draw.h).
+ *
+ * Tutte le grandezze sono cambiate di segno come nei file di misura (primo
+ * quadrante): ib = 50 indica I_B = -50 uA.
+ *
+ * Il tipo delle colonne e' un parametro: CurveStoreD (double) conserva i dati
+ * come letti, CurveStoreF (float) dimezza la memoria e la banda. Le letture
+ * hanno 3-4 cifre significative, quindi float (~7 cifre) non perde
+ * informazione; i fit accumulano comunque in double (vedi bjt/LineFit.h).
+ */
+
+#ifndef BJT_CURVESTORE_H
+#define BJT_CURVESTORE_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+namespace bjt
+{
+
+// Allocatore con allineamento fissato (linea di cache)
+template <typename T, std::size_t Align = 64>
+struct AlignedAllocator
+{
+    using value_type = T;
+    template <typename U> struct rebind { using other = AlignedAllocator<U, Align>; };
+
+    AlignedAllocator() = default;
+    template <typename U> AlignedAllocator(const AlignedAllocator<U, Align> &) {}
+
+    T *allocate(std::size_t n)
+    {
+        return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(Align)));
+    }
+    void deallocate(T *p, std::size_t) { ::operator delete(p, std::align_val_t(Align)); }
+
+    template <typename U> bool operator==(const AlignedAllocator<U, Align> &) const { return true; }
+    template <typename U> bool operator!=(const AlignedAllocator<U, Align> &) const { return false; }
+};
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+// Metadati di una curva
+struct CurveMeta
+{
+    double ib = 0;                  // corrente di base [uA]
+    unsigned device = 0;            // identificativo del dispositivo
+    double temperature = NAN;       // [gradi C], NAN se non misurata
+    unsigned lot = 0;               // lotto di produzione
+    unsigned scopeSerial = 0;       // numero di serie dell'oscilloscopio
+    unsigned meterSerial = 0;       // numero di serie del multimetro
+    int64_t time = 0;               // istante della misura [s], tempo Unix
+};
+
+// Vista non proprietaria su una curva dell'archivio
+template <typename Real>
+struct CurveView
+{
+    const Real *vce = nullptr;
+    const Real *ic = nullptr;
+    const Real *errVce = nullptr;
+    const Real *errIc = nullptr;
+    int n = 0;
+    double ib = 0;   // corrente di base [uA]
+};
+
+// Legge i primi 4 numeri di una riga in v; false se non ce ne sono 4
+inline bool ParseSweepLine(const char *line, double v[4])
+{
+    const char *p = line;
+    char *end = nullptr;
+    for (int k = 0; k < 4; ++k){
+        v[k] = std::strtod(p, &end);
+        if (end == p) return false;
+        p = end;
+    }
+    return true;
+}
+
+// -----------------------------------------------------
+// Lettura di un file a 4 colonne "Vce Ic errVce errIc", lo stesso formato
+// "%lg %lg %lg %lg" letto dal costruttore di TGraphErrors: le righe che non
+// contengono 4 numeri sono ignorate. Restituisce il numero di punti letti.
+// Per leggere controllando i dati vedi LoadFileValidated (bjt/Validate.h).
+// -----------------------------------------------------
+inline int ReadSweepFile(const char *path, std::vector<double> &vce, std::vector<double> &ic,
+                         std::vector<double> &errVce, std::vector<double> &errIc)
+{
+    FILE *f = std::fopen(path, "r");
+    if (!f) return 0;
+    int n = 0;
+    char line[512];
+    while (std::fgets(line, sizeof(line), f)){
+        double v[4];
+        if (!ParseSweepLine(line, v)) continue;
+        vce.push_back(v[0]);
+        ic.push_back(v[1]);
+        errVce.push_back(v[2]);
+        errIc.push_back(v[3]);
+        ++n;
+    }
+    std::fclose(f);
+    return n;
+}
+
+template <typename Real>
+class CurveStore
+{
+public:
+    using value_type = Real;
+
+    // Elementi per linea di cache: ogni curva inizia a un multiplo di kAlign
+    static constexpr size_t kAlign = 64 / sizeof(Real);
+
+    void Reserve(int nCurves, size_t nPoints)
+    {
+        size_t cap = nPoints + size_t(nCurves) * kAlign;
+        fVce.reserve(cap);
+        fIc.reserve(cap);
+        fErrVce.reserve(cap);
+        fErrIc.reserve(cap);
+        fOffset.reserve(nCurves);
+        fN.reserve(nCurves);
+        fIb.reserve(nCurves);
+        fDevice.reserve(nCurves);
+        fTemperature.reserve(nCurves);
+        fLot.reserve(nCurves);
+        fScopeSerial.reserve(nCurves);
+        fMeterSerial.reserve(nCurves);
+        fTime.reserve(nCurves);
+    }
+
+    // Elimina tutte le curve mantenendo la memoria gia' allocata
+    void Clear()
+    {
+        fVce.clear();
+        fIc.clear();
+        fErrVce.clear();
+        fErrIc.clear();
+        fOffset.clear();
+        fN.clear();
+        fIb.clear();
+        fDevice.clear();
+        fTemperature.clear();
+        fLot.clear();
+        fScopeSerial.clear();
+        fMeterSerial.clear();
+        fTime.clear();
+    }
+
+    // Aggiunge una curva; restituisce il suo indice
+    template <typename T>
+    int AddCurve(const T *vce, const T *ic, const T *errVce, const T *errIc, int n, const CurveMeta &meta)
+    {
+        size_t o = (fVce.size() + kAlign - 1) / kAlign * kAlign;
+        size_t end = o + n;
+        fVce.resize(end, Real(0));
+        fIc.resize(end, Real(0));
+        fErrVce.resize(end, Real(0));
+        fErrIc.resize(end, Real(0));
+        for (int i = 0; i < n; ++i){
+            fVce[o + i] = Real(vce[i]);
+            fIc[o + i] = Real(ic[i]);
+            fErrVce[o + i] = Real(errVce[i]);
+            fErrIc[o + i] = Real(errIc[i]);
+        }
+        fOffset.push_back(o);
+        fN.push_back(n);
+        fIb.push_back(meta.ib);
+        fDevice.push_back(meta.device);
+        fTemperature.push_back(meta.temperature);
+        fLot.push_back(meta.lot);
+        fScopeSerial.push_back(meta.scopeSerial);
+        fMeterSerial.push_back(meta.meterSerial);
+        fTime.push_back(meta.time);
+        return GetNCurves() - 1;
+    }
+
+    // Legge un file di misura; restituisce l'indice della curva o -1
+    int LoadFile(const char *path, const CurveMeta &meta)
+    {
+        std::vector<double> vce, ic, evce, eic;
+        int n = ReadSweepFile(path, vce, ic, evce, eic);
+        if (n == 0) return -1;
+        return AddCurve(vce.data(), ic.data(), evce.data(), eic.data(), n, meta);
+    }
+
+    int GetNCurves() const { return int(fN.size()); }
+    int GetN(int i) const { return fN[i]; }
+    size_t GetOffset(int i) const { return fOffset[i]; }
+    size_t GetNPoints() const
+    {
+        size_t s = 0;
+        for (int n : fN) s += n;
+        return s;
+    }
+
+    double GetIb(int i) const { return fIb[i]; }
+    unsigned GetDevice(int i) const { return fDevice[i]; }
+    double GetTemperature(int i) const { return fTemperature[i]; }
+    unsigned GetLot(int i) const { return fLot[i]; }
+    unsigned GetScopeSerial(int i) const { return fScopeSerial[i]; }
+    unsigned GetMeterSerial(int i) const { return fMeterSerial[i]; }
+    int64_t GetTime(int i) const { return fTime[i]; }
+    CurveMeta GetMeta(int i) const
+    {
+        return {fIb[i], fDevice[i], fTemperature[i], fLot[i], fScopeSerial[i], fMeterSerial[i], fTime[i]};
+    }
+
+    CurveView<Real> Curve(int i) const
+    {
+        CurveView<Real> c;
+        size_t o = fOffset[i];
+        c.vce = fVce.data() + o;
+        c.ic = fIc.data() + o;
+        c.errVce = fErrVce.data() + o;
+        c.errIc = fErrIc.data() + o;
+        c.n = fN[i];
+        c.ib = fIb[i];
+        return c;
+    }
+
+    // Colonne complete (padding incluso), per chi le elabora in blocco
+    const Real *GetVce() const { return fVce.data(); }
+    const Real *GetIc() const { return fIc.data(); }
+    const Real *GetErrVce() const { return fErrVce.data(); }
+    const Real *GetErrIc() const { return fErrIc.data(); }
+    size_t GetColumnSize() const { return fVce.size(); }
+    const size_t *GetOffsets() const { return fOffset.data(); }
+    const int *GetNs() const { return fN.data(); }
+    const double *GetIbs() const { return fIb.data(); }
+
+    // Memoria occupata dalle colonne di misura, padding incluso [byte]
+    size_t GetColumnBytes() const { return 4 * fVce.size() * sizeof(Real); }
+
+private:
+    AlignedVector<Real> fVce, fIc, fErrVce, fErrIc;
+    std::vector<size_t> fOffset;     // inizio di ogni curva nelle colonne
+    std::vector<int> fN;             // punti di ogni curva
+    std::vector<double> fIb;
+    std::vector<unsigned> fDevice;
+    std::vector<double> fTemperature;
+    std::vector<unsigned> fLot;
+    std::vector<unsigned> fScopeSerial, fMeterSerial;
+    std::vector<int64_t> fTime;
+};
+
+using CurveStoreD = CurveStore<double>;
+using CurveStoreF = CurveStore<float>;
+
+// -----------------------------------------------------
+// Vista su colonne esterne (ad es. array numpy passati da PyROOT) con la
+// stessa interfaccia di lettura di CurveStore, senza copiare i dati.
+// La curva i inizia all'elemento offsets[i] e ha counts[i] punti; senza
+// counts occupa [offsets[i], offsets[i+1]) e offsets ha nCurves + 1 elementi.
+// -----------------------------------------------------
+template <typename Real>
+class CurveColumns
+{
+public:
+    using value_type = Real;
+
+    CurveColumns(const Real *vce, const Real *ic, const Real *errVce, const Real *errIc,
+                 const int64_t *offsets, int nCurves, const int32_t *counts = nullptr,
+                 const double *ib = nullptr)
+        : fVce(vce), fIc(ic), fErrVce(errVce), fErrIc(errIc), fOffsets(offsets), fCounts(counts),
+          fNCurves(nCurves), fIb(ib)
+    {
+    }
+
+    int GetNCurves() const { return fNCurves; }
+    int GetN(int i) const { return fCounts ? fCounts[i] : int(fOffsets[i + 1] - fOffsets[i]); }
+    double GetIb(int i) const { return fIb ? fIb[i] : 0; }
+
+    CurveView<Real> Curve(int i) const
+    {
+        CurveView<Real> c;
+        int64_t o = fOffsets[i];
+        c.vce = fVce + o;
+        c.ic = fIc + o;
+        c.errVce = fErrVce + o;
+        c.errIc = fErrIc + o;
+        c.n = GetN(i);
+        c.ib = GetIb(i);
+        return c;
+    }
+
+private:
+    const Real *fVce, *fIc, *fErrVce, *fErrIc;
+    const int64_t *fOffsets;
+    const int32_t *fCounts;
+    int fNCurves;
+    const double *fIb;
+};
+
+} // namespace bjt
+
+#endif
@@ -0,0 +1,29 @@
+/*
+ * Costruzione degli oggetti ROOT per il disegno.
+ *
+ * L'analisi lavora sull'archivio di curve (bjt/CurveStore.h); un TGraphErrors
+ * viene creato solo qui, per le curve che vanno effettivamente disegnate.
+ */
+
+#ifndef BJT_DRAW_H
+#define BJT_DRAW_H
+
+#include "TGraphErrors.h"
+
+#include "CurveStore.h"
+
+namespace bjt
+{
+
+// TGraphErrors (Vce, Ic, errVce, errIc) della curva i; il chiamante ne e'
+// proprietario
+template <typename Real>
+TGraphErrors *MakeGraph(const CurveStore<Real> &store, int i)
+{
+    CurveView<Real> c = store.Curve(i);
+    return new TGraphErrors(c.n, c.vce, c.ic, c.errVce, c.errIc);
+}
+
+} // namespace bjt
+
+#endif
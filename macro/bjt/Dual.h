@@ -0,0 +1,262 @@
+/*
+ * Differenziazione automatica in avanti (numeri duali) per propagare gli
+ * errori sulle grandezze derivate dai fit.
+ *
+ * Un Dual<N> porta il valore e le N derivate rispetto ai parametri del fit;
+ * le operazioni applicano la regola della catena, quindi qualsiasi formula
+ * scritta con i Dual ha il gradiente esatto. La varianza e' g^T C g con la
+ * matrice di covarianza dei parametri: anche le correlazioni (cov_ab del fit
+ * di Early) entrano senza formule scritte a mano.
+ *
+ * Esempi: V_A = a e g = 1/b dipendono da un solo parametro e danno gli stessi
+ * errori di FillDerived; Ic(V) = (V - a)/b sulla retta del fit dipende da
+ * entrambi, e l'errore scritto a mano trascurando cov_ab e' sbagliato di un
+ * fattore 20-30 (sulle curve di data/ a e b hanno correlazione -0.999).
+ *
+ * Dual e' un aggregato di dimensione fissa senza memoria dinamica: nei
+ * cicli su molte curve (DeriveColumn, DerivePairs) il compilatore lo tiene
+ * nei registri e vettorizza il ciclo come le formule scritte a mano.
+ */
+
+#ifndef BJT_DUAL_H
+#define BJT_DUAL_H
+
+#include <cmath>
+#include <vector>
+
+#include "Batch.h"
+#include "EarlyFit.h"
+
+namespace bjt
+{
+
+template <int N, typename T = double>
+struct Dual
+{
+    T v = 0;        // valore
+    T d[N] = {};    // derivate rispetto ai parametri
+
+    Dual() = default;
+    Dual(T x) : v(x) {}   // costante
+
+    // Parametro k-esimo di valore x
+    static Dual Var(T x, int k)
+    {
+        Dual r(x);
+        r.d[k] = 1;
+        return r;
+    }
+};
+
+// -----------------------------------------------------
+// Aritmetica
+// -----------------------------------------------------
+template <int N, typename T>
+inline Dual<N, T> operator+(const Dual<N, T> &x, const Dual<N, T> &y)
+{
+    Dual<N, T> r(x.v + y.v);
+    for (int k = 0; k < N; ++k) r.d[k] = x.d[k] + y.d[k];
+    return r;
+}
+
+template <int N, typename T>
+inline Dual<N, T> operator-(const Dual<N, T> &x, const Dual<N, T> &y)
+{
+    Dual<N, T> r(x.v - y.v);
+    for (int k = 0; k < N; ++k) r.d[k] = x.d[k] - y.d[k];
+    return r;
+}
+
+template <int N, typename T>
+inline Dual<N, T> operator-(const Dual<N, T> &x)
+{
+    Dual<N, T> r(-x.v);
+    for (int k = 0; k < N; ++k) r.d[k] = -x.d[k];
+    return r;
+}
+
+template <int N, typename T>
+inline Dual<N, T> operator*(const Dual<N, T> &x, const Dual<N, T> &y)
+{
+    Dual<N, T> r(x.v * y.v);
+    for (int k = 0; k < N; ++k) r.d[k] = x.d[k] * y.v + x.v * y.d[k];
+    return r;
+}
+
+template <int N, typename T>
+inline Dual<N, T> operator/(const Dual<N, T> &x, const Dual<N, T> &y)
+{
+    T inv = T(1) / y.v;
+    Dual<N, T> r(x.v * inv);
+    for (int k = 0; k < N; ++k) r.d[k] = (x.d[k] - r.v * y.d[k]) * inv;
+    return r;
+}
+
+// Con costanti (senza passare da un Dual con derivate nulle)
+template <int N, typename T>
+inline Dual<N, T> operator+(const Dual<N, T> &x, T c)
+{
+    Dual<N, T> r = x;
+    r.v += c;
+    return r;
+}
+
+template <int N, typename T>
+inline Dual<N, T> operator+(T c, const Dual<N, T> &x) { return x + c; }
+
+template <int N, typename T>
+inline Dual<N, T> operator-(const Dual<N, T> &x, T c) { return x + (-c); }
+
+template <int N, typename T>
+inline Dual<N, T> operator-(T c, const Dual<N, T> &x) { return -x + c; }
+
+template <int N, typename T>
+inline Dual<N, T> operator*(const Dual<N, T> &x, T c)
+{
+    Dual<N, T> r(x.v * c);
+    for (int k = 0; k < N; ++k) r.d[k] = x.d[k] * c;
+    return r;
+}
+
+template <int N, typename T>
+inline Dual<N, T> operator*(T c, const Dual<N, T> &x) { return x * c; }
+
+template <int N, typename T>
+inline Dual<N, T> operator/(const Dual<N, T> &x, T c) { return x * (T(1) / c); }
+
+template <int N, typename T>
+inline Dual<N, T> operator/(T c, const Dual<N, T> &x)
+{
+    T inv = T(1) / x.v;
+    Dual<N, T> r(c * inv);
+    for (int k = 0; k < N; ++k) r.d[k] = -r.v * x.d[k] * inv;
+    return r;
+}
+
+// -----------------------------------------------------
+// Funzioni: f(x) con derivata f'(x) applicata al gradiente
+// -----------------------------------------------------
+template <int N, typename T>
+inline Dual<N, T> Chain(const Dual<N, T> &x, T f, T df)
+{
+    Dual<N, T> r(f);
+    for (int k = 0; k < N; ++k) r.d[k] = df * x.d[k];
+    return r;
+}
+
+template <int N, typename T>
+inline Dual<N, T> sqrt(const Dual<N, T> &x)
+{
+    T s = std::sqrt(x.v);
+    return Chain(x, s, T(0.5) / s);
+}
+
+template <int N, typename T>
+inline Dual<N, T> exp(const Dual<N, T> &x)
+{
+    T e = std::exp(x.v);
+    return Chain(x, e, e);
+}
+
+template <int N, typename T>
+inline Dual<N, T> log(const Dual<N, T> &x) { return Chain(x, T(std::log(x.v)), T(1) / x.v); }
+
+template <int N, typename T>
+inline Dual<N, T> pow(const Dual<N, T> &x, T p)
+{
+    T f = std::pow(x.v, p);
+    return Chain(x, f, p * f / x.v);
+}
+
+template <int N, typename T>
+inline Dual<N, T> fabs(const Dual<N, T> &x) { return x.v < 0 ? -x : x; }
+
+// -----------------------------------------------------
+// Varianza g^T C g, con C simmetrica N x N per righe
+// -----------------------------------------------------
+template <int N, typename T>
+inline T Variance(const Dual<N, T> &x, const T *cov)
+{
+    T s = 0;
+    for (int j = 0; j < N; ++j){
+        T row = 0;
+        for (int k = 0; k < N; ++k) row += cov[j * N + k] * x.d[k];
+        s += x.d[j] * row;
+    }
+    return s;
+}
+
+template <int N, typename T>
+inline T Error(const Dual<N, T> &x, const T *cov) { return std::sqrt(Variance(x, cov)); }
+
+// Forma ridotta per il fit di Early: parametri (a, b)
+inline double Error(const Dual<2> &x, double err_a, double err_b, double cov_ab)
+{
+    double v = x.d[0] * x.d[0] * err_a * err_a + 2 * x.d[0] * x.d[1] * cov_ab + x.d[1] * x.d[1] * err_b * err_b;
+    return std::sqrt(v);
+}
+
+// Parametri a e b di un fit come Dual<2>
+inline void FitDuals(const EarlyResult &r, Dual<2> &a, Dual<2> &b)
+{
+    a = Dual<2>::Var(r.a, 0);
+    b = Dual<2>::Var(r.b, 1);
+}
+
+// Grandezze derivate comuni, da usare con DeriveColumn
+template <typename D>
+inline D IcAt(const D &a, const D &b, double vce) { return (vce - a) / b; }   // Ic [mA] sulla retta del fit
+
+// -----------------------------------------------------
+// Grandezza derivata f(a, b) per tutte le curve di una ResultTable: valore
+// ed errore con la covarianza del fit di ogni curva. Curve non riuscite: 0
+// (f e' valutata comunque, per non spezzare il ciclo con un salto).
+// -----------------------------------------------------
+template <typename Fn>
+void DeriveColumn(const ResultTable &t, Fn f, std::vector<double> &value, std::vector<double> &err)
+{
+    int n = t.GetN();
+    value.resize(n);
+    err.resize(n);
+    const double *pa = t.a.data(), *pb = t.b.data(), *ea = t.err_a.data(), *eb = t.err_b.data();
+    const double *cab = t.cov_ab.data();
+    const int *ok = t.ok.data();
+    double *pv = value.data(), *pe = err.data();
+    for (int i = 0; i < n; ++i){
+        Dual<2> x = f(Dual<2>::Var(pa[i], 0), Dual<2>::Var(pb[i], 1));
+        double e = Error(x, ea[i], eb[i], cab[i]);
+        pv[i] = ok[i] ? x.v : 0.0;
+        pe[i] = ok[i] ? e : 0.0;
+    }
+}
+
+// -----------------------------------------------------
+// Grandezza derivata da due curve, ad es. beta, per le coppie (iA[k], iB[k]):
+// f(k, aA, bA, aB, bB) con Dual<4> sui parametri (aA, bA, aB, bB). I fit delle
+// due curve sono indipendenti: la covarianza e' a blocchi 2 x 2 e la varianza
+// e' la somma delle forme ridotte dei due blocchi.
+// -----------------------------------------------------
+template <typename Fn>
+void DerivePairs(const ResultTable &t, const std::vector<int> &iA, const std::vector<int> &iB, Fn f,
+                 std::vector<double> &value, std::vector<double> &err)
+{
+    int n = int(iA.size());
+    value.resize(n);
+    err.resize(n);
+    for (int k = 0; k < n; ++k){
+        int i = iA[k], j = iB[k];
+        Dual<4> x = f(k, Dual<4>::Var(t.a[i], 0), Dual<4>::Var(t.b[i], 1), Dual<4>::Var(t.a[j], 2),
+                      Dual<4>::Var(t.b[j], 3));
+        double vA = x.d[0] * x.d[0] * t.err_a[i] * t.err_a[i] + 2 * x.d[0] * x.d[1] * t.cov_ab[i] +
+                    x.d[1] * x.d[1] * t.err_b[i] * t.err_b[i];
+        double vB = x.d[2] * x.d[2] * t.err_a[j] * t.err_a[j] + 2 * x.d[2] * x.d[3] * t.cov_ab[j] +
+                    x.d[3] * x.d[3] * t.err_b[j] * t.err_b[j];
+        bool ok = t.ok[i] && t.ok[j];
+        value[k] = ok ? x.v : 0.0;
+        err[k] = ok ? std::sqrt(vA + vB) : 0.0;
+    }
+}
+
+} // namespace bjt
+
+#endif
@@ -0,0 +1,298 @@
+/*
+ * Estrazione di tensione di Early e conduttanza da una curva Ic(Vce).
+ *
+ * Stessa procedura di processDataset in fit_lineare.C: si selezionano i punti
+ * con Vce in [vMin, vMax], si scambiano gli assi (x' = Ic, y' = Vce) e si
+ * esegue il fit V = a + b*I con errori su entrambi gli assi. Allora
+ * V_A = a e g = 1/b.
+ *
+ * La memoria di lavoro (punti della finestra, residui, repliche bootstrap) e'
+ * presa dall'arena del thread (bjt/Arena.h), non dall'allocatore globale.
+ */
+
+#ifndef BJT_EARLYFIT_H
+#define BJT_EARLYFIT_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "Arena.h"
+#include "CurveStore.h"
+#include "LineFit.h"
+
+namespace bjt
+{
+
+struct EarlyResult
+{
+    double a = 0, err_a = 0;        // [V]
+    double b = 0, err_b = 0;        // [V/mA]
+    double cov_ab = 0;
+    double V_A = 0, err_V_A = 0;    // [V]
+    double cond = 0, err_cond = 0;  // [mA/V]
+    double chi2 = 0;
+    int ndf = 0;
+    int nPoints = 0;                // punti nella finestra
+    bool ok = false;
+
+    // Conduttanza in Siemens: 1 mA/V = 1e-3 S
+    double CondS() const { return cond * 1e-3; }
+    double ErrCondS() const { return err_cond * 1e-3; }
+};
+
+// Quantita' derivate dai parametri della retta
+inline void FillDerived(EarlyResult &r)
+{
+    r.V_A = r.a;
+    r.err_V_A = r.err_a;
+    r.cond = 1.0 / r.b;
+    r.err_cond = r.err_b / (r.b * r.b);
+}
+
+// Punti nella finestra di fit, con assi scambiati (x' = I, y' = V)
+template <typename Real>
+struct FitWindow
+{
+    Real *I = nullptr, *V = nullptr, *eI = nullptr, *eV = nullptr;
+    int n = 0;
+};
+
+// Copia nell'arena i punti della curva con Vce in [vMin, vMax]
+template <typename Real>
+FitWindow<Real> SelectWindow(const CurveView<Real> &c, double vMin, double vMax, MonotonicArena &arena)
+{
+    FitWindow<Real> w;
+    w.I = arena.Allocate<Real>(c.n);
+    w.V = arena.Allocate<Real>(c.n);
+    w.eI = arena.Allocate<Real>(c.n);
+    w.eV = arena.Allocate<Real>(c.n);
+    for (int i = 0; i < c.n; ++i){
+        if (c.vce[i] >= vMin && c.vce[i] <= vMax){
+            w.I[w.n] = c.ic[i];
+            w.V[w.n] = c.vce[i];
+            w.eI[w.n] = c.errIc[i];
+            w.eV[w.n] = c.errVce[i];
+            ++w.n;
+        }
+    }
+    return w;
+}
+
+template <typename Real>
+EarlyResult FitWindowEarly(const FitWindow<Real> &w)
+{
+    EarlyResult r;
+    r.nPoints = w.n;
+    if (w.n < 2) return r;
+
+    LineFitResult f = FitLineEffVar(w.I, w.V, w.eI, w.eV, w.n);
+    if (!f.ok) return r;
+
+    r.a = f.a;
+    r.err_a = f.err_a;
+    r.b = f.b;
+    r.err_b = f.err_b;
+    r.cov_ab = f.cov_ab;
+    r.chi2 = f.chi2;
+    r.ndf = f.ndf;
+    FillDerived(r);
+    r.ok = true;
+    return r;
+}
+
+// -----------------------------------------------------
+// Fit di una curva. Le colonne possono essere float o double: i punti della
+// finestra sono copiati nel tipo di origine e il fit accumula in double.
+// -----------------------------------------------------
+template <typename Real>
+EarlyResult FitEarly(const CurveView<Real> &c, double vMin, double vMax,
+                     MonotonicArena &arena = ScratchArena())
+{
+    ArenaScope scope(arena);
+    return FitWindowEarly(SelectWindow(c, vMin, vMax, arena));
+}
+
+// Residui normalizzati (V - a - b I) / sqrt(sV^2 + b^2 sI^2) dei punti della
+// finestra, allocati nell'arena
+template <typename Real>
+double *Residuals(const FitWindow<Real> &w, const EarlyResult &r, MonotonicArena &arena)
+{
+    double *res = arena.Allocate<double>(w.n);
+    for (int i = 0; i < w.n; ++i){
+        double V = double(w.eV[i]) * w.eV[i] + r.b * r.b * double(w.eI[i]) * w.eI[i];
+        res[i] = (w.V[i] - r.a - r.b * w.I[i]) / std::sqrt(V);
+    }
+    return res;
+}
+
+// Influenza di un punto della finestra
+struct PointInfluence
+{
+    double leverage = 0;           // h_i, elemento diagonale della matrice cappello
+    double cook = 0;               // distanza di Cook
+    double VA_loo = 0;             // V_A e conduttanza senza il punto
+    double cond_loo = 0;
+};
+
+struct InfluenceResult
+{
+    double jack_err_V_A = 0;       // errori jackknife
+    double jack_err_cond = 0;
+    double maxCook = 0;
+    int iMaxCook = -1;             // indice nella finestra
+    double maxShiftVA = 0;         // max |V_A senza il punto - V_A| / err_V_A
+    int iMaxShiftVA = -1;
+    bool ok = false;
+};
+
+// -----------------------------------------------------
+// Leverage, distanza di Cook e fit senza ciascun punto (leave-one-out) per
+// tutti i punti della finestra, senza rifare n fit. Ai pesi del minimo
+// w_i = 1 / (sV^2 + b^2 sI^2) il fit e' lineare in (a, b) con matrice
+// M = sum w_i u_i u_i^T, u_i = (1, I_i), e per ogni punto:
+//   h_i = w_i u_i^T M^-1 u_i
+//   (a, b) senza il punto = (a, b) - M^-1 u_i w_i e_i / (1 - h_i)
+//   D_i = w_i e_i^2 h_i / (2 (1 - h_i)^2)
+// con e_i = V_i - a - b I_i. Gli errori sono noti, quindi D_i non e' diviso
+// per la varianza residua. Il risultato e' esatto a pesi fissati; rifare il
+// fit cambierebbe i pesi solo tramite b, al secondo ordine. Costo: tre
+// passate sulla finestra. Se points non e' nullo vi si scrivono i w.n valori
+// per punto.
+// -----------------------------------------------------
+template <typename Real>
+InfluenceResult InfluenceEarly(const FitWindow<Real> &w, const EarlyResult &r, PointInfluence *points = nullptr)
+{
+    InfluenceResult ir;
+    if (!r.ok || w.n < 3) return ir;
+
+    // Matrice di informazione con I centrata sulla media pesata
+    double b = r.b, s0 = 0, s1 = 0;
+    for (int i = 0; i < w.n; ++i){
+        double wi = 1 / (double(w.eV[i]) * w.eV[i] + b * b * double(w.eI[i]) * w.eI[i]);
+        s0 += wi;
+        s1 += wi * w.I[i];
+    }
+    double xc = s1 / s0, sxx = 0;
+    for (int i = 0; i < w.n; ++i){
+        double wi = 1 / (double(w.eV[i]) * w.eV[i] + b * b * double(w.eI[i]) * w.eI[i]);
+        double dx = w.I[i] - xc;
+        sxx += wi * dx * dx;
+    }
+    if (!(sxx > 0)) return ir;
+
+    double sumVA = 0, sumVA2 = 0, sumC = 0, sumC2 = 0;
+    for (int i = 0; i < w.n; ++i){
+        double wi = 1 / (double(w.eV[i]) * w.eV[i] + b * b * double(w.eI[i]) * w.eI[i]);
+        double dx = w.I[i] - xc;
+        double h = wi * (1 / s0 + dx * dx / sxx);
+        if (!(h < 1)) return ir;
+        double e = w.V[i] - r.a - b * w.I[i];
+        double k = wi * e / (1 - h);
+        double db = -k * dx / sxx;
+        double da = -k / s0 - db * xc;     // a = a0 - b xc, a0 all'ascissa xc
+        double va = r.a + da, cond = 1 / (b + db);
+        double cook = wi * e * e * h / (2 * (1 - h) * (1 - h));
+
+        if (points){
+            points[i].leverage = h;
+            points[i].cook = cook;
+            points[i].VA_loo = va;
+            points[i].cond_loo = cond;
+        }
+        if (cook > ir.maxCook || ir.iMaxCook < 0){
+            ir.maxCook = cook;
+            ir.iMaxCook = i;
+        }
+        double shift = r.err_V_A > 0 ? std::fabs(da) / r.err_V_A : 0;
+        if (shift > ir.maxShiftVA || ir.iMaxShiftVA < 0){
+            ir.maxShiftVA = shift;
+            ir.iMaxShiftVA = i;
+        }
+        // Somme centrate sul fit completo, per la stabilita' numerica
+        sumVA += da;
+        sumVA2 += da * da;
+        sumC += cond - r.cond;
+        sumC2 += (cond - r.cond) * (cond - r.cond);
+    }
+
+    // Jackknife: var = (n - 1) / n * sum (theta_i - media)^2
+    double n = w.n;
+    ir.jack_err_V_A = std::sqrt(std::max(0.0, (n - 1) / n * (sumVA2 - sumVA * sumVA / n)));
+    ir.jack_err_cond = std::sqrt(std::max(0.0, (n - 1) / n * (sumC2 - sumC * sumC / n)));
+    ir.ok = true;
+    return ir;
+}
+
+// Intervallo bootstrap (percentili 16-84, cioe' +/- 1 sigma)
+struct BootstrapInterval
+{
+    double VA_lo = 0, VA_hi = 0;
+    double cond_lo = 0, cond_hi = 0;
+    int nReplicas = 0;             // repliche con fit riuscito
+};
+
+// Generatore veloce e riproducibile per il ricampionamento
+inline uint64_t SplitMix64(uint64_t &state)
+{
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// -----------------------------------------------------
+// Bootstrap non parametrico sulle coppie (I, V) della finestra: nReplicas
+// ricampionamenti con reinserimento, tutti allocati nell'arena.
+// -----------------------------------------------------
+template <typename Real>
+BootstrapInterval BootstrapEarly(const FitWindow<Real> &w, int nReplicas, uint64_t seed,
+                                 MonotonicArena &arena)
+{
+    BootstrapInterval bi;
+    if (w.n < 3 || nReplicas <= 0) return bi;
+    ArenaScope scope(arena);
+
+    FitWindow<Real> rep;
+    rep.I = arena.Allocate<Real>(w.n);
+    rep.V = arena.Allocate<Real>(w.n);
+    rep.eI = arena.Allocate<Real>(w.n);
+    rep.eV = arena.Allocate<Real>(w.n);
+    rep.n = w.n;
+    double *va = arena.Allocate<double>(nReplicas);
+    double *cond = arena.Allocate<double>(nReplicas);
+
+    uint64_t state = seed;
+    int m = 0;
+    for (int k = 0; k < nReplicas; ++k){
+        for (int i = 0; i < w.n; ++i){
+            int j = int(SplitMix64(state) % uint64_t(w.n));
+            rep.I[i] = w.I[j];
+            rep.V[i] = w.V[j];
+            rep.eI[i] = w.eI[j];
+            rep.eV[i] = w.eV[j];
+        }
+        EarlyResult r = FitWindowEarly(rep);
+        if (!r.ok) continue;
+        va[m] = r.V_A;
+        cond[m] = r.cond;
+        ++m;
+    }
+    bi.nReplicas = m;
+    if (m == 0) return bi;
+
+    auto quantile = [m](double *v, double q){
+        int k = std::min(m - 1, std::max(0, int(q * (m - 1) + 0.5)));
+        std::nth_element(v, v + k, v + m);
+        return v[k];
+    };
+    bi.VA_lo = quantile(va, 0.16);
+    bi.VA_hi = quantile(va, 0.84);
+    bi.cond_lo = quantile(cond, 0.16);
+    bi.cond_hi = quantile(cond, 0.84);
+    return bi;
+}
+
+} // namespace bjt
+
+#endif
@@ -0,0 +1,330 @@
+/*
+ * Bilancio degli errori: quanto contribuisce ogni sorgente dell'appendice
+ * (bjt/ErrorModel.h) alla varianza di V_A, conduttanza e beta.
+ *
+ * Sorgenti: lettura dell'oscilloscopio (mezza tacchetta), taratura
+ * dell'oscilloscopio (3% del costruttore), guadagno del multimetro (k * I) e
+ * digit del multimetro. L'errore di ogni punto e' diviso tra le sorgenti in
+ * proporzione al modello: per l'oscilloscopio, somma in quadratura, le
+ * frazioni di varianza sono sigma_l^2 / sigma_V^2 e sigma_c^2 / sigma_V^2;
+ * per il multimetro, somma lineare, kI / sigma_I e 3 digit / sigma_I. Cosi'
+ * i contributi si sommano esattamente alla varianza di ogni punto, anche
+ * con gli errori arrotondati dei file.
+ *
+ * Fit V = a + b*I. Ai pesi del minimo w_i = 1 / (sV^2 + b^2 sI^2) una
+ * variazione dV_i e dI_i dei punti sposta i parametri di
+ *   d(a, b) = sum g_i (dV_i - b dI_i),   g_i = M^-1 u_i w_i,  u_i = (1, I_i)
+ * Due letture del bilancio:
+ *   - indipendente: tutte le sorgenti indipendenti da punto a punto, come
+ *     le tratta il fit; la somma dei contributi e' la varianza del fit a
+ *     pesi fissati (err_a^2 e err_b^2 a meno della dipendenza dei pesi da b);
+ *   - correlata: taratura dell'oscilloscopio e guadagno del multimetro
+ *     comuni a tutta la curva (un unico fattore di scala). Allora la taratura
+ *     sposta V_A del 3% e la conduttanza del 3%, il guadagno del multimetro
+ *     non sposta V_A e sposta la conduttanza dell'1%: questi contributi non
+ *     si riducono con il numero di punti.
+ * Lettura e digit sono indipendenti in entrambe.
+ *
+ * Beta (ComputeBeta): contano gli errori su Ic dei punti interpolati delle
+ * due curve; in piu' l'errore su Vce sposta il punto lungo le curve, di
+ * dIc/dVce * sigma_V, contributo che err_beta non include.
+ */
+
+#ifndef BJT_ERRORBUDGET_H
+#define BJT_ERRORBUDGET_H
+
+#include <cmath>
+#include <map>
+#include <vector>
+
+#include "Arena.h"
+#include "Batch.h"
+#include "Beta.h"
+#include "CurveStore.h"
+#include "EarlyFit.h"
+#include "ErrorModel.h"
+
+namespace bjt
+{
+
+enum ErrorSource
+{
+    kSrcScopeReading = 0,
+    kSrcScopeCalib,
+    kSrcMeterGain,
+    kSrcMeterDigits,
+    kNErrorSources
+};
+
+inline const char *ErrorSourceName(int s)
+{
+    static const char *const names[kNErrorSources] = {"lettura osc.", "taratura osc.", "guadagno mult.",
+                                                      "digit mult."};
+    return s >= 0 && s < kNErrorSources ? names[s] : "?";
+}
+
+// Varianze di un parametro per sorgente
+struct ParamBudget
+{
+    double var[kNErrorSources] = {};       // sorgenti indipendenti da punto a punto
+    double varCorr[kNErrorSources] = {};   // taratura e guadagno comuni alla curva
+
+    double Total() const
+    {
+        double t = 0;
+        for (double v : var) t += v;
+        return t;
+    }
+
+    double TotalCorr() const
+    {
+        double t = 0;
+        for (double v : varCorr) t += v;
+        return t;
+    }
+};
+
+struct EarlyBudget
+{
+    ParamBudget VA, cond;
+    bool ok = false;
+};
+
+// Frazioni di varianza delle sorgenti in un punto (vedi sopra)
+inline void ScopeFractions(const ScopeModel &scope, double v, double &fReading, double &fCalib)
+{
+    double l = scope.ReadingError(scope.ChooseScale(v)), c = scope.CalibError(v);
+    double t = l * l + c * c;
+    fReading = t > 0 ? l * l / t : 1;
+    fCalib = 1 - fReading;
+}
+
+inline void MeterFractions(const MeterModel &meter, double i, double &fGain, double &fDigits)
+{
+    double g = meter.GainError(i), d = meter.DigitError();
+    fGain = g + d > 0 ? g / (g + d) : 0;
+    fDigits = 1 - fGain;
+}
+
+// -----------------------------------------------------
+// Bilancio di V_A e conduttanza di un fit, in due passate sulla finestra
+// -----------------------------------------------------
+template <typename Real>
+EarlyBudget BudgetEarly(const FitWindow<Real> &w, const EarlyResult &r, const ScopeModel &scope = ScopeModel(),
+                        const MeterModel &meter = MeterModel())
+{
+    EarlyBudget eb;
+    if (!r.ok || w.n < 2 || r.b == 0) return eb;
+    double b = r.b;
+
+    double s0 = 0, s1 = 0;
+    for (int i = 0; i < w.n; ++i){
+        double wi = 1 / (double(w.eV[i]) * w.eV[i] + b * b * double(w.eI[i]) * w.eI[i]);
+        s0 += wi;
+        s1 += wi * w.I[i];
+    }
+    double xc = s1 / s0, sxx = 0;
+    for (int i = 0; i < w.n; ++i){
+        double wi = 1 / (double(w.eV[i]) * w.eV[i] + b * b * double(w.eI[i]) * w.eI[i]);
+        sxx += wi * (w.I[i] - xc) * (w.I[i] - xc);
+    }
+    if (!(sxx > 0)) return eb;
+
+    double va[kNErrorSources] = {}, vb[kNErrorSources] = {};
+    double daCalib = 0, dbCalib = 0, daGain = 0, dbGain = 0;   // spostamenti per fattore di scala unitario
+    for (int i = 0; i < w.n; ++i){
+        double wi = 1 / (double(w.eV[i]) * w.eV[i] + b * b * double(w.eI[i]) * w.eI[i]);
+        double gb = wi * (w.I[i] - xc) / sxx;
+        double ga = wi / s0 - xc * gb;
+        double eV2 = double(w.eV[i]) * w.eV[i], eI2 = b * b * double(w.eI[i]) * w.eI[i];
+        double fR, fC, fG, fD;
+        ScopeFractions(scope, w.V[i], fR, fC);
+        MeterFractions(meter, w.I[i], fG, fD);
+        double part[kNErrorSources] = {fR * eV2, fC * eV2, fG * eI2, fD * eI2};
+        for (int s = 0; s < kNErrorSources; ++s){
+            va[s] += ga * ga * part[s];
+            vb[s] += gb * gb * part[s];
+        }
+        daCalib += ga * w.V[i];
+        dbCalib += gb * w.V[i];
+        daGain -= ga * b * w.I[i];
+        dbGain -= gb * b * w.I[i];
+    }
+
+    double b4 = b * b * b * b;
+    for (int s = 0; s < kNErrorSources; ++s){
+        eb.VA.var[s] = va[s];
+        eb.cond.var[s] = vb[s] / b4;
+    }
+    for (int s : {kSrcScopeReading, kSrcMeterDigits}){
+        eb.VA.varCorr[s] = va[s];
+        eb.cond.varCorr[s] = vb[s] / b4;
+    }
+    double kc = scope.calib * scope.calib, kg = meter.gain * meter.gain;
+    eb.VA.varCorr[kSrcScopeCalib] = kc * daCalib * daCalib;
+    eb.cond.varCorr[kSrcScopeCalib] = kc * dbCalib * dbCalib / b4;
+    eb.VA.varCorr[kSrcMeterGain] = kg * daGain * daGain;
+    eb.cond.varCorr[kSrcMeterGain] = kg * dbGain * dbGain / b4;
+    eb.ok = true;
+    return eb;
+}
+
+// -----------------------------------------------------
+// Bilancio di beta tra le curve a e b alla tensione vce (come ComputeBeta)
+// -----------------------------------------------------
+template <typename Real>
+bool BudgetBeta(const CurveView<Real> &a, const CurveView<Real> &b, double vce, ParamBudget &out,
+                const ScopeModel &scope = ScopeModel(), const MeterModel &meter = MeterModel())
+{
+    out = ParamBudget();
+    double dIb = b.ib - a.ib;
+    if (dIb == 0) return false;
+    double k = 1e3 / dIb;
+
+    // Varianza di Ic interpolata per sorgente del multimetro, Ic e pendenza
+    // dIc/dVce nel punto
+    auto curve = [&](const CurveView<Real> &c, double &ic, double &slope, double &vGain, double &vDigits){
+        // Come InterpolateIc: punto esatto o interpolazione tra i vicini;
+        // la pendenza e' sempre quella tra i vicini
+        int lo = -1, hi = -1, at = -1;
+        for (int i = 0; i < c.n; ++i){
+            double x = c.vce[i];
+            if (std::fabs(x - vce) < 1e-9) at = i;
+            else if (x < vce && (lo < 0 || x > c.vce[lo])) lo = i;
+            else if (x > vce && (hi < 0 || x < c.vce[hi])) hi = i;
+        }
+        int sLo = lo >= 0 ? lo : at, sHi = hi >= 0 ? hi : at;
+        slope = sLo >= 0 && sHi >= 0 && sHi != sLo
+                    ? (double(c.ic[sHi]) - c.ic[sLo]) / (double(c.vce[sHi]) - c.vce[sLo])
+                    : 0;
+        int pts[2] = {at, -1};
+        double wts[2] = {1, 0};
+        if (at < 0){
+            if (lo < 0 || hi < 0) return false;
+            double f = (vce - c.vce[lo]) / (double(c.vce[hi]) - c.vce[lo]);
+            pts[0] = lo;
+            pts[1] = hi;
+            wts[0] = 1 - f;
+            wts[1] = f;
+        }
+        ic = vGain = vDigits = 0;
+        for (int j = 0; j < 2; ++j){
+            if (pts[j] < 0) continue;
+            double fG, fD, e2 = double(c.errIc[pts[j]]) * c.errIc[pts[j]];
+            MeterFractions(meter, c.ic[pts[j]], fG, fD);
+            ic += wts[j] * c.ic[pts[j]];
+            vGain += wts[j] * wts[j] * fG * e2;
+            vDigits += wts[j] * wts[j] * fD * e2;
+        }
+        return true;
+    };
+    double icA, sA, gA, dA, icB, sB, gB, dB;
+    if (!curve(a, icA, sA, gA, dA) || !curve(b, icB, sB, gB, dB)) return false;
+    double beta = (icB - icA) * k;
+
+    double sV = scope.Error(vce, scope.ChooseScale(vce)), fR, fC;
+    ScopeFractions(scope, vce, fR, fC);
+    double sV2 = sV * sV;
+
+    out.var[kSrcMeterGain] = k * k * (gA + gB);
+    out.var[kSrcMeterDigits] = k * k * (dA + dB);
+    out.var[kSrcScopeReading] = k * k * (sA * sA + sB * sB) * fR * sV2;
+    out.var[kSrcScopeCalib] = k * k * (sA * sA + sB * sB) * fC * sV2;
+
+    out.varCorr[kSrcMeterDigits] = out.var[kSrcMeterDigits];
+    out.varCorr[kSrcScopeReading] = out.var[kSrcScopeReading];
+    double dCalib = k * (sB - sA) * vce * scope.calib;   // stesso fattore di scala su Vce
+    out.varCorr[kSrcScopeCalib] = dCalib * dCalib;
+    out.varCorr[kSrcMeterGain] = meter.gain * meter.gain * beta * beta;
+    return true;
+}
+
+// Bilancio per curva: varianze per colonne, [s * nCurves + i]
+struct BudgetTable
+{
+    std::vector<double> VA, VACorr, cond, condCorr;
+    std::vector<int> ok;
+
+    int GetN() const { return int(ok.size()); }
+    double Get(const std::vector<double> &col, int s, int i) const { return col[size_t(s) * GetN() + i]; }
+
+    void Resize(int n)
+    {
+        for (auto *c : {&VA, &VACorr, &cond, &condCorr}) c->assign(size_t(n) * kNErrorSources, 0.0);
+        ok.assign(n, 0);
+    }
+};
+
+// -----------------------------------------------------
+// Fit e bilancio di tutte le curve, con il driver multi-thread di
+// AnalyzeBatch (di cfg contano finestra, nThreads e passthrough)
+// -----------------------------------------------------
+template <typename Store>
+void AnalyzeBatchBudget(const Store &store, const BatchConfig &cfg, ResultTable &out, BudgetTable &budget,
+                        const ScopeModel &scope = ScopeModel(), const MeterModel &meter = MeterModel())
+{
+    using Real = typename Store::value_type;
+    int n = store.GetNCurves();
+    out.Resize(n);
+    budget.Resize(n);
+    ParallelChunks(n, cfg.nThreads, kChunk, cfg.passthrough, [&](int i, MonotonicArena &arena){
+        ArenaScope as(arena);
+        FitWindow<Real> w = SelectWindow(store.Curve(i), cfg.vMin, cfg.vMax, arena);
+        EarlyResult r = FitWindowEarly(w);
+        out.Set(i, r);
+        EarlyBudget eb = BudgetEarly(w, r, scope, meter);
+        budget.ok[i] = eb.ok;
+        if (!eb.ok) return;
+        for (int s = 0; s < kNErrorSources; ++s){
+            size_t k = size_t(s) * n + i;
+            budget.VA[k] = eb.VA.var[s];
+            budget.VACorr[k] = eb.VA.varCorr[s];
+            budget.cond[k] = eb.cond.var[s];
+            budget.condCorr[k] = eb.cond.varCorr[s];
+        }
+    });
+}
+
+// Bilancio medio di un lotto: varianze relative (var / parametro^2) medie
+struct LotBudget
+{
+    int nCurves = 0;
+    ParamBudget VA, cond;          // varianze relative medie
+};
+
+// -----------------------------------------------------
+// Media per lotto (CurveMeta::lot) dei bilanci relativi delle curve
+// -----------------------------------------------------
+template <typename Store>
+std::map<unsigned, LotBudget> AggregateBudget(const Store &store, const ResultTable &res, const BudgetTable &budget)
+{
+    std::map<unsigned, LotBudget> lots;
+    int n = budget.GetN();
+    for (int i = 0; i < n; ++i){
+        if (!budget.ok[i] || res.V_A[i] == 0 || res.cond[i] == 0) continue;
+        LotBudget &lb = lots[store.GetLot(i)];
+        double va2 = res.V_A[i] * res.V_A[i], c2 = res.cond[i] * res.cond[i];
+        for (int s = 0; s < kNErrorSources; ++s){
+            size_t k = size_t(s) * n + i;
+            lb.VA.var[s] += budget.VA[k] / va2;
+            lb.VA.varCorr[s] += budget.VACorr[k] / va2;
+            lb.cond.var[s] += budget.cond[k] / c2;
+            lb.cond.varCorr[s] += budget.condCorr[k] / c2;
+        }
+        ++lb.nCurves;
+    }
+    for (auto &kv : lots){
+        LotBudget &lb = kv.second;
+        for (int s = 0; s < kNErrorSources; ++s){
+            lb.VA.var[s] /= lb.nCurves;
+            lb.VA.varCorr[s] /= lb.nCurves;
+            lb.cond.var[s] /= lb.nCurves;
+            lb.cond.varCorr[s] /= lb.nCurves;
+        }
+    }
+    return lots;
+}
+
+} // namespace bjt
+
+#endif
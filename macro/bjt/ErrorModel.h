@@ -0,0 +1,60 @@
+/*
+ * Modello degli errori strumentali (appendice "Calcolo degli errori per
+ * tensioni e correnti" della relazione).
+ *
+ * Oscilloscopio GW Instek GOS-652G:
+ *   sigma_l = F.S./5 * 0.5        (lettura: mezza tacchetta, 5 tacchette/div)
+ *   sigma_c = 3% * V              (costruttore)
+ *   sigma_V = sqrt(sigma_l^2 + sigma_c^2)
+ * Multimetro Fluke 175, fondo scala 60 mA, risoluzione 0.01 mA:
+ *   sigma_I = k * I + 3 digit
+ * La relazione riporta k = 1.5%, ma gli errori tabulati in data/ sono
+ * calcolati con k = 1%: qui si usa il valore dei dati.
+ */
+
+#ifndef BJT_ERRORMODEL_H
+#define BJT_ERRORMODEL_H
+
+#include <cmath>
+
+namespace bjt
+{
+
+// Fondo scala verticali dell'oscilloscopio [V/div], sequenza 1-2-5
+constexpr double kScopeScales[] = {0.005, 0.01, 0.02, 0.05, 0.1, 0.2, 0.5, 1, 2, 5};
+constexpr int kNScopeScales = sizeof(kScopeScales) / sizeof(kScopeScales[0]);
+
+struct ScopeModel
+{
+    double ticksPerDiv = 5;     // tacchette per divisione
+    double ticksRead = 0.5;     // tacchette apprezzabili
+    double calib = 0.03;        // errore relativo del costruttore
+    double maxDivs = 6;         // divisioni usate al massimo prima di cambiare scala
+
+    double ReadingError(double scale) const { return scale / ticksPerDiv * ticksRead; }
+    double CalibError(double v) const { return calib * std::fabs(v); }
+    double Error(double v, double scale) const { return std::hypot(ReadingError(scale), CalibError(v)); }
+
+    // Fondo scala piu' piccolo su cui la lettura v sta nello schermo
+    double ChooseScale(double v) const
+    {
+        for (double s : kScopeScales)
+            if (std::fabs(v) <= maxDivs * s) return s;
+        return kScopeScales[kNScopeScales - 1];
+    }
+};
+
+struct MeterModel
+{
+    double gain = 0.01;         // errore relativo
+    double digits = 3;          // digit di incertezza
+    double resolution = 0.01;   // [mA] sul fondo scala da 60 mA
+
+    double GainError(double i) const { return gain * std::fabs(i); }
+    double DigitError() const { return digits * resolution; }
+    double Error(double i) const { return GainError(i) + DigitError(); }
+};
+
+} // namespace bjt
+
+#endif
@@ -0,0 +1,395 @@
+/*
+ * Motori di fit lineare usati dall'analisi BJT.
+ *
+ * Tutte le funzioni sono header-only e non dipendono da ROOT, in modo da poter
+ * essere incluse sia da una macro (root -l) sia da codice compilato.
+ *
+ * Motori disponibili:
+ *  - FitLineOLS     : retta y = a + b*x ai minimi quadrati non pesati
+ *                     (somme centrate a due passate, come richiesto dai
+ *                     dataset NIST mal condizionati);
+ *  - FitLineWLS     : retta pesata con i soli errori su y;
+ *  - FitLineEffVar  : retta con errori su x e su y a varianza efficace,
+ *                     cioe' lo stesso chi2 che TGraphErrors::Fit minimizza con
+ *                     Minuit: chi2 = sum (y - a - b x)^2 / (sy^2 + b^2 sx^2);
+ *  - FitLinearQR    : modello lineare generico (polinomi, regressione
+ *                     multipla) risolto con fattorizzazione QR di Householder.
+ */
+
+#ifndef BJT_LINEFIT_H
+#define BJT_LINEFIT_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace bjt
+{
+
+// Risultato di un fit a retta y = a + b*x
+struct LineFitResult
+{
+    double a = 0, b = 0;
+    double err_a = 0, err_b = 0;
+    double cov_ab = 0;
+    double chi2 = 0;   // per OLS: somma dei quadrati dei residui
+    int ndf = 0;
+    int iterations = 0;
+    bool ok = false;
+};
+
+// Risultato di un modello lineare generico con p parametri
+struct LinearFitResult
+{
+    std::vector<double> par;
+    std::vector<double> cov;   // matrice p x p, per righe
+    double chi2 = 0;
+    int ndf = 0;
+    bool ok = false;
+
+    double Error(int i) const { return std::sqrt(cov[i * par.size() + i]); }
+};
+
+// -----------------------------------------------------
+// Retta non pesata. Gli errori sui parametri sono scalati con la varianza
+// residua s^2 = RSS/(n-2), come nei valori certificati NIST.
+// -----------------------------------------------------
+template <typename T>
+LineFitResult FitLineOLS(const T *x, const T *y, int n)
+{
+    LineFitResult r;
+    if (n < 3) return r;
+
+    double mx = 0, my = 0;
+    for (int i = 0; i < n; ++i){
+        mx += x[i];
+        my += y[i];
+    }
+    mx /= n;
+    my /= n;
+
+    double sxx = 0, sxy = 0;
+    for (int i = 0; i < n; ++i){
+        double dx = x[i] - mx;
+        sxx += dx * dx;
+        sxy += dx * (y[i] - my);
+    }
+    if (sxx <= 0) return r;
+
+    r.b = sxy / sxx;
+    r.a = my - r.b * mx;
+
+    double rss = 0;
+    for (int i = 0; i < n; ++i){
+        double res = y[i] - r.a - r.b * x[i];
+        rss += res * res;
+    }
+    double s2 = rss / (n - 2);
+    r.chi2 = rss;
+    r.ndf = n - 2;
+    r.err_b = std::sqrt(s2 / sxx);
+    r.err_a = std::sqrt(s2 * (1.0 / n + mx * mx / sxx));
+    r.cov_ab = -mx * s2 / sxx;
+    r.ok = true;
+    return r;
+}
+
+// -----------------------------------------------------
+// Retta pesata con w = 1/sy^2. Gli errori NON sono scalati con chi2/ndf,
+// come fa ROOT per i grafici con errori.
+// -----------------------------------------------------
+template <typename T>
+LineFitResult FitLineWLS(const T *x, const T *y, const T *sy, int n)
+{
+    LineFitResult r;
+    if (n < 2) return r;
+
+    double sw = 0, mx = 0, my = 0;
+    for (int i = 0; i < n; ++i){
+        double w = 1.0 / (double(sy[i]) * sy[i]);
+        sw += w;
+        mx += w * x[i];
+        my += w * y[i];
+    }
+    if (!(sw > 0) || !std::isfinite(sw)) return r;
+    mx /= sw;
+    my /= sw;
+
+    double sxx = 0, sxy = 0;
+    for (int i = 0; i < n; ++i){
+        double w = 1.0 / (double(sy[i]) * sy[i]);
+        double dx = x[i] - mx;
+        sxx += w * dx * dx;
+        sxy += w * dx * (y[i] - my);
+    }
+    if (sxx <= 0) return r;
+
+    r.b = sxy / sxx;
+    r.a = my - r.b * mx;
+
+    double chi2 = 0;
+    for (int i = 0; i < n; ++i){
+        double res = (y[i] - r.a - r.b * x[i]) / sy[i];
+        chi2 += res * res;
+    }
+    r.chi2 = chi2;
+    r.ndf = n - 2;
+    r.err_b = std::sqrt(1.0 / sxx);
+    r.err_a = std::sqrt(1.0 / sw + mx * mx / sxx);
+    r.cov_ab = -mx / sxx;
+    r.ok = true;
+    return r;
+}
+
+// -----------------------------------------------------
+// Retta a varianza efficace (errori su x e su y).
+//
+// Minimizza chi2(a,b) = sum r_i^2 / V_i con r = y - a - b x e
+// V = sy^2 + b^2 sx^2, che e' la funzione minimizzata da TGraphErrors::Fit.
+// Si parte dalla soluzione pesata con i soli sy, si fanno alcune iterazioni a
+// pesi fissati e si conclude con passi di Newton sul chi2 completo (gradiente e
+// hessiana analitici). La covarianza e' 2*H^-1, cioe' quella che Minuit/HESSE
+// ricava dalla condizione delta chi2 = 1.
+// Per stabilita' numerica i conti sono fatti con x centrata sulla media pesata.
+// -----------------------------------------------------
+template <typename T>
+LineFitResult FitLineEffVar(const T *x, const T *y, const T *sx, const T *sy, int n,
+                            int maxIter = 50, double tol = 1e-13)
+{
+    LineFitResult r = FitLineWLS(x, y, sy, n);
+    if (!r.ok) return r;
+
+    double sw = 0, xc = 0;
+    for (int i = 0; i < n; ++i){
+        double w = 1.0 / (double(sy[i]) * sy[i]);
+        sw += w;
+        xc += w * x[i];
+    }
+    xc /= sw;
+
+    // Parametri nelle coordinate centrate: y = a0 + b (x - xc)
+    double b = r.b;
+    double a0 = r.a + b * xc;
+
+    auto chi2At = [&](double aa, double bb){
+        double c = 0;
+        for (int i = 0; i < n; ++i){
+            double dx = x[i] - xc;
+            double res = y[i] - aa - bb * dx;
+            double V = double(sy[i]) * sy[i] + bb * bb * double(sx[i]) * sx[i];
+            c += res * res / V;
+        }
+        return c;
+    };
+
+    // Iterazioni a pesi fissati: convergono al punto fisso vicino al minimo
+    int it = 0;
+    for (; it < maxIter; ++it){
+        double s0 = 0, s1 = 0, sy0 = 0;
+        for (int i = 0; i < n; ++i){
+            double w = 1.0 / (double(sy[i]) * sy[i] + b * b * double(sx[i]) * sx[i]);
+            s0 += w;
+            s1 += w * (x[i] - xc);
+            sy0 += w * y[i];
+        }
+        double m = s1 / s0;
+        double my = sy0 / s0;
+        double sxx = 0, sxy = 0;
+        for (int i = 0; i < n; ++i){
+            double w = 1.0 / (double(sy[i]) * sy[i] + b * b * double(sx[i]) * sx[i]);
+            double dx = x[i] - xc - m;
+            sxx += w * dx * dx;
+            sxy += w * dx * (y[i] - my);
+        }
+        double bNew = sxy / sxx;
+        a0 = my - bNew * m;
+        bool conv = std::fabs(bNew - b) <= tol * std::fabs(bNew);
+        b = bNew;
+        if (conv) break;
+    }
+
+    // Passi di Newton sul chi2 completo + calcolo dell'hessiana finale
+    double haa = 0, hab = 0, hbb = 0;
+    double chi2 = chi2At(a0, b);
+    for (int step = 0; step <= maxIter; ++step){
+        double ga = 0, gb = 0;
+        haa = hab = hbb = 0;
+        for (int i = 0; i < n; ++i){
+            double dx = x[i] - xc;
+            double sx2 = double(sx[i]) * sx[i];
+            double V = double(sy[i]) * sy[i] + b * b * sx2;
+            double res = y[i] - a0 - b * dx;
+            double iV = 1.0 / V, iV2 = iV * iV;
+            ga += -2 * res * iV;
+            gb += -2 * res * dx * iV - 2 * b * sx2 * res * res * iV2;
+            haa += 2 * iV;
+            hab += 2 * dx * iV + 4 * b * sx2 * res * iV2;
+            hbb += 2 * dx * dx * iV + 8 * b * dx * sx2 * res * iV2
+                 - 2 * sx2 * res * res * iV2 + 8 * b * b * sx2 * sx2 * res * res * iV2 * iV;
+        }
+        double det = haa * hbb - hab * hab;
+        if (!(det > 0) || step == maxIter) break;
+
+        double da = -(hbb * ga - hab * gb) / det;
+        double db = -(-hab * ga + haa * gb) / det;
+        if (std::fabs(da) <= tol * (std::fabs(a0) + 1e-300) &&
+            std::fabs(db) <= tol * (std::fabs(b) + 1e-300)) break;
+
+        // Passo smorzato se il chi2 non diminuisce
+        double lambda = 1.0;
+        double c = chi2At(a0 + da, b + db);
+        while (c > chi2 && lambda > 1e-6){
+            lambda *= 0.5;
+            c = chi2At(a0 + lambda * da, b + lambda * db);
+        }
+        if (c > chi2) break;
+        a0 += lambda * da;
+        b += lambda * db;
+        chi2 = c;
+        ++it;
+    }
+
+    double det = haa * hbb - hab * hab;
+    if (!(det > 0)) {
+        r.ok = false;
+        return r;
+    }
+    // Covarianza nelle coordinate centrate: 2 * H^-1
+    double vaa = 2 * hbb / det;
+    double vbb = 2 * haa / det;
+    double vab = -2 * hab / det;
+
+    // Ritorno alle coordinate originali: a = a0 - b*xc
+    r.b = b;
+    r.a = a0 - b * xc;
+    r.err_b = std::sqrt(vbb);
+    r.err_a = std::sqrt(vaa + xc * xc * vbb - 2 * xc * vab);
+    r.cov_ab = vab - xc * vbb;
+    r.chi2 = chi2;
+    r.ndf = n - 2;
+    r.iterations = it;
+    r.ok = true;
+    return r;
+}
+
+// -----------------------------------------------------
+// Modello lineare generico y = sum_j p_j * X_ij con pesi w_i (w = nullptr per
+// il caso non pesato). La matrice di disegno X e' n x p, memorizzata per
+// colonne. Soluzione con QR di Householder sulle colonne normalizzate, che
+// evita la perdita di cifre delle equazioni normali.
+// Se scaleByResidual e' vero la covarianza e' moltiplicata per chi2/ndf
+// (convenzione NIST); altrimenti e' (X^T W X)^-1 (convenzione ROOT).
+// -----------------------------------------------------
+template <typename T>
+LinearFitResult FitLinearQR(const double *X, const T *y, const T *w, int n, int p,
+                            bool scaleByResidual = false)
+{
+    LinearFitResult r;
+    if (n <= p || p <= 0) return r;
+
+    // Copia pesata: righe moltiplicate per sqrt(w)
+    std::vector<double> A(X, X + size_t(n) * p);
+    std::vector<double> b(n);
+    for (int i = 0; i < n; ++i){
+        double sw = w ? std::sqrt(double(w[i])) : 1.0;
+        b[i] = sw * y[i];
+        for (int j = 0; j < p; ++j) A[size_t(j) * n + i] *= sw;
+    }
+
+    // Equilibratura delle colonne
+    std::vector<double> scale(p);
+    for (int j = 0; j < p; ++j){
+        double s = 0;
+        for (int i = 0; i < n; ++i) s += A[size_t(j) * n + i] * A[size_t(j) * n + i];
+        scale[j] = s > 0 ? 1.0 / std::sqrt(s) : 1.0;
+        for (int i = 0; i < n; ++i) A[size_t(j) * n + i] *= scale[j];
+    }
+
+    // Householder: A = Q R, applicando Q^T anche a b
+    std::vector<double> rdiag(p);
+    for (int k = 0; k < p; ++k){
+        double *col = &A[size_t(k) * n];
+        double norm = 0;
+        for (int i = k; i < n; ++i) norm += col[i] * col[i];
+        norm = std::sqrt(norm);
+        if (norm == 0) return r;
+        double alpha = col[k] > 0 ? -norm : norm;
+        col[k] -= alpha;
+        double vnorm2 = 0;
+        for (int i = k; i < n; ++i) vnorm2 += col[i] * col[i];
+        for (int j = k + 1; j < p; ++j){
+            double *cj = &A[size_t(j) * n];
+            double dot = 0;
+            for (int i = k; i < n; ++i) dot += col[i] * cj[i];
+            double f = 2 * dot / vnorm2;
+            for (int i = k; i < n; ++i) cj[i] -= f * col[i];
+        }
+        double dot = 0;
+        for (int i = k; i < n; ++i) dot += col[i] * b[i];
+        double f = 2 * dot / vnorm2;
+        for (int i = k; i < n; ++i) b[i] -= f * col[i];
+        rdiag[k] = alpha;
+    }
+
+    // R e' triangolare superiore: diagonale in rdiag, sopra in A
+    auto R = [&](int i, int j){ return i == j ? rdiag[i] : A[size_t(j) * n + i]; };
+
+    std::vector<double> z(p);
+    for (int i = p - 1; i >= 0; --i){
+        double s = b[i];
+        for (int j = i + 1; j < p; ++j) s -= R(i, j) * z[j];
+        z[i] = s / R(i, i);
+    }
+
+    double chi2 = 0;
+    for (int i = p; i < n; ++i) chi2 += b[i] * b[i];
+
+    // (R^T R)^-1 = R^-1 R^-T
+    std::vector<double> Rinv(size_t(p) * p, 0.0);
+    for (int j = 0; j < p; ++j){
+        Rinv[size_t(j) * p + j] = 1.0 / R(j, j);
+        for (int i = j - 1; i >= 0; --i){
+            double s = 0;
+            for (int k = i + 1; k <= j; ++k) s += R(i, k) * Rinv[size_t(k) * p + j];
+            Rinv[size_t(i) * p + j] = -s / R(i, i);
+        }
+    }
+
+    r.ndf = n - p;
+    r.chi2 = chi2;
+    double s2 = scaleByResidual ? chi2 / r.ndf : 1.0;
+    r.par.resize(p);
+    r.cov.assign(size_t(p) * p, 0.0);
+    for (int i = 0; i < p; ++i){
+        r.par[i] = z[i] * scale[i];
+        for (int j = 0; j < p; ++j){
+            double s = 0;
+            for (int k = std::max(i, j); k < p; ++k)
+                s += Rinv[size_t(i) * p + k] * Rinv[size_t(j) * p + k];
+            r.cov[size_t(i) * p + j] = s * s2 * scale[i] * scale[j];
+        }
+    }
+    r.ok = true;
+    return r;
+}
+
+// Polinomio di grado deg in x, risolto con FitLinearQR
+template <typename T>
+LinearFitResult FitPolyQR(const T *x, const T *y, const T *w, int n, int deg,
+                          bool scaleByResidual = false)
+{
+    int p = deg + 1;
+    std::vector<double> X(size_t(n) * p);
+    for (int i = 0; i < n; ++i){
+        double v = 1;
+        for (int j = 0; j < p; ++j){
+            X[size_t(j) * n + i] = v;
+            v *= x[i];
+        }
+    }
+    return FitLinearQR(X.data(), y, w, n, p, scaleByResidual);
+}
+
+} // namespace bjt
+
+#endif
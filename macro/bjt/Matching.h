@@ -0,0 +1,456 @@
+/*
+ * Selezione di coppie (o quartetti) di transistor appaiati per stadi
+ * differenziali, su un lotto intero.
+ *
+ * Due dispositivi sono compatibili se beta e V_A differiscono meno delle
+ * tolleranze relative, eventualmente allargando la differenza di nSigma
+ * errori:
+ *   |x1 - x2| + nSigma * sqrt(err1^2 + err2^2) <= tol * |x1 + x2| / 2
+ * e, se richiesto, se le coordinate di forma (bjt/ShapePCA.h, divise per la
+ * radice degli autovalori) distano meno di tolShape. Gli errori dei file
+ * comprendono la parte sistematica degli strumenti (il 3% del costruttore),
+ * comune ai due dispositivi se misurati con gli stessi strumenti: per questo
+ * nSigma vale 0 se non indicato. Il costo di una coppia e' la somma dei
+ * quadrati delle differenze divise per le tolleranze; ogni gruppo trovato
+ * riporta le differenze massime tra i suoi membri con il loro errore.
+ *
+ * I dispositivi sono distribuiti in una griglia in (log beta, log |V_A|) con
+ * kMatchCellsPerTol celle per tolleranza. Per ogni dispositivo si
+ * esaminano gli anelli di celle intorno alla sua, dal piu' vicino, finche'
+ * la distanza minima dall'anello successivo non supera il costo peggiore dei
+ * maxCandidates compatibili meno costosi trovati; nelle zone dense del lotto
+ * bastano i primi anelli. Sugli archi candidati si fa un
+ * abbinamento greedy in ordine di costo, poi lo si migliora con scambi
+ * locali: cammini aumentanti di lunghezza 3 (u libero, a-b coppia, w libero
+ * -> u-a, b-w) aumentano il numero di coppie, scambi 2-opt (a-b, c-d -> a-c,
+ * b-d) ne riducono il costo. L'algoritmo ungherese sarebbe cubico nel numero
+ * di dispositivi: su centinaia di migliaia non e' praticabile.
+ *
+ * I quartetti si ottengono abbinando allo stesso modo le coppie: due coppie
+ * sono compatibili se lo sono tutti e quattro i dispositivi incrociati.
+ */
+
+#ifndef BJT_MATCHING_H
+#define BJT_MATCHING_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Arena.h"
+#include "Batch.h"
+#include "Beta.h"
+#include "CurveStore.h"
+#include "ShapePCA.h"
+
+namespace bjt
+{
+
+constexpr int kMaxMatchShape = 8;
+constexpr int kMatchCellsPerTol = 8;
+
+struct MatchConfig
+{
+    double tolBeta = 0.01;         // differenza relativa massima di beta
+    double tolVA = 0.03;           // differenza relativa massima di V_A
+    double tolShape = 0;           // distanza massima di forma (0 = non usata)
+    double nSigma = 0;             // errori aggiunti alla differenza per la compatibilita'
+    int groupSize = 2;             // 2 = coppie, 4 = quartetti
+    int maxCandidates = 16;        // compatibili tenuti per dispositivo
+    int maxPasses = 10;            // passaggi di miglioramento
+    int nThreads = 0;              // 0 = std::thread::hardware_concurrency()
+};
+
+// Parametri dei dispositivi da abbinare, per colonne
+struct MatchDevices
+{
+    std::vector<unsigned> device;
+    std::vector<double> beta, err_beta, VA, err_VA;
+    std::vector<float> shape;      // nShape per dispositivo
+    int nShape = 0;
+
+    int GetN() const { return int(device.size()); }
+
+    void Add(unsigned dev, double b, double eb, double va, double eva, const float *s = nullptr)
+    {
+        device.push_back(dev);
+        beta.push_back(b);
+        err_beta.push_back(eb);
+        VA.push_back(va);
+        err_VA.push_back(eva);
+        for (int j = 0; j < nShape; ++j) shape.push_back(s ? s[j] : 0.f);
+    }
+};
+
+struct MatchGroup
+{
+    unsigned device[4] = {0, 0, 0, 0};
+    int n = 0;
+    double cost = 0;
+    double dBeta = 0, err_dBeta = 0;   // differenza relativa massima tra i membri e suo errore
+    double dVA = 0, err_dVA = 0;
+};
+
+struct MatchResult
+{
+    std::vector<MatchGroup> groups;
+    bool ok = true;                // false: tolleranze non positive, nessun abbinamento
+    int nDevices = 0;              // dispositivi utilizzabili
+    int nGreedy = 0;               // gruppi dopo il greedy (ultimo livello)
+    int nAugmented = 0;            // gruppi aggiunti dai cammini aumentanti
+    int nSwaps = 0;                // scambi 2-opt
+    double costGreedy = 0, cost = 0;
+};
+
+// -----------------------------------------------------
+// Parametri di ogni dispositivo dai fit del lotto: beta tra la prima e
+// l'ultima Ib del campione a Vce = betaVce, V_A media pesata sulle curve.
+// Con model si aggiungono le prime min(k, kMaxMatchShape) coordinate di forma.
+// -----------------------------------------------------
+template <typename Real>
+void FillMatchDevices(const CurveStore<Real> &store, const ShapeSamples &samples, const ResultTable &results,
+                      MatchDevices &out, const ShapeModel *model = nullptr, double betaVce = 3.0)
+{
+    out.nShape = model ? std::min(model->k, kMaxMatchShape) : 0;
+    int d = model ? model->GetDim() : 0;
+    std::vector<double> x(d), sx(d), coeffs(model ? std::max(model->k, 1) : 0);
+    float s[kMaxMatchShape];
+    for (int k = 0; k < samples.GetN(); ++k){
+        const int *c = samples.Curves(k);
+        if (samples.perSample < 2) continue;
+        BetaResult b = ComputeBeta(store.Curve(c[0]), store.Curve(c[samples.perSample - 1]), betaVce);
+        if (!b.ok) continue;
+        double sw = 0, swx = 0;
+        for (int j = 0; j < samples.perSample; ++j){
+            int i = c[j];
+            if (!results.ok[i] || !(results.err_V_A[i] > 0)) continue;
+            double w = 1 / (results.err_V_A[i] * results.err_V_A[i]);
+            sw += w;
+            swx += w * results.V_A[i];
+        }
+        if (sw == 0) continue;
+        if (model){
+            if (!ResampleSample(store, samples, k, model->layout, x.data(), sx.data())) continue;
+            model->Project(x.data(), coeffs.data());
+            for (int j = 0; j < out.nShape; ++j){
+                double ev = model->eigenvalues[j];
+                s[j] = float(ev > 0 ? coeffs[j] / std::sqrt(ev) : 0);
+            }
+        }
+        out.Add(samples.device[k], b.beta, b.err_beta, swx / sw, 1 / std::sqrt(sw), s);
+    }
+}
+
+namespace detail
+{
+
+// -----------------------------------------------------
+// Abbinamento su un insieme generico di elementi. Space fornisce GetN(),
+// le coordinate di griglia X(i), Y(i) (in unita' di cella, NAN = escluso) e
+// Cost(i, j) (INFINITY se incompatibili). Restituisce il compagno di ogni
+// elemento, -1 se resta libero.
+// -----------------------------------------------------
+template <typename Space>
+std::vector<int> MatchSpace(const Space &sp, const MatchConfig &cfg, MatchResult &stats)
+{
+    int n = sp.GetN();
+    int mc = std::max(1, cfg.maxCandidates);
+
+    // Griglia: elementi ordinati per cella, intervallo di ogni cella
+    auto cellKey = [](int64_t ix, int64_t iy){ return (uint64_t(ix) << 32) ^ uint64_t(uint32_t(iy)); };
+    std::vector<std::pair<uint64_t, int>> keyed;
+    keyed.reserve(n);
+    for (int i = 0; i < n; ++i){
+        double x = sp.X(i), y = sp.Y(i);
+        if (!std::isfinite(x) || !std::isfinite(y)) continue;
+        keyed.push_back({cellKey(int64_t(std::floor(x)), int64_t(std::floor(y))), i});
+    }
+    std::sort(keyed.begin(), keyed.end());
+    std::unordered_map<uint64_t, std::pair<int, int>> cells;
+    for (int a = 0, m = int(keyed.size()); a < m;){
+        int b = a;
+        while (b < m && keyed[b].first == keyed[a].first) ++b;
+        cells[keyed[a].first] = {a, b};
+        a = b;
+    }
+
+    // Candidati di ogni elemento, ordinati per costo
+    std::vector<int> cand(size_t(n) * mc, -1);
+    std::vector<float> candCost(size_t(n) * mc, INFINITY);
+    ParallelChunks(n, cfg.nThreads, kChunk, false, [&](int i, MonotonicArena &){
+        double x = sp.X(i), y = sp.Y(i);
+        if (!std::isfinite(x) || !std::isfinite(y)) return;
+        int *ci = cand.data() + size_t(i) * mc;
+        float *cc = candCost.data() + size_t(i) * mc;
+        int64_t ix = int64_t(std::floor(x)), iy = int64_t(std::floor(y));
+        auto scan = [&](int64_t cx, int64_t cy){
+            auto it = cells.find(cellKey(cx, cy));
+            if (it == cells.end()) return;
+            for (int r = it->second.first; r < it->second.second; ++r){
+                int j = keyed[r].second;
+                if (j == i) continue;
+                float c = float(sp.Cost(i, j));
+                if (!(c < cc[mc - 1])) continue;
+                int p = mc - 1;   // inserimento ordinato
+                while (p > 0 && cc[p - 1] > c){
+                    cc[p] = cc[p - 1];
+                    ci[p] = ci[p - 1];
+                    --p;
+                }
+                cc[p] = c;
+                ci[p] = j;
+            }
+        };
+        // Anelli di celle a distanza ring (massimo delle due coordinate)
+        for (int64_t ring = 0; ring <= sp.Reach(); ++ring){
+            if (ring > 1 && std::isfinite(cc[mc - 1]) && sp.Bound(ring - 1) >= cc[mc - 1]) break;
+            for (int64_t dx = -ring; dx <= ring; ++dx){
+                bool edge = dx == -ring || dx == ring;
+                for (int64_t dy = -ring; dy <= ring; dy += edge ? 1 : 2 * std::max<int64_t>(ring, 1))
+                    scan(ix + dx, iy + dy);
+            }
+        }
+    });
+
+    // Greedy sugli archi candidati in ordine di costo
+    std::vector<std::pair<float, std::pair<int, int>>> edges;
+    for (int i = 0; i < n; ++i)
+        for (int r = 0; r < mc; ++r){
+            int j = cand[size_t(i) * mc + r];
+            if (j < 0) break;
+            if (i < j) edges.push_back({candCost[size_t(i) * mc + r], {i, j}});
+            else {
+                // j < i: l'arco c'e' gia' se i e' tra i candidati di j
+                const int *cj = cand.data() + size_t(j) * mc;
+                if (std::find(cj, cj + mc, i) == cj + mc) edges.push_back({candCost[size_t(i) * mc + r], {j, i}});
+            }
+        }
+    std::sort(edges.begin(), edges.end());
+    std::vector<int> mate(n, -1);
+    for (const auto &e : edges){
+        int i = e.second.first, j = e.second.second;
+        if (mate[i] < 0 && mate[j] < 0){
+            mate[i] = j;
+            mate[j] = i;
+            ++stats.nGreedy;
+            stats.costGreedy += e.first;
+        }
+    }
+
+    // Miglioramenti locali
+    for (int pass = 0; pass < cfg.maxPasses; ++pass){
+        int changes = 0;
+        for (int u = 0; u < n; ++u){
+            if (mate[u] >= 0) continue;
+            const int *cu = cand.data() + size_t(u) * mc;
+            bool done = false;
+            for (int r = 0; r < mc && cu[r] >= 0 && !done; ++r){
+                int a = cu[r], b = mate[a];
+                if (b < 0){   // compagno libero
+                    mate[u] = a;
+                    mate[a] = u;
+                    ++stats.nAugmented;
+                    ++changes;
+                    break;
+                }
+                const int *cb = cand.data() + size_t(b) * mc;
+                for (int q = 0; q < mc && cb[q] >= 0; ++q){
+                    int w = cb[q];
+                    if (w == u || mate[w] >= 0) continue;
+                    mate[u] = a;
+                    mate[a] = u;
+                    mate[b] = w;
+                    mate[w] = b;
+                    ++stats.nAugmented;
+                    ++changes;
+                    done = true;
+                    break;
+                }
+            }
+        }
+        for (int a = 0; a < n; ++a){
+            int b = mate[a];
+            if (b < 0) continue;
+            const int *ca = cand.data() + size_t(a) * mc;
+            for (int r = 0; r < mc && ca[r] >= 0; ++r){
+                int c = ca[r], d = mate[c];
+                if (c == b || d < 0 || d == a) continue;
+                double bd = sp.Cost(b, d);
+                if (!std::isfinite(bd)) continue;
+                double before = sp.Cost(a, b) + sp.Cost(c, d);
+                if (candCost[size_t(a) * mc + r] + bd < before * (1 - 1e-9)){
+                    mate[a] = c;
+                    mate[c] = a;
+                    mate[b] = d;
+                    mate[d] = b;
+                    ++stats.nSwaps;
+                    ++changes;
+                    break;
+                }
+            }
+        }
+        if (changes == 0) break;
+    }
+    return mate;
+}
+
+// Dispositivi in coordinate di griglia
+struct DeviceSpace
+{
+    const MatchDevices &dev;
+    const MatchConfig &cfg;
+    double cellBeta, cellVA;
+
+    DeviceSpace(const MatchDevices &d, const MatchConfig &c)
+        : dev(d), cfg(c), cellBeta(c.tolBeta * (1 + c.tolBeta) / kMatchCellsPerTol),
+          cellVA(c.tolVA * (1 + c.tolVA) / kMatchCellsPerTol)
+    {
+    }
+
+    // Anelli da esaminare: oltre, la differenza supera la tolleranza
+    int64_t Reach() const { return kMatchCellsPerTol + 1; }
+
+    // Costo minimo a una distanza di cells celle in una coordinata: la
+    // differenza relativa e' 2 tanh(L / 2) con L quella dei logaritmi
+    double Bound(int64_t cells) const
+    {
+        double rb = 2 * std::tanh(0.5 * cells * cellBeta) / cfg.tolBeta;
+        double rv = 2 * std::tanh(0.5 * cells * cellVA) / cfg.tolVA;
+        double r = std::min(rb, rv);
+        return r * r;
+    }
+
+    int GetN() const { return dev.GetN(); }
+    double X(int i) const { return dev.beta[i] > 0 ? std::log(dev.beta[i]) / cellBeta : NAN; }
+    double Y(int i) const { return dev.VA[i] != 0 ? std::log(std::fabs(dev.VA[i])) / cellVA : NAN; }
+
+    double Cost(int i, int j) const
+    {
+        double cb = Term(dev.beta[i], dev.err_beta[i], dev.beta[j], dev.err_beta[j], cfg.tolBeta);
+        double cv = Term(dev.VA[i], dev.err_VA[i], dev.VA[j], dev.err_VA[j], cfg.tolVA);
+        double c = cb + cv;
+        if (cfg.tolShape > 0 && dev.nShape > 0){
+            const float *a = dev.shape.data() + size_t(i) * dev.nShape;
+            const float *b = dev.shape.data() + size_t(j) * dev.nShape;
+            double d2 = 0;
+            for (int k = 0; k < dev.nShape; ++k) d2 += double(a[k] - b[k]) * (a[k] - b[k]);
+            double r2 = d2 / (cfg.tolShape * cfg.tolShape);
+            c += r2 <= 1 ? r2 : INFINITY;
+        }
+        return c;
+    }
+
+    double Term(double x1, double e1, double x2, double e2, double tol) const
+    {
+        double scale = tol * 0.5 * std::fabs(x1 + x2);
+        double d = std::fabs(x1 - x2) / scale;
+        if (cfg.nSigma > 0) d += cfg.nSigma * std::sqrt(e1 * e1 + e2 * e2) / scale;
+        return d <= 1 ? d * d : INFINITY;
+    }
+};
+
+// Coppie come elementi, per i quartetti
+struct PairSpace
+{
+    const DeviceSpace &dev;
+    const std::vector<std::pair<int, int>> &pairs;
+
+    int GetN() const { return int(pairs.size()); }
+    double X(int p) const { return 0.5 * (dev.X(pairs[p].first) + dev.X(pairs[p].second)); }
+    double Y(int p) const { return 0.5 * (dev.Y(pairs[p].first) + dev.Y(pairs[p].second)); }
+    int64_t Reach() const { return dev.Reach(); }
+
+    // Se le medie distano L, i quattro scarti incrociati valgono L in media
+    double Bound(int64_t cells) const { return 4 * dev.Bound(cells); }
+
+    double Cost(int p, int q) const
+    {
+        int a[2] = {pairs[p].first, pairs[p].second};
+        int b[2] = {pairs[q].first, pairs[q].second};
+        double c = 0;
+        for (int i : a)
+            for (int j : b) c += dev.Cost(i, j);
+        return c;
+    }
+};
+
+} // namespace detail
+
+// Dispositivi, costo e differenze massime (con errore) di un gruppo di
+// righe di dev
+inline MatchGroup MakeGroup(const MatchDevices &dev, const int *rows, int n, double cost)
+{
+    MatchGroup g;
+    g.n = n;
+    g.cost = cost;
+    for (int a = 0; a < n; ++a){
+        g.device[a] = dev.device[rows[a]];
+        for (int b = a + 1; b < n; ++b){
+            int i = rows[a], j = rows[b];
+            double sb = 0.5 * std::fabs(dev.beta[i] + dev.beta[j]), sv = 0.5 * std::fabs(dev.VA[i] + dev.VA[j]);
+            double db = std::fabs(dev.beta[i] - dev.beta[j]) / sb, dv = std::fabs(dev.VA[i] - dev.VA[j]) / sv;
+            if (db >= g.dBeta){
+                g.dBeta = db;
+                g.err_dBeta = std::hypot(dev.err_beta[i], dev.err_beta[j]) / sb;
+            }
+            if (dv >= g.dVA){
+                g.dVA = dv;
+                g.err_dVA = std::hypot(dev.err_VA[i], dev.err_VA[j]) / sv;
+            }
+        }
+    }
+    return g;
+}
+
+// -----------------------------------------------------
+// Coppie o quartetti disgiunti del lotto, secondo cfg.groupSize.
+// tolBeta e tolVA devono essere positive: fissano il passo della griglia
+// -----------------------------------------------------
+inline MatchResult MatchLot(const MatchDevices &dev, const MatchConfig &cfg = MatchConfig())
+{
+    MatchResult res;
+    if (!(cfg.tolBeta > 0) || !(cfg.tolVA > 0)){
+        res.ok = false;
+        return res;
+    }
+    detail::DeviceSpace ds(dev, cfg);
+    for (int i = 0; i < dev.GetN(); ++i) res.nDevices += std::isfinite(ds.X(i)) && std::isfinite(ds.Y(i));
+
+    std::vector<int> mate = detail::MatchSpace(ds, cfg, res);
+    std::vector<std::pair<int, int>> pairs;
+    for (int i = 0; i < dev.GetN(); ++i)
+        if (mate[i] > i) pairs.push_back({i, mate[i]});
+
+    if (cfg.groupSize != 4){
+        for (const auto &p : pairs){
+            int rows[2] = {p.first, p.second};
+            res.groups.push_back(MakeGroup(dev, rows, 2, ds.Cost(p.first, p.second)));
+            res.cost += res.groups.back().cost;
+        }
+        return res;
+    }
+
+    // Quartetti: abbinamento delle coppie
+    MatchResult pairStats;
+    detail::PairSpace ps{ds, pairs};
+    std::vector<int> pmate = detail::MatchSpace(ps, cfg, pairStats);
+    res.nGreedy = pairStats.nGreedy;
+    res.nAugmented = pairStats.nAugmented;
+    res.nSwaps = pairStats.nSwaps;
+    res.costGreedy = pairStats.costGreedy;
+    for (int p = 0; p < int(pairs.size()); ++p){
+        int q = pmate[p];
+        if (q <= p) continue;
+        int rows[4] = {pairs[p].first, pairs[p].second, pairs[q].first, pairs[q].second};
+        res.groups.push_back(MakeGroup(dev, rows, 4, ps.Cost(p, q)));
+        res.cost += res.groups.back().cost;
+    }
+    return res;
+}
+
+} // namespace bjt
+
+#endif
@@ -0,0 +1,368 @@
+/*
+ * Fit di un modello generico (bjt/ModelPlugin.h) con Levenberg-Marquardt.
+ *
+ * Il chi2 e' quello di ROOT per i grafici con errori:
+ *   chi2 = sum (y - f(x))^2 / (sy^2 + (f'(x) sx)^2)
+ * (se il modello fornisce derivative_x, altrimenti contano solo gli errori
+ * su y). La covarianza e' l'inversa della matrice di Gauss-Newton nel minimo,
+ * non scalata con chi2/ndf.
+ *
+ * I modelli integrati (lineare e quadratico) e quelli caricati dai plugin
+ * passano per lo stesso codice e per lo stesso driver in blocco multi-thread
+ * di AnalyzeBatch (AnalyzeBatchModel).
+ */
+
+#ifndef BJT_MODELFIT_H
+#define BJT_MODELFIT_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "Arena.h"
+#include "Batch.h"
+#include "CurveStore.h"
+#include "EarlyFit.h"
+#include "LineFit.h"
+#include "ModelPlugin.h"
+
+namespace bjt
+{
+
+struct ModelFitResult
+{
+    int nPar = 0;
+    double par[BJT_MODEL_MAX_PARAMS] = {};
+    double cov[BJT_MODEL_MAX_PARAMS * BJT_MODEL_MAX_PARAMS] = {};
+    double chi2 = 0;
+    int ndf = 0;
+    int nPoints = 0;
+    int iterations = 0;
+    bool ok = false;
+
+    double Error(int j) const { return std::sqrt(cov[j * nPar + j]); }
+};
+
+// Cholesky di una matrice p x p simmetrica definita positiva (in place,
+// triangolo inferiore); false se non definita positiva
+inline bool CholeskyDecompose(double *A, int p)
+{
+    for (int j = 0; j < p; ++j){
+        double d = A[j * p + j];
+        for (int k = 0; k < j; ++k) d -= A[j * p + k] * A[j * p + k];
+        if (!(d > 0)) return false;
+        d = std::sqrt(d);
+        A[j * p + j] = d;
+        for (int i = j + 1; i < p; ++i){
+            double s = A[i * p + j];
+            for (int k = 0; k < j; ++k) s -= A[i * p + k] * A[j * p + k];
+            A[i * p + j] = s / d;
+        }
+    }
+    return true;
+}
+
+inline void CholeskySolve(const double *L, int p, double *b)
+{
+    for (int i = 0; i < p; ++i){
+        for (int k = 0; k < i; ++k) b[i] -= L[i * p + k] * b[k];
+        b[i] /= L[i * p + i];
+    }
+    for (int i = p - 1; i >= 0; --i){
+        for (int k = i + 1; k < p; ++k) b[i] -= L[k * p + i] * b[k];
+        b[i] /= L[i * p + i];
+    }
+}
+
+// -----------------------------------------------------
+// Fit di y = f(x; p) sui punti dati. sx puo' essere nullptr. p0 (facoltativo)
+// sostituisce la stima iniziale del modello.
+//
+// Si minimizza sum e_i^2 con i residui normalizzati e_i = (y_i - f_i) / s_i,
+// s_i^2 = sy_i^2 + (f'_i sx_i)^2: la derivata di s_i rispetto ai parametri
+// entra nello jacobiano, quindi il minimo e' quello del chi2 completo e non
+// il punto fisso dei minimi quadrati iterati. d(f')/dp e' calcolata per
+// differenze finite centrali su derivative_x.
+// -----------------------------------------------------
+inline ModelFitResult FitModel(const bjt_model_v1 &m, const double *x, const double *y, const double *sx,
+                               const double *sy, int n, MonotonicArena &arena, const double *p0 = nullptr,
+                               int maxIter = 200, double tol = 1e-12)
+{
+    ModelFitResult r;
+    int P = m.n_params;
+    r.nPar = P;
+    r.nPoints = n;
+    if (P <= 0 || P > BJT_MODEL_MAX_PARAMS || n < P) return r;
+    ArenaScope scope(arena);
+
+    double *f = arena.Allocate<double>(n);
+    double *s = arena.Allocate<double>(n);
+    double *e = arena.Allocate<double>(n);
+    double *d = arena.Allocate<double>(n);
+    double *dp = arena.Allocate<double>(n);
+    double *dm = arena.Allocate<double>(n);
+    double *J = arena.Allocate<double>(size_t(n) * P);
+
+    double p[BJT_MODEL_MAX_PARAMS];
+    if (p0)
+        std::copy(p0, p0 + P, p);
+    else if (!m.initial_guess || m.initial_guess(x, y, sy, n, p) != 0)
+        return r;
+
+    bool effVar = sx && m.derivative_x;
+    // Residui normalizzati e chi2 nel punto q
+    auto chi2At = [&](const double *q){
+        m.evaluate(q, x, f, n);
+        if (effVar) m.derivative_x(q, x, d, n);
+        double c = 0;
+        for (int i = 0; i < n; ++i){
+            double V = sy[i] * sy[i];
+            if (effVar) V += d[i] * d[i] * sx[i] * sx[i];
+            s[i] = std::sqrt(V);
+            e[i] = (y[i] - f[i]) / s[i];
+            c += e[i] * e[i];
+        }
+        return c;
+    };
+
+    // Jacobiano dei residui normalizzati in q (dopo chi2At(q)), A = Je^T Je
+    // e g = -Je^T e
+    double A[BJT_MODEL_MAX_PARAMS * BJT_MODEL_MAX_PARAMS];
+    double g[BJT_MODEL_MAX_PARAMS];
+    auto normalEquations = [&](const double *q){
+        m.jacobian(q, x, J, n);
+        for (int j = 0; j < P; ++j){
+            double *Jj = J + size_t(j) * n;
+            if (effVar){
+                double qq[BJT_MODEL_MAX_PARAMS];
+                std::copy(q, q + P, qq);
+                double h = 1e-6 * (std::fabs(q[j]) + 1e-3);
+                qq[j] = q[j] + h;
+                m.derivative_x(qq, x, dp, n);
+                qq[j] = q[j] - h;
+                m.derivative_x(qq, x, dm, n);
+                for (int i = 0; i < n; ++i){
+                    double ddj = (dp[i] - dm[i]) / (2 * h);
+                    double ri = y[i] - f[i];
+                    Jj[i] = -Jj[i] / s[i] - ri * d[i] * sx[i] * sx[i] * ddj / (s[i] * s[i] * s[i]);
+                }
+            } else {
+                for (int i = 0; i < n; ++i) Jj[i] = -Jj[i] / s[i];
+            }
+        }
+        for (int a = 0; a < P; ++a){
+            const double *Ja = J + size_t(a) * n;
+            g[a] = 0;
+            for (int i = 0; i < n; ++i) g[a] -= Ja[i] * e[i];
+            for (int b = 0; b <= a; ++b){
+                const double *Jb = J + size_t(b) * n;
+                double sum = 0;
+                for (int i = 0; i < n; ++i) sum += Ja[i] * Jb[i];
+                A[a * P + b] = A[b * P + a] = sum;
+            }
+        }
+    };
+
+    double chi2 = chi2At(p);
+    if (!std::isfinite(chi2)) return r;
+    double lambda = 1e-3;
+    int it = 0;
+    for (; it < maxIter; ++it){
+        normalEquations(p);
+        bool accepted = false;
+        double trial[BJT_MODEL_MAX_PARAMS];
+        double chi2New = chi2;
+        while (lambda < 1e12){
+            double L[BJT_MODEL_MAX_PARAMS * BJT_MODEL_MAX_PARAMS];
+            std::copy(A, A + P * P, L);
+            for (int a = 0; a < P; ++a) L[a * P + a] *= 1 + lambda;
+            double step[BJT_MODEL_MAX_PARAMS];
+            std::copy(g, g + P, step);
+            if (CholeskyDecompose(L, P)){
+                CholeskySolve(L, P, step);
+                for (int a = 0; a < P; ++a) trial[a] = p[a] + step[a];
+                chi2New = chi2At(trial);
+                if (std::isfinite(chi2New) && chi2New <= chi2){
+                    accepted = true;
+                    break;
+                }
+            }
+            lambda *= 10;
+        }
+        if (!accepted) break;
+        double dChi2 = chi2 - chi2New;
+        std::copy(trial, trial + P, p);
+        chi2 = chi2New;
+        lambda = std::max(lambda / 10, 1e-12);
+        if (dChi2 <= tol * (chi2 + tol)) break;
+    }
+
+    // Covarianza (Je^T Je)^-1 nel minimo
+    chi2 = chi2At(p);
+    normalEquations(p);
+    double L[BJT_MODEL_MAX_PARAMS * BJT_MODEL_MAX_PARAMS];
+    std::copy(A, A + P * P, L);
+    if (!CholeskyDecompose(L, P)) return r;
+    for (int b = 0; b < P; ++b){
+        double col[BJT_MODEL_MAX_PARAMS] = {};
+        col[b] = 1;
+        CholeskySolve(L, P, col);
+        for (int a = 0; a < P; ++a) r.cov[a * P + b] = col[a];
+    }
+    std::copy(p, p + P, r.par);
+    r.chi2 = chi2;
+    r.ndf = n - P;
+    r.iterations = it;
+    r.ok = true;
+    return r;
+}
+
+// -----------------------------------------------------
+// Modelli integrati
+// -----------------------------------------------------
+namespace builtin
+{
+
+// V = a + b*I, lo stesso modello di fitVI
+inline void LinEval(const double *p, const double *x, double *y, int n)
+{
+    for (int i = 0; i < n; ++i) y[i] = p[0] + p[1] * x[i];
+}
+inline void LinJac(const double *, const double *x, double *J, int n)
+{
+    for (int i = 0; i < n; ++i){
+        J[i] = 1;
+        J[n + i] = x[i];
+    }
+}
+inline void LinDx(const double *p, const double *, double *d, int n)
+{
+    for (int i = 0; i < n; ++i) d[i] = p[1];
+}
+inline int LinGuess(const double *x, const double *y, const double *sy, int n, double *p)
+{
+    LineFitResult r = FitLineWLS(x, y, sy, n);
+    p[0] = r.a;
+    p[1] = r.b;
+    return r.ok ? 0 : 1;
+}
+
+// V = a + b*I + c*I^2 (curvatura residua della regione attiva)
+inline void QuadEval(const double *p, const double *x, double *y, int n)
+{
+    for (int i = 0; i < n; ++i) y[i] = p[0] + x[i] * (p[1] + p[2] * x[i]);
+}
+inline void QuadJac(const double *, const double *x, double *J, int n)
+{
+    for (int i = 0; i < n; ++i){
+        J[i] = 1;
+        J[n + i] = x[i];
+        J[2 * n + i] = x[i] * x[i];
+    }
+}
+inline void QuadDx(const double *p, const double *x, double *d, int n)
+{
+    for (int i = 0; i < n; ++i) d[i] = p[1] + 2 * p[2] * x[i];
+}
+inline int QuadGuess(const double *x, const double *y, const double *sy, int n, double *p)
+{
+    std::vector<double> w(n);
+    for (int i = 0; i < n; ++i) w[i] = 1.0 / (sy[i] * sy[i]);
+    LinearFitResult r = FitPolyQR(x, y, w.data(), n, 2);
+    if (!r.ok) return 1;
+    std::copy(r.par.begin(), r.par.end(), p);
+    return 0;
+}
+
+inline const char *const kLinNames[] = {"a", "b"};
+inline const char *const kLinUnits[] = {"V", "V/mA"};
+inline const char *const kQuadNames[] = {"a", "b", "c"};
+inline const char *const kQuadUnits[] = {"V", "V/mA", "V/mA^2"};
+
+inline const bjt_model_v1 kLinear = {
+    BJT_MODEL_ABI_VERSION, "lineare", "V = a + b*I (regione attiva, V_A = a)", BJT_AXES_VI, 2,
+    kLinNames, kLinUnits, 1.0, 3.5, LinEval, LinJac, LinDx, LinGuess};
+
+inline const bjt_model_v1 kQuadratic = {
+    BJT_MODEL_ABI_VERSION, "quadratico", "V = a + b*I + c*I^2 (regione attiva)", BJT_AXES_VI, 3,
+    kQuadNames, kQuadUnits, 1.0, 3.5, QuadEval, QuadJac, QuadDx, QuadGuess};
+
+} // namespace builtin
+
+// Risultati per curva di un modello: parametri ed errori per colonne
+struct ModelResultTable
+{
+    int nPar = 0;
+    std::vector<double> par, err;   // par[j * nCurves + i]
+    std::vector<double> chi2;
+    std::vector<int> ndf, nPoints, ok;
+
+    int GetN() const { return int(chi2.size()); }
+    double Par(int j, int i) const { return par[size_t(j) * GetN() + i]; }
+    double Err(int j, int i) const { return err[size_t(j) * GetN() + i]; }
+
+    void Resize(int n, int p)
+    {
+        nPar = p;
+        par.assign(size_t(n) * p, 0.0);
+        err.assign(size_t(n) * p, 0.0);
+        chi2.assign(n, 0.0);
+        ndf.assign(n, 0);
+        nPoints.assign(n, 0);
+        ok.assign(n, 0);
+    }
+};
+
+// Punti della finestra di Vce negli assi del modello, in double
+template <typename Real>
+int SelectModelWindow(const CurveView<Real> &c, int axes, double vMin, double vMax, MonotonicArena &arena,
+                      double *&x, double *&y, double *&sx, double *&sy)
+{
+    x = arena.Allocate<double>(c.n);
+    y = arena.Allocate<double>(c.n);
+    sx = arena.Allocate<double>(c.n);
+    sy = arena.Allocate<double>(c.n);
+    int m = 0;
+    for (int i = 0; i < c.n; ++i){
+        if (c.vce[i] < vMin || c.vce[i] > vMax) continue;
+        bool vi = axes == BJT_AXES_VI;
+        x[m] = vi ? c.ic[i] : c.vce[i];
+        y[m] = vi ? c.vce[i] : c.ic[i];
+        sx[m] = vi ? c.errIc[i] : c.errVce[i];
+        sy[m] = vi ? c.errVce[i] : c.errIc[i];
+        ++m;
+    }
+    return m;
+}
+
+// -----------------------------------------------------
+// Fit del modello su tutte le curve, con lo stesso driver multi-thread di
+// AnalyzeBatch (cfg.nBootstrap e' ignorato)
+// -----------------------------------------------------
+template <typename Store>
+void AnalyzeBatchModel(const Store &store, const bjt_model_v1 &model, const BatchConfig &cfg,
+                       ModelResultTable &out)
+{
+    int n = store.GetNCurves();
+    int P = model.n_params;
+    out.Resize(n, P);
+    ParallelChunks(n, cfg.nThreads, kChunk, cfg.passthrough, [&](int i, MonotonicArena &arena){
+        ArenaScope scope(arena);
+        double *x, *y, *sx, *sy;
+        int m = SelectModelWindow(store.Curve(i), model.axes, cfg.vMin, cfg.vMax, arena, x, y, sx, sy);
+        ModelFitResult r = FitModel(model, x, y, sx, sy, m, arena);
+        out.nPoints[i] = m;
+        out.ok[i] = r.ok;
+        if (!r.ok) return;
+        out.chi2[i] = r.chi2;
+        out.ndf[i] = r.ndf;
+        for (int j = 0; j < P; ++j){
+            out.par[size_t(j) * n + i] = r.par[j];
+            out.err[size_t(j) * n + i] = r.Error(j);
+        }
+    });
+}
+
+} // namespace bjt
+
+#endif
@@ -0,0 +1,66 @@
+/*
+ * Interfaccia dei modelli di fit caricabili come librerie condivise.
+ *
+ * Intestazione C pura: un plugin puo' essere scritto in C o in C++ e
+ * compilato separatamente dall'analisi. Ogni libreria esporta
+ *
+ *   const bjt_model_v1 *bjt_model_entry(int index);
+ *
+ * che restituisce il modello numero index (0, 1, ...) o NULL quando non ce ne
+ * sono altri. Le funzioni lavorano su blocchi di punti, non su un punto alla
+ * volta: il driver di fit (bjt/ModelFit.h) chiama evaluate/jacobian una volta
+ * per iterazione su tutta la finestra.
+ *
+ * Esempio di plugin: macro/modelli/early_tanh.c.
+ */
+
+#ifndef BJT_MODELPLUGIN_H
+#define BJT_MODELPLUGIN_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BJT_MODEL_ABI_VERSION 1
+#define BJT_MODEL_MAX_PARAMS 8
+
+/* Assi su cui e' definito il modello y = f(x; p) */
+enum
+{
+    BJT_AXES_VI = 0,           /* x = Ic [mA], y = Vce [V] (come fitVI) */
+    BJT_AXES_IV = 1            /* x = Vce [V], y = Ic [mA] */
+};
+
+typedef struct bjt_model_v1
+{
+    int abi_version;           /* BJT_MODEL_ABI_VERSION */
+    const char *name;
+    const char *description;
+    int axes;                  /* BJT_AXES_VI o BJT_AXES_IV */
+    int n_params;              /* <= BJT_MODEL_MAX_PARAMS */
+    const char *const *param_names;
+    const char *const *param_units;
+    double default_v_min;      /* finestra di Vce suggerita [V] */
+    double default_v_max;
+
+    /* y[i] = f(x[i]; p) per i < n */
+    void (*evaluate)(const double *p, const double *x, double *y, int n);
+
+    /* J[j*n + i] = df(x[i])/dp_j, per colonne */
+    void (*jacobian)(const double *p, const double *x, double *J, int n);
+
+    /* dydx[i] = df/dx in x[i]; serve per la varianza efficace con errori su
+     * x. Puo' essere NULL: allora si usano solo gli errori su y. */
+    void (*derivative_x)(const double *p, const double *x, double *dydx, int n);
+
+    /* Stima iniziale dei parametri dai dati; 0 se riuscita */
+    int (*initial_guess)(const double *x, const double *y, const double *sy, int n, double *p);
+} bjt_model_v1;
+
+typedef const bjt_model_v1 *(*bjt_model_entry_fn)(int index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,161 @@
+/*
+ * Registro dei modelli di fit: modelli integrati piu' quelli trovati come
+ * librerie condivise (bjt/ModelPlugin.h).
+ *
+ * Alla prima chiamata di ModelRegistry::Instance() vengono caricate tutte le
+ * librerie *.so nelle cartelle elencate in BJT_MODEL_PATH (separate da ':')
+ * e, se esiste, nella cartella "modelli" della directory corrente. Le
+ * librerie restano caricate per tutta la vita del processo.
+ */
+
+#ifndef BJT_MODELREGISTRY_H
+#define BJT_MODELREGISTRY_H
+
+#include <dirent.h>
+#include <dlfcn.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ModelFit.h"
+#include "ModelPlugin.h"
+
+namespace bjt
+{
+
+class ModelRegistry
+{
+public:
+    static ModelRegistry &Instance()
+    {
+        static ModelRegistry reg(true);
+        return reg;
+    }
+
+    // Registro vuoto con i soli modelli integrati, senza ricerca dei plugin
+    ModelRegistry() : ModelRegistry(false) {}
+
+    ~ModelRegistry()
+    {
+        // Le librerie non vengono chiuse: i puntatori ai modelli restano validi
+    }
+
+    // Aggiunge un modello; false se l'ABI non e' compatibile o il nome e' gia' usato
+    bool Register(const bjt_model_v1 *m)
+    {
+        std::lock_guard<std::mutex> lock(fMutex);
+        if (!m || m->abi_version != BJT_MODEL_ABI_VERSION) return false;
+        if (m->n_params <= 0 || m->n_params > BJT_MODEL_MAX_PARAMS) return false;
+        if (!m->name || !m->evaluate || !m->jacobian || !m->initial_guess) return false;
+        for (auto *o : fModels)
+            if (std::strcmp(o->name, m->name) == 0) return false;
+        fModels.push_back(m);
+        return true;
+    }
+
+    // Carica una libreria e registra i suoi modelli; restituisce quanti
+    int LoadLibrary(const std::string &path)
+    {
+        void *h = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (!h){
+            AddError(path + ": " + dlerror());
+            return 0;
+        }
+        auto entry = reinterpret_cast<bjt_model_entry_fn>(dlsym(h, "bjt_model_entry"));
+        if (!entry){
+            AddError(path + ": simbolo bjt_model_entry mancante");
+            dlclose(h);
+            return 0;
+        }
+        int n = 0;
+        for (int k = 0; k < 64; ++k){
+            const bjt_model_v1 *m = entry(k);
+            if (!m) break;
+            if (Register(m))
+                ++n;
+            else
+                AddError(path + ": modello " + std::to_string(k) + " non valido o duplicato");
+        }
+        std::lock_guard<std::mutex> lock(fMutex);
+        fHandles.push_back(h);
+        return n;
+    }
+
+    // Carica tutte le librerie *.so di una cartella
+    int LoadDirectory(const std::string &dir)
+    {
+        DIR *d = opendir(dir.c_str());
+        if (!d) return 0;
+        std::vector<std::string> files;
+        while (dirent *e = readdir(d)){
+            std::string name = e->d_name;
+            if (name.size() > 3 && name.compare(name.size() - 3, 3, ".so") == 0)
+                files.push_back(dir + "/" + name);
+        }
+        closedir(d);
+        std::sort(files.begin(), files.end());
+        int n = 0;
+        for (auto &f : files) n += LoadLibrary(f);
+        return n;
+    }
+
+    const bjt_model_v1 *Find(const char *name) const
+    {
+        std::lock_guard<std::mutex> lock(fMutex);
+        for (auto *m : fModels)
+            if (std::strcmp(m->name, name) == 0) return m;
+        return nullptr;
+    }
+
+    std::vector<const bjt_model_v1 *> GetModels() const
+    {
+        std::lock_guard<std::mutex> lock(fMutex);
+        return fModels;
+    }
+
+    // Copia: una LoadLibrary in corso su un altro thread puo' aggiungerne
+    std::vector<std::string> GetErrors() const
+    {
+        std::lock_guard<std::mutex> lock(fMutex);
+        return fErrors;
+    }
+
+private:
+    void AddError(std::string msg)
+    {
+        std::lock_guard<std::mutex> lock(fMutex);
+        fErrors.push_back(std::move(msg));
+    }
+
+    explicit ModelRegistry(bool discover)
+    {
+        Register(&builtin::kLinear);
+        Register(&builtin::kQuadratic);
+        if (!discover) return;
+        if (const char *env = std::getenv("BJT_MODEL_PATH")){
+            std::string path = env;
+            size_t start = 0;
+            while (start <= path.size()){
+                size_t end = path.find(':', start);
+                if (end == std::string::npos) end = path.size();
+                if (end > start) LoadDirectory(path.substr(start, end - start));
+                start = end + 1;
+            }
+        }
+        LoadDirectory("modelli");
+    }
+
+    mutable std::mutex fMutex;
+    std::vector<const bjt_model_v1 *> fModels;
+    std::vector<void *> fHandles;
+    std::vector<std::string> fErrors;
+};
+
+} // namespace bjt
+
+#endif
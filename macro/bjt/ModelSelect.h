@@ -0,0 +1,416 @@
+/*
+ * Scelta automatica della finestra di fit e del modello della regione attiva,
+ * curva per curva.
+ *
+ * Invece della finestra fissa [fitV_min, fitV_max] e del solo modello
+ * lineare V = a + b*I, per ogni curva si valutano tutte le finestre
+ * [vMin, vMax] della griglia (SelectConfig) con il modello lineare e con
+ * quello quadratico V = a + b*I + c*I^2, e si sceglie la coppia con il
+ * punteggio minore. Per confrontare finestre diverse sugli stessi dati, il
+ * punteggio riguarda tutti gli N punti tra il minimo di vMins e il massimo
+ * di vMaxs: quelli fuori dalla finestra sono descritti dal modello saturo
+ * (un parametro per punto, residuo nullo). Con n punti nella finestra e p
+ * parametri:
+ *   kSelectCV   errore di previsione a K gruppi (K-fold cross-validation)
+ *               sum w (V - previsione senza il gruppo del punto)^2 nella
+ *               finestra, piu' 2 per ogni punto escluso: il modello saturo
+ *               prevede una nuova lettura con la lettura vecchia, con errore
+ *               atteso 2 in unita' di w
+ *   kSelectAIC  chi2 + 2 (p + N - n)
+ *   kSelectBIC  chi2 + (p + N - n) ln N
+ * Un punto entra nella finestra se peggiora il chi2 meno di quanto costa
+ * escluderlo: i punti della saturazione restano fuori, quelli della regione
+ * attiva dentro.
+ *
+ * Nessun fit e' rifatto da capo: i pesi w = 1 / (sV^2 + b^2 sI^2) sono
+ * fissati con la b di un fit preliminare sulla finestra di riferimento, e i
+ * punti, ordinati per Vce, sono riassunti in somme prefisse dei momenti
+ * (sum w I^k, sum w V I^k, sum w V^2) separate per gruppo di
+ * cross-validation (punto j-esimo nel gruppo j % K). Le somme di una
+ * finestra, con o senza un gruppo, sono differenze di somme prefisse, e ogni
+ * candidato costa la soluzione di un sistema 2x2 o 3x3 per gruppo. I pesi
+ * dipendono dalla pendenza, che cambia molto se la finestra entra nella
+ * saturazione: le somme prefisse sono calcolate su una griglia di pendenze
+ * (passo 10%) solo quando servono, e ogni candidato itera sulla griglia
+ * fino al punto fisso della varianza efficace. Scelta la finestra, il
+ * modello lineare e' rifatto con FitWindowEarly come nell'analisi standard;
+ * per il quadratico V_A e conduttanza sono quelle della tangente al centro
+ * della finestra.
+ *
+ * Il modello quadratico e' escluso per default: la curvatura assorbe quella
+ * della saturazione, la finestra scelta si allarga verso il ginocchio e la
+ * tangente estrapolata a I = 0 sposta V_A (vedi selezione_modelli.C).
+ */
+
+#ifndef BJT_MODELSELECT_H
+#define BJT_MODELSELECT_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "Arena.h"
+#include "Batch.h"
+#include "CurveStore.h"
+#include "EarlyFit.h"
+
+namespace bjt
+{
+
+enum SelectCriterion
+{
+    kSelectCV = 0,
+    kSelectAIC,
+    kSelectBIC
+};
+
+enum SelectModel
+{
+    kSelectLinear = 0,             // V = a + b*I
+    kSelectQuadratic               // V = a + b*I + c*I^2
+};
+
+struct SelectConfig
+{
+    std::vector<double> vMins = {0.5, 0.6, 0.8, 1.0, 1.2, 1.5};   // estremi candidati [V]
+    std::vector<double> vMaxs = {2.5, 3.0, 3.5, 4.0};
+    int criterion = kSelectCV;
+    int nFolds = 5;
+    int minPoints = 6;             // punti minimi in una finestra
+    bool quadratic = false;        // valuta anche il modello quadratico (vedi sotto)
+    double refVMin = 1.0;          // finestra del fit preliminare (pesi)
+    double refVMax = 3.5;
+};
+
+// Scelta fatta per ogni curva, indicizzata come le curve dell'archivio
+struct SelectionTable
+{
+    std::vector<double> vMin, vMax, score;
+    std::vector<int> model, nPoints, ok;
+
+    int GetN() const { return int(score.size()); }
+
+    void Resize(int n)
+    {
+        for (auto *c : {&vMin, &vMax, &score}) c->assign(n, 0.0);
+        for (auto *c : {&model, &nPoints, &ok}) c->assign(n, 0);
+    }
+};
+
+struct SelectResult
+{
+    double vMin = 0, vMax = 0, score = 0;
+    int model = kSelectLinear;
+    EarlyResult fit;               // V_A e conduttanza del candidato scelto
+    bool ok = false;
+};
+
+namespace detail
+{
+
+// Momenti pesati di un insieme di punti, con x = I - xc e y = V - yc
+struct Moments
+{
+    static const int kN = 9;
+    double m[kN] = {};             // w, wx, wx^2, wx^3, wx^4, wy, wxy, wx^2y, wy^2
+
+    void Add(double w, double x, double y)
+    {
+        double x2 = x * x;
+        m[0] += w;
+        m[1] += w * x;
+        m[2] += w * x2;
+        m[3] += w * x2 * x;
+        m[4] += w * x2 * x2;
+        m[5] += w * y;
+        m[6] += w * x * y;
+        m[7] += w * x2 * y;
+        m[8] += w * y * y;
+    }
+
+    // Matrice normale A (p x p) e termine noto c
+    void Normal(int p, double *A, double *c) const
+    {
+        for (int r = 0; r < p; ++r){
+            for (int s = 0; s < p; ++s) A[r * p + s] = m[r + s];
+            c[r] = m[5 + r];
+        }
+    }
+};
+
+// Soluzione di A x = c (simmetrica definita positiva, p <= 3) con Cholesky;
+// se inv non e' nullo vi scrive A^-1. false se A e' singolare.
+inline bool SolveSmall(int p, const double *A, const double *c, double *x, double *inv = nullptr)
+{
+    double L[9] = {};
+    for (int r = 0; r < p; ++r){
+        for (int s = 0; s <= r; ++s){
+            double v = A[r * p + s];
+            for (int k = 0; k < s; ++k) v -= L[r * 3 + k] * L[s * 3 + k];
+            if (r == s){
+                if (!(v > 1e-300 * (1 + std::fabs(A[r * p + r])))) return false;
+                L[r * 3 + r] = std::sqrt(v);
+            }
+            else
+                L[r * 3 + s] = v / L[s * 3 + s];
+        }
+    }
+    auto solve = [&](const double *b, double *out){
+        double z[3];
+        for (int r = 0; r < p; ++r){
+            double v = b[r];
+            for (int k = 0; k < r; ++k) v -= L[r * 3 + k] * z[k];
+            z[r] = v / L[r * 3 + r];
+        }
+        for (int r = p - 1; r >= 0; --r){
+            double v = z[r];
+            for (int k = r + 1; k < p; ++k) v -= L[k * 3 + r] * out[k];
+            out[r] = v / L[r * 3 + r];
+        }
+    };
+    solve(c, x);
+    if (inv){
+        for (int s = 0; s < p; ++s){
+            double e[3] = {}, col[3];
+            e[s] = 1;
+            solve(e, col);
+            for (int r = 0; r < p; ++r) inv[r * p + s] = col[r];
+        }
+    }
+    return true;
+}
+
+// sum w (y - X beta)^2 di un insieme con momenti mo
+inline double ResidualSum(const Moments &mo, int p, const double *beta)
+{
+    double A[9], c[3];
+    mo.Normal(p, A, c);
+    double q = mo.m[8];
+    for (int r = 0; r < p; ++r){
+        q -= 2 * beta[r] * c[r];
+        for (int s = 0; s < p; ++s) q += beta[r] * A[r * p + s] * beta[s];
+    }
+    return q;
+}
+
+} // namespace detail
+
+// -----------------------------------------------------
+// Sceglie finestra e modello per una curva. Costo: due fit di Early,
+// O(punti * K) per ogni pendenza della griglia usata (di solito due o tre) e
+// O(finestre * modelli * K) sistemi 2x2 o 3x3.
+// -----------------------------------------------------
+template <typename Real>
+SelectResult SelectEarly(const CurveView<Real> &c, const SelectConfig &cfg, MonotonicArena &arena = ScratchArena())
+{
+    SelectResult res;
+    if (cfg.vMins.empty() || cfg.vMaxs.empty()) return res;
+    ArenaScope scope(arena);
+
+    // Fit preliminare: pendenza di partenza per i pesi
+    EarlyResult ref = FitWindowEarly(SelectWindow(c, cfg.refVMin, cfg.refVMax, arena));
+    if (!ref.ok || ref.b == 0) return res;
+
+    // Punti nell'intervallo di tutte le finestre, ordinati per Vce crescente
+    double lo = *std::min_element(cfg.vMins.begin(), cfg.vMins.end());
+    double hi = *std::max_element(cfg.vMaxs.begin(), cfg.vMaxs.end());
+    FitWindow<Real> all = SelectWindow(c, lo, hi, arena);
+    int n = all.n;
+    if (n < cfg.minPoints) return res;
+    int *idx = arena.Allocate<int>(n);
+    for (int i = 0; i < n; ++i) idx[i] = i;
+    std::sort(idx, idx + n, [&](int i, int j){ return all.V[i] < all.V[j]; });
+    double *V = arena.Allocate<double>(n);
+    double *I = arena.Allocate<double>(n);
+    double *eV2 = arena.Allocate<double>(n);
+    double *eI2 = arena.Allocate<double>(n);
+    double xc = 0, yc = 0;
+    for (int k = 0; k < n; ++k){
+        V[k] = all.V[idx[k]];
+        I[k] = all.I[idx[k]];
+        eV2[k] = double(all.eV[idx[k]]) * all.eV[idx[k]];
+        eI2[k] = double(all.eI[idx[k]]) * all.eI[idx[k]];
+        xc += I[k];
+        yc += V[k];
+    }
+    xc /= n;
+    yc /= n;
+
+    // Somme prefisse dei momenti per gruppo, una tabella per pendenza della
+    // griglia b_j = b0 * kSlopeStep^j, costruita alla prima richiesta:
+    // tab[f * (n + 1) + k] = gruppo f, punti [0, k)
+    const double kSlopeStep = 1.1;
+    const int kSlopeGrid = 16;                 // j in [-kSlopeGrid, kSlopeGrid]
+    int K = cfg.criterion == kSelectCV ? std::max(2, cfg.nFolds) : 1;
+    detail::Moments **tables = arena.Allocate<detail::Moments *>(2 * kSlopeGrid + 1);
+    std::fill(tables, tables + 2 * kSlopeGrid + 1, nullptr);
+    auto table = [&](int j){
+        detail::Moments *&t = tables[j + kSlopeGrid];
+        if (t) return t;
+        double b = ref.b * std::pow(kSlopeStep, j);
+        t = arena.Allocate<detail::Moments>(size_t(K) * (n + 1));
+        for (int f = 0; f < K; ++f){
+            detail::Moments m;
+            t[f * (n + 1)] = m;
+            for (int k = 0; k < n; ++k){
+                if (k % K == f) m.Add(1 / (eV2[k] + b * b * eI2[k]), I[k] - xc, V[k] - yc);
+                t[f * (n + 1) + k + 1] = m;
+            }
+        }
+        return t;
+    };
+    auto slopeIndex = [&](double b){
+        if (!(b / ref.b > 0)) return 0;
+        int j = int(std::lround(std::log(b / ref.b) / std::log(kSlopeStep)));
+        return std::max(-kSlopeGrid, std::min(kSlopeGrid, j));
+    };
+
+    // Candidato: finestra [l, r), p parametri, pesi della pendenza j
+    struct Candidate
+    {
+        double score = INFINITY, beta[3] = {}, C[9] = {};
+        detail::Moments tot;
+        int j = 0;
+    };
+    detail::Moments *folds = arena.Allocate<detail::Moments>(K);
+    // Valuta in un candidato temporaneo: out cambia solo se tutto riesce, cosi'
+    // un'iterazione fallita non lascia momenti nuovi con il punteggio vecchio
+    auto evaluate = [&](int l, int r, int p, int j, Candidate &out){
+        Candidate cand;
+        const detail::Moments *t = table(j);
+        int m = r - l;
+        cand.tot = detail::Moments();
+        for (int f = 0; f < K; ++f){
+            for (int q = 0; q < detail::Moments::kN; ++q)
+                folds[f].m[q] = t[f * (n + 1) + r].m[q] - t[f * (n + 1) + l].m[q];
+            for (int q = 0; q < detail::Moments::kN; ++q) cand.tot.m[q] += folds[f].m[q];
+        }
+        double A[9], cv[3];
+        cand.tot.Normal(p, A, cv);
+        if (!detail::SolveSmall(p, A, cv, cand.beta, cand.C)) return false;
+        cand.j = j;
+        if (cfg.criterion == kSelectCV){
+            // Ogni gruppo previsto dal fit degli altri
+            double err = 0, beta[3];
+            for (int f = 0; f < K; ++f){
+                double Af[9], cf[3];
+                cand.tot.Normal(p, A, cv);
+                folds[f].Normal(p, Af, cf);
+                for (int q = 0; q < p * p; ++q) A[q] -= Af[q];
+                for (int q = 0; q < p; ++q) cv[q] -= cf[q];
+                if (!detail::SolveSmall(p, A, cv, beta)) return false;
+                err += detail::ResidualSum(folds[f], p, beta);
+            }
+            cand.score = err + 2.0 * (n - m);
+        }
+        else{
+            double chi2 = detail::ResidualSum(cand.tot, p, cand.beta);
+            cand.score = chi2 + (cfg.criterion == kSelectAIC ? 2.0 : std::log(double(n))) * (p + n - m);
+        }
+        out = cand;
+        return true;
+    };
+    // Pendenza dV/dI del candidato al centro pesato della finestra
+    auto slopeOf = [](const Candidate &cand, int p){
+        double xm = cand.tot.m[1] / cand.tot.m[0];
+        return cand.beta[1] + (p == 3 ? 2 * cand.beta[2] * xm : 0);
+    };
+
+    Candidate best;
+    int bestL = 0, bestR = 0, bestP = 0;
+    for (double vMin : cfg.vMins){
+        int l = int(std::lower_bound(V, V + n, vMin) - V);
+        for (double vMax : cfg.vMaxs){
+            int r = int(std::upper_bound(V, V + n, vMax) - V);
+            if (r - l < cfg.minPoints) continue;
+            for (int p = 2; p <= (cfg.quadratic ? 3 : 2); ++p){
+                if (r - l <= p + 1) continue;
+                // Punto fisso a pesi fissati, come in FitLineEffVar, sulla
+                // griglia delle pendenze
+                Candidate cand;
+                int j = 0;
+                bool ok = false;
+                for (int it = 0; it < 4; ++it){
+                    if (!evaluate(l, r, p, j, cand)) break;
+                    ok = true;
+                    int j1 = slopeIndex(slopeOf(cand, p));
+                    if (j1 == j) break;
+                    j = j1;
+                }
+                if (ok && cand.score < best.score){
+                    best = cand;
+                    bestL = l;
+                    bestR = r;
+                    bestP = p;
+                    res.vMin = vMin;
+                    res.vMax = vMax;
+                }
+            }
+        }
+    }
+    if (bestP == 0) return res;
+    res.score = best.score;
+    res.model = bestP == 3 ? kSelectQuadratic : kSelectLinear;
+
+    if (bestP == 2){
+        res.fit = FitWindowEarly(SelectWindow(c, res.vMin, res.vMax, arena));
+    }
+    else{
+        // Quadratico: tangente nel punto medio pesato della finestra, con la
+        // covarianza dei parametri a pesi fissati
+        const double *beta = best.beta, *C = best.C;
+        double xm = best.tot.m[1] / best.tot.m[0];
+        double sl = slopeOf(best, 3);
+        double vm = yc + beta[0] + beta[1] * xm + beta[2] * xm * xm;
+        EarlyResult &r = res.fit;
+        r.nPoints = bestR - bestL;
+        r.chi2 = detail::ResidualSum(best.tot, 3, beta);
+        r.ndf = r.nPoints - 3;
+        r.b = sl;
+        r.a = vm - sl * (xm + xc);
+        // Gradienti di V_A = a e della pendenza rispetto a beta
+        double ga[3] = {1, -xc, -xm * xm - 2 * xm * xc};
+        double gs[3] = {0, 1, 2 * xm};
+        double va = 0, vs = 0, cas = 0;
+        for (int i = 0; i < 3; ++i)
+            for (int k = 0; k < 3; ++k){
+                va += ga[i] * C[i * 3 + k] * ga[k];
+                vs += gs[i] * C[i * 3 + k] * gs[k];
+                cas += ga[i] * C[i * 3 + k] * gs[k];
+            }
+        r.err_a = std::sqrt(va);
+        r.err_b = std::sqrt(vs);
+        r.cov_ab = cas;
+        FillDerived(r);
+        r.ok = sl != 0;
+    }
+    res.ok = res.fit.ok;
+    return res;
+}
+
+// -----------------------------------------------------
+// Scelta e fit di tutte le curve, con il driver multi-thread di AnalyzeBatch
+// (di cfg contano nThreads e passthrough)
+// -----------------------------------------------------
+template <typename Store>
+void AnalyzeBatchSelect(const Store &store, const BatchConfig &cfg, const SelectConfig &sc, ResultTable &out,
+                        SelectionTable &sel)
+{
+    int n = store.GetNCurves();
+    out.Resize(n);
+    sel.Resize(n);
+    ParallelChunks(n, cfg.nThreads, kChunk, cfg.passthrough, [&](int i, MonotonicArena &arena){
+        SelectResult r = SelectEarly(store.Curve(i), sc, arena);
+        out.Set(i, r.fit);
+        sel.vMin[i] = r.vMin;
+        sel.vMax[i] = r.vMax;
+        sel.score[i] = r.score;
+        sel.model[i] = r.model;
+        sel.nPoints[i] = r.fit.nPoints;
+        sel.ok[i] = r.ok;
+    });
+}
+
+} // namespace bjt
+
+#endif
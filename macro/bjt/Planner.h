@@ -0,0 +1,181 @@
+/*
+ * Scelta adattiva delle tensioni di misura per il fit di Early.
+ *
+ * Le scansioni di data/ usano passi fissi (0.02 V vicino alla saturazione,
+ * 0.1-0.2 V oltre): molti punti pesano poco su V_A. Qui, dopo ogni lettura,
+ * si rifa' il fit V = a + b*I delle letture e si sceglie la
+ * prossima tensione tra le candidate (passo step in [vMin, vMax]) secondo il
+ * guadagno di informazione. Con la retta attuale una lettura a Vce = v da'
+ * I = (v - a) / b, u = (1, I) e peso w = 1 / (sV^2 + b^2 sI^2), con gli
+ * errori previsti dal modello strumentale (bjt/ErrorModel.h). Aggiungerla
+ * alla matrice di informazione M = sum w u u^T cambia:
+ *   det M      di un fattore 1 + w u^T C u          (criterio D, kPlanD)
+ *   var(a)     di -w (C u)_a^2 / (1 + w u^T C u)    (solo V_A, kPlanVA)
+ * con C = M^-1. Il criterio D riduce insieme le varianze di V_A e della
+ * conduttanza. Il piano D-ottimo di una retta metterebbe tutte le letture
+ * agli estremi della finestra: per distribuire i punti e poter controllare
+ * la linearita' le candidate a meno di minSpacing da una tensione gia' usata
+ * sono escluse.
+ *
+ * Ogni decisione costa un fit su qualche decina di punti e la valutazione di
+ * (vMax - vMin) / step candidate: pochi microsecondi.
+ */
+
+#ifndef BJT_PLANNER_H
+#define BJT_PLANNER_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "EarlyFit.h"
+#include "ErrorModel.h"
+
+namespace bjt
+{
+
+enum PlanCriterion
+{
+    kPlanD = 0,                    // massimo det M: V_A e conduttanza
+    kPlanVA                        // minima varianza di V_A
+};
+
+struct PlannerConfig
+{
+    double vMin = 1.0;             // finestra di fit [V]
+    double vMax = 3.5;
+    double step = 0.01;            // risoluzione delle tensioni impostate [V]
+    double minSpacing = 0.05;      // distanza minima tra due tensioni [V]
+    int nSeed = 3;                 // prime tensioni equispaziate, prima del fit
+    int maxPoints = 30;
+    double targetRelErrVA = 0;     // fine se err(V_A)/|V_A| scende sotto (0 = mai)
+    int criterion = kPlanD;
+    ScopeModel scope;
+    MeterModel meter;
+};
+
+class AdaptivePlanner
+{
+public:
+    explicit AdaptivePlanner(const PlannerConfig &cfg = PlannerConfig()) : fCfg(cfg) {}
+
+    void Reset()
+    {
+        fSet.clear();
+        fI.clear();
+        fV.clear();
+        fEI.clear();
+        fEV.clear();
+        fResult = EarlyResult();
+    }
+
+    // -----------------------------------------------------
+    // Prossima tensione da impostare; NAN se la misura e' conclusa
+    // -----------------------------------------------------
+    double Next() const
+    {
+        if (Done()) return NAN;
+        int n = int(fSet.size());
+        if (n < fCfg.nSeed || !fResult.ok || fResult.b == 0){
+            if (n < fCfg.nSeed && fCfg.nSeed > 1) return Snap(fCfg.vMin + (fCfg.vMax - fCfg.vMin) * n / (fCfg.nSeed - 1));
+            return Farthest();
+        }
+
+        // Matrice di informazione dei punti misurati e sua inversa
+        double a = fResult.a, b = fResult.b;
+        double m00 = 0, m01 = 0, m11 = 0;
+        for (size_t i = 0; i < fI.size(); ++i){
+            double w = 1 / (fEV[i] * fEV[i] + b * b * fEI[i] * fEI[i]);
+            m00 += w;
+            m01 += w * fI[i];
+            m11 += w * fI[i] * fI[i];
+        }
+        double det = m00 * m11 - m01 * m01;
+        if (!(det > 0)) return Farthest();
+        double c00 = m11 / det, c01 = -m01 / det, c11 = m00 / det;
+
+        double best = NAN, bestGain = -1;
+        int nCand = int(std::floor((fCfg.vMax - fCfg.vMin) / fCfg.step + 1e-9)) + 1;
+        for (int k = 0; k < nCand; ++k){
+            double v = fCfg.vMin + k * fCfg.step;
+            if (TooClose(v)) continue;
+            double I = (v - a) / b;
+            double sV = fCfg.scope.Error(v, fCfg.scope.ChooseScale(v));
+            double sI = fCfg.meter.Error(I);
+            double w = 1 / (sV * sV + b * b * sI * sI);
+            double cu0 = c00 + c01 * I, cu1 = c01 + c11 * I;   // C u
+            double uCu = cu0 + cu1 * I;
+            double gain = fCfg.criterion == kPlanVA ? w * cu0 * cu0 / (1 + w * uCu) : w * uCu;
+            if (gain > bestGain){
+                bestGain = gain;
+                best = v;
+            }
+        }
+        return std::isnan(best) ? Farthest() : best;
+    }
+
+    // Registra la lettura fatta alla tensione impostata setpoint e rifa' il
+    // fit. Le tensioni proposte sono nella finestra: le letture si tengono
+    // anche se il rumore le porta appena fuori.
+    void Add(double setpoint, double vce, double ic, double errVce, double errIc)
+    {
+        fSet.push_back(setpoint);
+        fI.push_back(ic);
+        fV.push_back(vce);
+        fEI.push_back(errIc);
+        fEV.push_back(errVce);
+        FitWindow<double> w;
+        w.I = fI.data();
+        w.V = fV.data();
+        w.eI = fEI.data();
+        w.eV = fEV.data();
+        w.n = int(fI.size());
+        fResult = FitWindowEarly(w);
+    }
+
+    bool Done() const
+    {
+        if (int(fSet.size()) >= fCfg.maxPoints) return true;
+        return fCfg.targetRelErrVA > 0 && fResult.ok && int(fSet.size()) >= fCfg.nSeed &&
+               fResult.err_V_A <= fCfg.targetRelErrVA * std::fabs(fResult.V_A);
+    }
+
+    const EarlyResult &GetResult() const { return fResult; }
+    const std::vector<double> &GetSetpoints() const { return fSet; }
+    int GetN() const { return int(fSet.size()); }
+
+private:
+    double Snap(double v) const { return fCfg.vMin + std::round((v - fCfg.vMin) / fCfg.step) * fCfg.step; }
+
+    bool TooClose(double v) const
+    {
+        for (double s : fSet)
+            if (std::fabs(s - v) < fCfg.minSpacing - 1e-9) return true;
+        return false;
+    }
+
+    // Candidata piu' lontana dalle tensioni gia' usate (senza fit)
+    double Farthest() const
+    {
+        double best = fCfg.vMin, bestD = -1;
+        int nCand = int(std::floor((fCfg.vMax - fCfg.vMin) / fCfg.step + 1e-9)) + 1;
+        for (int k = 0; k < nCand; ++k){
+            double v = fCfg.vMin + k * fCfg.step, d = INFINITY;
+            for (double s : fSet) d = std::min(d, std::fabs(s - v));
+            if (d > bestD){
+                bestD = d;
+                best = v;
+            }
+        }
+        return best;
+    }
+
+    PlannerConfig fCfg;
+    std::vector<double> fSet;                  // tensioni impostate
+    std::vector<double> fI, fV, fEI, fEV;      // letture
+    EarlyResult fResult;
+};
+
+} // namespace bjt
+
+#endif
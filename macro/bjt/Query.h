@@ -0,0 +1,380 @@
+/*
+ * Selezione di curve dal catalogo di un archivio (bjt/SweepArchive.h).
+ *
+ * Sintassi delle interrogazioni, ad esempio
+ *   ib == 100 && lot == 42 && ic(3) > 30
+ * - confronti  ==  !=  <  <=  >  >=  tra campi e numeri
+ * - operatori logici  &&  ||  !  (anche and, or, not) e parentesi
+ * - campi del catalogo: ib [uA], lot, device, temperature [gradi C],
+ *   scope, meter (numeri di serie), time [s, tempo Unix], n (punti),
+ *   vmin, vmax [V], icmax [mA]
+ * - ic(V): Ic [mA] alla tensione V, solo sulla griglia del catalogo
+ *   (multipli di kGridStep); fuori dal range della curva vale NAN e ogni
+ *   confronto e' falso
+ *
+ * L'interrogazione e' valutata solo sul catalogo, prima di leggere qualsiasi
+ * corpo di curva. Se e' una congiunzione con un'uguaglianza su lot, device o
+ * ib, la scansione e' limitata alle curve dell'indice corrispondente
+ * (CatalogIndex), quindi il costo e' proporzionale al risultato e non
+ * all'archivio.
+ */
+
+#ifndef BJT_QUERY_H
+#define BJT_QUERY_H
+
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "SweepArchive.h"
+
+namespace bjt
+{
+
+// Campi del catalogo accessibili dalle interrogazioni
+enum class QueryField
+{
+    kIb, kLot, kDevice, kTemperature, kScope, kMeter, kTime, kN, kVMin, kVMax, kIcMax, kIcGrid
+};
+
+inline double FieldValue(const CatalogEntry &e, QueryField f, int grid)
+{
+    switch (f){
+    case QueryField::kIb: return e.ib;
+    case QueryField::kLot: return e.lot;
+    case QueryField::kDevice: return e.device;
+    case QueryField::kTemperature: return e.temperature;
+    case QueryField::kScope: return e.scopeSerial;
+    case QueryField::kMeter: return e.meterSerial;
+    case QueryField::kTime: return double(e.time);
+    case QueryField::kN: return e.n;
+    case QueryField::kVMin: return e.vMin;
+    case QueryField::kVMax: return e.vMax;
+    case QueryField::kIcMax: return e.icMax;
+    case QueryField::kIcGrid: return e.icGrid[grid];
+    }
+    return NAN;
+}
+
+// -----------------------------------------------------
+// Indici secondari del catalogo per le uguaglianze su lot, device e ib.
+// Le liste di curve sono in ordine crescente di indice.
+// -----------------------------------------------------
+class CatalogIndex
+{
+public:
+    void Build(const std::vector<CatalogEntry> &catalog)
+    {
+        fLot.clear();
+        fDevice.clear();
+        fIb.clear();
+        for (int i = 0; i < int(catalog.size()); ++i){
+            fLot[catalog[i].lot].push_back(i);
+            fDevice[catalog[i].device].push_back(i);
+            fIb[catalog[i].ib].push_back(i);
+        }
+    }
+
+    // Curve con il campo f uguale a v; nullptr se il campo non e' indicizzato
+    const std::vector<int> *Lookup(QueryField f, double v) const
+    {
+        static const std::vector<int> kEmpty;
+        if (f == QueryField::kIb){
+            auto it = fIb.find(v);
+            return it == fIb.end() ? &kEmpty : &it->second;
+        }
+        if (f != QueryField::kLot && f != QueryField::kDevice) return nullptr;
+        if (!(v >= 0) || v != std::floor(v) || v > 4294967295.0) return &kEmpty;
+        auto &m = f == QueryField::kLot ? fLot : fDevice;
+        auto it = m.find(unsigned(v));
+        return it == m.end() ? &kEmpty : &it->second;
+    }
+
+private:
+    std::unordered_map<unsigned, std::vector<int>> fLot, fDevice;
+    std::map<double, std::vector<int>> fIb;
+};
+
+class Query
+{
+public:
+    // Compila l'interrogazione; false con un messaggio in GetError se non valida
+    bool Compile(const std::string &text)
+    {
+        fText = text;
+        fPos = 0;
+        fNodes.clear();
+        fError.clear();
+        fRoot = ParseOr();
+        SkipSpace();
+        if (fRoot >= 0 && fPos < fText.size()) Fail("testo inatteso");
+        if (!fError.empty()){
+            fNodes.clear();
+            fRoot = -1;
+            return false;
+        }
+        return true;
+    }
+
+    bool IsValid() const { return fRoot >= 0; }
+    const std::string &GetError() const { return fError; }
+
+    bool Matches(const CatalogEntry &e) const { return fRoot >= 0 && Eval(fRoot, e); }
+
+    // Indici delle curve selezionate, in ordine crescente. Con index != nullptr
+    // si usa l'uguaglianza indicizzata piu' selettiva, se c'e'.
+    std::vector<int> Select(const std::vector<CatalogEntry> &catalog, const CatalogIndex *index = nullptr) const
+    {
+        std::vector<int> out;
+        if (fRoot < 0) return out;
+        const std::vector<int> *candidates = index ? BestCandidates(fRoot, *index) : nullptr;
+        if (candidates){
+            for (int i : *candidates)
+                if (Eval(fRoot, catalog[i])) out.push_back(i);
+        } else {
+            for (int i = 0; i < int(catalog.size()); ++i)
+                if (Eval(fRoot, catalog[i])) out.push_back(i);
+        }
+        return out;
+    }
+
+    std::vector<int> Select(const SweepArchive &archive, const CatalogIndex *index = nullptr) const
+    {
+        return Select(archive.GetCatalog(), index);
+    }
+
+private:
+    enum class Op { kAnd, kOr, kNot, kEq, kNe, kLt, kLe, kGt, kGe };
+
+    // Nodo: operatore logico su (left, right) o confronto campo op valore
+    struct Node
+    {
+        Op op;
+        int left = -1, right = -1;
+        QueryField field = QueryField::kIb;
+        int grid = 0;
+        double value = 0;
+    };
+
+    bool Eval(int k, const CatalogEntry &e) const
+    {
+        const Node &n = fNodes[k];
+        switch (n.op){
+        case Op::kAnd: return Eval(n.left, e) && Eval(n.right, e);
+        case Op::kOr: return Eval(n.left, e) || Eval(n.right, e);
+        case Op::kNot: return !Eval(n.left, e);
+        default: break;
+        }
+        double x = FieldValue(e, n.field, n.grid);
+        switch (n.op){
+        case Op::kEq: return x == n.value;
+        case Op::kNe: return x != n.value && !std::isnan(x);
+        case Op::kLt: return x < n.value;
+        case Op::kLe: return x <= n.value;
+        case Op::kGt: return x > n.value;
+        case Op::kGe: return x >= n.value;
+        default: return false;
+        }
+    }
+
+    // Lista di candidati piu' corta tra le uguaglianze indicizzate in AND
+    const std::vector<int> *BestCandidates(int k, const CatalogIndex &index) const
+    {
+        const Node &n = fNodes[k];
+        if (n.op == Op::kAnd){
+            const std::vector<int> *a = BestCandidates(n.left, index);
+            const std::vector<int> *b = BestCandidates(n.right, index);
+            if (!a) return b;
+            if (!b) return a;
+            return a->size() <= b->size() ? a : b;
+        }
+        if (n.op == Op::kEq) return index.Lookup(n.field, n.value);
+        return nullptr;
+    }
+
+    // --- Parser a discesa ricorsiva ---
+
+    void Fail(const std::string &msg)
+    {
+        if (fError.empty()) fError = msg + " (posizione " + std::to_string(fPos) + ")";
+    }
+
+    void SkipSpace()
+    {
+        while (fPos < fText.size() && std::isspace((unsigned char)fText[fPos])) ++fPos;
+    }
+
+    bool Accept(const char *tok)
+    {
+        SkipSpace();
+        size_t len = std::char_traits<char>::length(tok);
+        if (fText.compare(fPos, len, tok) != 0) return false;
+        // Le parole chiave devono finire con la parola
+        if (std::isalpha((unsigned char)tok[0]) && fPos + len < fText.size() &&
+            (std::isalnum((unsigned char)fText[fPos + len]) || fText[fPos + len] == '_'))
+            return false;
+        fPos += len;
+        return true;
+    }
+
+    int Add(const Node &n)
+    {
+        fNodes.push_back(n);
+        return int(fNodes.size()) - 1;
+    }
+
+    int ParseOr()
+    {
+        int left = ParseAnd();
+        while (left >= 0 && (Accept("||") || Accept("or"))){
+            int right = ParseAnd();
+            if (right < 0) return -1;
+            Node n;
+            n.op = Op::kOr;
+            n.left = left;
+            n.right = right;
+            left = Add(n);
+        }
+        return left;
+    }
+
+    int ParseAnd()
+    {
+        int left = ParseUnary();
+        while (left >= 0 && (Accept("&&") || Accept("and"))){
+            int right = ParseUnary();
+            if (right < 0) return -1;
+            Node n;
+            n.op = Op::kAnd;
+            n.left = left;
+            n.right = right;
+            left = Add(n);
+        }
+        return left;
+    }
+
+    int ParseUnary()
+    {
+        if (Accept("!") || Accept("not")){
+            int arg = ParseUnary();
+            if (arg < 0) return -1;
+            Node n;
+            n.op = Op::kNot;
+            n.left = arg;
+            return Add(n);
+        }
+        if (Accept("(")){
+            int e = ParseOr();
+            if (e < 0) return -1;
+            if (!Accept(")")){
+                Fail("manca ')'");
+                return -1;
+            }
+            return e;
+        }
+        return ParseComparison();
+    }
+
+    bool ParseNumber(double &v)
+    {
+        SkipSpace();
+        const char *start = fText.c_str() + fPos;
+        char *end = nullptr;
+        v = std::strtod(start, &end);
+        if (end == start){
+            Fail("atteso un numero");
+            return false;
+        }
+        fPos += size_t(end - start);
+        return true;
+    }
+
+    bool ParseField(Node &n)
+    {
+        SkipSpace();
+        size_t start = fPos;
+        while (fPos < fText.size() && (std::isalnum((unsigned char)fText[fPos]) || fText[fPos] == '_')) ++fPos;
+        std::string name = fText.substr(start, fPos - start);
+        static const std::map<std::string, QueryField> kFields = {
+            {"ib", QueryField::kIb},          {"lot", QueryField::kLot},
+            {"device", QueryField::kDevice},  {"temperature", QueryField::kTemperature},
+            {"scope", QueryField::kScope},    {"meter", QueryField::kMeter},
+            {"time", QueryField::kTime},
+            {"n", QueryField::kN},            {"vmin", QueryField::kVMin},
+            {"vmax", QueryField::kVMax},      {"icmax", QueryField::kIcMax}};
+        if (name == "ic"){
+            double v;
+            if (!Accept("(")){
+                Fail("atteso '(' dopo ic");
+                return false;
+            }
+            if (!ParseNumber(v)) return false;
+            if (!Accept(")")){
+                Fail("manca ')'");
+                return false;
+            }
+            double k = v / kGridStep;
+            if (std::fabs(k - std::round(k)) > 1e-9 || k < 0 || k > kGridN - 1){
+                char msg[96];
+                std::snprintf(msg, sizeof(msg), "ic(V) e' nel catalogo solo per V multiplo di %g tra 0 e %g",
+                              kGridStep, (kGridN - 1) * kGridStep);
+                Fail(msg);
+                return false;
+            }
+            n.field = QueryField::kIcGrid;
+            n.grid = int(std::round(k));
+            return true;
+        }
+        auto it = kFields.find(name);
+        if (it == kFields.end()){
+            fPos = start;
+            Fail(name.empty() ? "atteso un campo" : "campo sconosciuto '" + name + "'");
+            return false;
+        }
+        n.field = it->second;
+        return true;
+    }
+
+    // campo op numero oppure numero op campo
+    int ParseComparison()
+    {
+        Node n;
+        SkipSpace();
+        bool numberFirst = fPos < fText.size() &&
+                           (std::isdigit((unsigned char)fText[fPos]) || fText[fPos] == '-' || fText[fPos] == '.' ||
+                            fText[fPos] == '+');
+        if (numberFirst ? !ParseNumber(n.value) : !ParseField(n)) return -1;
+
+        static const struct { const char *tok; Op op, flipped; } kOps[] = {
+            {"==", Op::kEq, Op::kEq}, {"!=", Op::kNe, Op::kNe}, {"<=", Op::kLe, Op::kGe},
+            {">=", Op::kGe, Op::kLe}, {"<", Op::kLt, Op::kGt},  {">", Op::kGt, Op::kLt}};
+        bool found = false;
+        for (auto &o : kOps)
+            if (Accept(o.tok)){
+                n.op = numberFirst ? o.flipped : o.op;
+                found = true;
+                break;
+            }
+        if (!found){
+            Fail("atteso un operatore di confronto");
+            return -1;
+        }
+        if (numberFirst ? !ParseField(n) : !ParseNumber(n.value)) return -1;
+        return Add(n);
+    }
+
+    std::string fText;
+    size_t fPos = 0;
+    std::string fError;
+    std::vector<Node> fNodes;
+    int fRoot = -1;
+};
+
+} // namespace bjt
+
+#endif
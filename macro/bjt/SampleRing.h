@@ -0,0 +1,428 @@
+/*
+ * Anello in memoria condivisa tra il processo di acquisizione (produttore)
+ * e quello di analisi (consumatore): le letture passano come record a
+ * layout fisso (SampleRecord, 64 byte) senza testo da formattare e
+ * rileggere, e l'analisi le legge direttamente nel segmento.
+ *
+ * Struttura del segmento (shm_open):
+ *   intestazione   SampleRingHeader (64 byte)
+ *   indici         head (scritto solo dal produttore) e tail (scritto solo
+ *                  dal consumatore), ciascuno nella propria linea di cache
+ *   record         capacity SampleRecord, capacity potenza di 2
+ *
+ * Un solo produttore e un solo consumatore. Il produttore chiede spazio con
+ * Claim, scrive i record al loro posto e li pubblica con Commit (store
+ * release di head); il consumatore li vede con Peek (load acquire di head),
+ * li legge nel segmento e li restituisce con Release. Ogni lato tiene una
+ * copia locale dell'indice dell'altro e la rilegge solo quando l'anello
+ * sembra pieno (o vuoto), cosi' le due linee di cache non rimbalzano a ogni
+ * record. Claim e Peek danno blocchi contigui, fino alla fine dell'anello.
+ *
+ * Il primo Claim registra il pid del produttore nell'intestazione. Se il
+ * produttore muore senza CloseStream, Wait se ne accorge (kill(pid, 0) e, su
+ * Linux, lo stato in /proc per i figli non ancora raccolti) e restituisce
+ * -1; lo stesso dopo timeoutMs senza record.
+ *
+ * StreamCurveFitter e' l'analisi in streaming dal lato del consumatore: tiene
+ * i punti della finestra di fit della curva in corso e alla fine della curva
+ * (kSampleEndOfCurve, oppure cambio di dispositivo o di Ib) esegue il fit.
+ *
+ * Su glibc precedenti alla 2.34 serve -lrt per shm_open.
+ */
+
+#ifndef BJT_SAMPLERING_H
+#define BJT_SAMPLERING_H
+
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "CurveStore.h"
+#include "EarlyFit.h"
+#include "TimeAlign.h"
+
+namespace bjt
+{
+
+enum SampleFlags
+{
+    kSampleEndOfCurve = 1u << 0,   // ultima lettura della curva
+};
+
+struct SampleRecord
+{
+    int64_t t;                      // istante della lettura [us]
+    double vce, ic;                 // [V], [mA]
+    double errVce, errIc;
+    double ib;                      // corrente di base della curva [uA]
+    uint32_t device;
+    uint32_t flags;                 // SampleFlags
+    uint64_t seq;                   // numero progressivo del produttore
+};
+static_assert(sizeof(SampleRecord) == 64, "record di una linea di cache");
+
+// Record da una riga allineata (bjt/TimeAlign.h)
+inline SampleRecord MakeSample(const AlignedRow &r, double ib, uint32_t device, uint32_t flags = 0)
+{
+    return {r.t, r.vce, r.ic, r.errVce, r.errIc, ib, device, flags, 0};
+}
+
+struct SampleRingHeader
+{
+    char magic[8];                  // "BJTRNG01"
+    uint32_t version;
+    uint32_t capacity;              // record, potenza di 2
+    uint32_t recordSize;
+    std::atomic<uint32_t> producerPid;   // 0 finche' il produttore non scrive
+    uint64_t reserved[5];
+};
+static_assert(sizeof(SampleRingHeader) == 64, "intestazione di 64 byte");
+
+struct alignas(64) SampleRingIndex
+{
+    std::atomic<uint64_t> pos;      // record scritti (head) o letti (tail) dall'inizio
+    std::atomic<uint32_t> closed;   // solo head: il produttore ha finito
+};
+static_assert(sizeof(SampleRingIndex) == 64, "indice in una linea di cache");
+
+constexpr char kRingMagic[8] = {'B', 'J', 'T', 'R', 'N', 'G', '0', '1'};
+constexpr uint32_t kRingVersion = 1;
+constexpr const char *kDefaultRingName = "/bjt_campioni";
+
+inline size_t SampleRingSize(uint32_t capacity)
+{
+    return sizeof(SampleRingHeader) + 2 * sizeof(SampleRingIndex) + size_t(capacity) * sizeof(SampleRecord);
+}
+
+// Attesa breve: qualche giro a vuoto, poi cede il processore (con meno core
+// che processi l'altro lato deve poter girare)
+inline void RingBackoff(int &spins)
+{
+    if (++spins < 256){
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+        return;
+    }
+    ::sched_yield();
+}
+
+// -----------------------------------------------------
+// Anello produttore-consumatore; ogni processo usa solo i metodi del
+// proprio lato
+// -----------------------------------------------------
+class SampleRing
+{
+public:
+    SampleRing() = default;
+    SampleRing(const SampleRing &) = delete;
+    SampleRing &operator=(const SampleRing &) = delete;
+    ~SampleRing() { Close(); }
+
+    // Crea (o ricrea vuoto) il segmento con almeno capacity record
+    bool Create(const char *name = kDefaultRingName, uint32_t capacity = 1 << 16)
+    {
+        Close();
+        uint32_t cap = 64;
+        while (cap < capacity) cap <<= 1;
+        ::shm_unlink(name);
+        int fd = ::shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd < 0) return false;
+        size_t size = SampleRingSize(cap);
+        if (::ftruncate(fd, off_t(size)) != 0 || !Map(fd, size)){
+            ::close(fd);
+            ::shm_unlink(name);
+            return false;
+        }
+        fName = name;
+        fOwner = true;
+        fHeader->version = kRingVersion;
+        fHeader->capacity = cap;
+        fHeader->recordSize = sizeof(SampleRecord);
+        fHeader->producerPid.store(0, std::memory_order_relaxed);
+        fMask = cap - 1;
+        // L'identificativo per ultimo: l'altro lato accetta il segmento solo dopo
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(fHeader->magic, kRingMagic, sizeof(kRingMagic));
+        return true;
+    }
+
+    // Apre il segmento creato dall'altro processo
+    bool Open(const char *name = kDefaultRingName)
+    {
+        Close();
+        int fd = ::shm_open(name, O_RDWR, 0);
+        if (fd < 0) return false;
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || size_t(st.st_size) < SampleRingSize(0) || !Map(fd, size_t(st.st_size))){
+            ::close(fd);
+            return false;
+        }
+        bool ok = std::memcmp(fHeader->magic, kRingMagic, sizeof(kRingMagic)) == 0;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        ok = ok && fHeader->version == kRingVersion && fHeader->recordSize == sizeof(SampleRecord) &&
+             SampleRingSize(fHeader->capacity) == fSize;
+        if (!ok){
+            Close();
+            return false;
+        }
+        fName = name;
+        fMask = fHeader->capacity - 1;
+        return true;
+    }
+
+    // Smonta il segmento; chi lo ha creato lo rimuove
+    void Close()
+    {
+        if (fHeader) ::munmap(fHeader, fSize);
+        if (fOwner && !fName.empty()) ::shm_unlink(fName.c_str());
+        fHeader = nullptr;
+        fHead = fTail = nullptr;
+        fRecords = nullptr;
+        fSize = 0;
+        fOwner = false;
+        fName.clear();
+        fCachedHead = fCachedTail = 0;
+        fIsProducer = false;
+    }
+
+    bool IsOpen() const { return fHeader != nullptr; }
+    uint32_t GetCapacity() const { return fHeader ? fHeader->capacity : 0; }
+
+    // -----------------------------------------------------
+    // Produttore
+    // -----------------------------------------------------
+
+    // Fino a n record liberi e contigui, da scrivere al loro posto e poi
+    // pubblicare con Commit; in got quanti (0 se l'anello e' pieno)
+    SampleRecord *Claim(int n, int &got)
+    {
+        if (!fIsProducer){
+            fHeader->producerPid.store(uint32_t(::getpid()), std::memory_order_release);
+            fIsProducer = true;
+        }
+        uint64_t head = fHead->pos.load(std::memory_order_relaxed);
+        uint64_t cap = fMask + 1;
+        if (head - fCachedTail + uint64_t(n) > cap) fCachedTail = fTail->pos.load(std::memory_order_acquire);
+        uint64_t free = cap - (head - fCachedTail);
+        uint64_t contiguous = cap - (head & fMask);
+        got = int(std::min<uint64_t>({uint64_t(n), free, contiguous}));
+        return fRecords + (head & fMask);
+    }
+
+    // Pubblica i primi n record dell'ultimo Claim
+    void Commit(int n)
+    {
+        uint64_t head = fHead->pos.load(std::memory_order_relaxed);
+        fHead->pos.store(head + uint64_t(n), std::memory_order_release);
+    }
+
+    // Un record, aspettando se l'anello e' pieno
+    void Push(const SampleRecord &r)
+    {
+        int got = 0, spins = 0;
+        SampleRecord *p;
+        while ((p = Claim(1, got)), got == 0) RingBackoff(spins);
+        *p = r;
+        Commit(1);
+    }
+
+    // Fine del flusso: il consumatore esce da Wait dopo gli ultimi record
+    void CloseStream()
+    {
+        fHead->closed.store(1, std::memory_order_release);
+    }
+
+    // -----------------------------------------------------
+    // Consumatore
+    // -----------------------------------------------------
+
+    // Record pubblicati e contigui, da leggere al loro posto; 0 se vuoto
+    int Peek(const SampleRecord *&p)
+    {
+        uint64_t tail = fTail->pos.load(std::memory_order_relaxed);
+        if (tail == fCachedHead) fCachedHead = fHead->pos.load(std::memory_order_acquire);
+        uint64_t avail = fCachedHead - tail;
+        uint64_t contiguous = (fMask + 1) - (tail & fMask);
+        p = fRecords + (tail & fMask);
+        return int(std::min(avail, contiguous));
+    }
+
+    // Restituisce al produttore i primi n record dell'ultimo Peek
+    void Release(int n)
+    {
+        uint64_t tail = fTail->pos.load(std::memory_order_relaxed);
+        fTail->pos.store(tail + uint64_t(n), std::memory_order_release);
+    }
+
+    // Come Peek, aspettando i record (timeoutMs < 0: senza limite). 0 a
+    // flusso chiuso e vuoto; -1 se il produttore e' morto senza chiudere il
+    // flusso o dopo timeoutMs senza record
+    int Wait(const SampleRecord *&p, int timeoutMs = -1)
+    {
+        int spins = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        for (long k = 0;; ++k){
+            int n = Peek(p);
+            if (n > 0) return n;
+            if (fHead->closed.load(std::memory_order_acquire)){
+                // Record pubblicati prima della chiusura
+                n = Peek(p);
+                return n > 0 ? n : 0;
+            }
+            // Controlli ogni 256 attese, quando l'attesa cede gia' il processore
+            if (spins >= 256 && k % 256 == 0){
+                if (!ProducerAlive()){
+                    n = Peek(p);   // ultimi record scritti prima di morire
+                    return n > 0 ? n : -1;
+                }
+                if (timeoutMs >= 0 && std::chrono::steady_clock::now() - t0 > std::chrono::milliseconds(timeoutMs))
+                    return -1;
+            }
+            RingBackoff(spins);
+        }
+    }
+
+    // Il produttore (se ha gia' scritto) esiste ancora
+    bool ProducerAlive() const
+    {
+        pid_t pid = pid_t(fHeader->producerPid.load(std::memory_order_acquire));
+        if (pid == 0) return true;
+        if (::kill(pid, 0) != 0 && errno == ESRCH) return false;
+#ifdef __linux__
+        // Un figlio morto e non ancora raccolto (zombie) risponde a kill
+        char path[64], state = 0;
+        std::snprintf(path, sizeof(path), "/proc/%d/stat", int(pid));
+        if (FILE *f = std::fopen(path, "r")){
+            int ok = std::fscanf(f, "%*d (%*[^)]) %c", &state);
+            std::fclose(f);
+            if (ok == 1 && (state == 'Z' || state == 'X')) return false;
+        }
+#endif
+        return true;
+    }
+
+private:
+    bool Map(int fd, size_t size)
+    {
+        void *p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) return false;
+        ::close(fd);
+        char *base = static_cast<char *>(p);
+        fHeader = reinterpret_cast<SampleRingHeader *>(base);
+        fHead = reinterpret_cast<SampleRingIndex *>(base + sizeof(SampleRingHeader));
+        fTail = fHead + 1;
+        fRecords = reinterpret_cast<SampleRecord *>(base + sizeof(SampleRingHeader) + 2 * sizeof(SampleRingIndex));
+        fSize = size;
+        fCachedHead = fHead->pos.load(std::memory_order_acquire);
+        fCachedTail = fTail->pos.load(std::memory_order_acquire);
+        return true;
+    }
+
+    SampleRingHeader *fHeader = nullptr;
+    SampleRingIndex *fHead = nullptr, *fTail = nullptr;
+    SampleRecord *fRecords = nullptr;
+    size_t fSize = 0;
+    uint64_t fMask = 0;
+    uint64_t fCachedHead = 0;       // consumatore: ultimo head letto
+    uint64_t fCachedTail = 0;       // produttore: ultimo tail letto
+    std::string fName;
+    bool fOwner = false;
+    bool fIsProducer = false;       // pid gia' registrato da Claim
+};
+
+// -----------------------------------------------------
+// Fit in streaming: i record arrivano in ordine, curva dopo curva
+// -----------------------------------------------------
+template <typename Real>
+class StreamCurveFitter
+{
+public:
+    StreamCurveFitter(double vMin = 1.0, double vMax = 3.5) : fVMin(vMin), fVMax(vMax) {}
+
+    // Legge n record al loro posto; sink(const CurveMeta &, const EarlyResult &)
+    // riceve ogni curva completa. Restituisce le curve chiuse.
+    template <typename Sink>
+    int Consume(const SampleRecord *p, int n, Sink &&sink)
+    {
+        int nCurves = 0;
+        for (int k = 0; k < n; ++k){
+            const SampleRecord &r = p[k];
+            if (fOpen && (r.device != fMeta.device || r.ib != fMeta.ib)){
+                Finish(sink);
+                ++nCurves;
+            }
+            if (!fOpen){
+                fOpen = true;
+                fMeta = CurveMeta();
+                fMeta.ib = r.ib;
+                fMeta.device = r.device;
+                fMeta.time = r.t / 1000000;
+            }
+            if (r.vce >= fVMin && r.vce <= fVMax){
+                fI.push_back(Real(r.ic));
+                fV.push_back(Real(r.vce));
+                fEI.push_back(Real(r.errIc));
+                fEV.push_back(Real(r.errVce));
+            }
+            ++fNSamples;
+            if (r.flags & kSampleEndOfCurve){
+                Finish(sink);
+                ++nCurves;
+            }
+        }
+        return nCurves;
+    }
+
+    // Fine del flusso: chiude l'eventuale curva in corso
+    template <typename Sink>
+    int Flush(Sink &&sink)
+    {
+        if (!fOpen) return 0;
+        Finish(sink);
+        return 1;
+    }
+
+    long GetNSamples() const { return fNSamples; }
+
+private:
+    template <typename Sink>
+    void Finish(Sink &sink)
+    {
+        FitWindow<Real> w;
+        w.I = fI.data();
+        w.V = fV.data();
+        w.eI = fEI.data();
+        w.eV = fEV.data();
+        w.n = int(fI.size());
+        sink(static_cast<const CurveMeta &>(fMeta), FitWindowEarly(w));
+        fI.clear();
+        fV.clear();
+        fEI.clear();
+        fEV.clear();
+        fOpen = false;
+    }
+
+    double fVMin, fVMax;
+    std::vector<Real> fI, fV, fEI, fEV;    // finestra della curva in corso
+    CurveMeta fMeta;
+    bool fOpen = false;
+    long fNSamples = 0;
+};
+
+} // namespace bjt
+
+#endif
@@ -0,0 +1,324 @@
+/*
+ * Acquisizione delle curve da strumenti SCPI, direttamente nell'archivio in
+ * memoria (bjt/CurveStore.h).
+ *
+ * Gli strumenti del laboratorio (alimentatore TTi EB2025T, oscilloscopio
+ * GOS-652G, multimetro Fluke 175) non hanno interfaccia remota: il driver
+ * parla con un banco SCPI equivalente (alimentatore e multimetri
+ * programmabili, eventualmente dietro un unico indirizzo) o con il simulatore
+ * strumenti/simulatore_banco.cpp. Comandi usati:
+ *   SOUR:BASE:CURR <uA>              corrente di base
+ *   SOUR:VOLT <V>;:MEAS:VOLT?;:MEAS:CURR?
+ *                                    imposta Vce e legge Vce [V] e Ic [mA];
+ *                                    risposta "V;I" su una riga
+ *   SYST:ERR?                        primo errore in coda, "0,..." se nessuno
+ *
+ * Il collegamento e' TCP ("host:porta", di solito porta 5025) o seriale
+ * ("/dev/ttyUSB0" o "/dev/ttyUSB0@115200"), con righe terminate da '\n'.
+ * Le misure sono in pipeline: fino a depth comandi sono inviati prima di
+ * leggere la prima risposta, cosi' il tempo di andata e ritorno del
+ * collegamento si paga una volta sola e non per ogni punto. Ogni lettura
+ * riceve l'istante di arrivo della risposta; gli errori sono quelli del
+ * modello strumentale (bjt/ErrorModel.h), arrotondati come nei file di
+ * data/.
+ */
+
+#ifndef BJT_SCPI_H
+#define BJT_SCPI_H
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "CurveStore.h"
+#include "ErrorModel.h"
+
+namespace bjt
+{
+
+// Istante attuale in microsecondi, tempo Unix
+inline int64_t UnixMicros()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+}
+
+// -----------------------------------------------------
+// Collegamento a righe con uno strumento, TCP o seriale
+// -----------------------------------------------------
+class ScpiLink
+{
+public:
+    ScpiLink() = default;
+    ScpiLink(const ScpiLink &) = delete;
+    ScpiLink &operator=(const ScpiLink &) = delete;
+    ~ScpiLink() { Close(); }
+
+    bool Open(const char *address)
+    {
+        Close();
+        fBuf.clear();
+        fPos = 0;
+        return address[0] == '/' ? OpenSerial(address) : OpenTcp(address);
+    }
+
+    void Close()
+    {
+        if (fFd >= 0) ::close(fFd);
+        fFd = -1;
+        fSocket = false;
+    }
+
+    bool IsOpen() const { return fFd >= 0; }
+    const std::string &GetError() const { return fError; }
+
+    // Invia una o piu' righe gia' terminate da '\n'. Sul socket senza
+    // SIGPIPE: un collegamento caduto e' un errore, non la fine del processo
+    bool Write(const std::string &text)
+    {
+        const char *p = text.data();
+        size_t left = text.size();
+        while (left > 0){
+            ssize_t w = fSocket ? ::send(fFd, p, left, MSG_NOSIGNAL) : ::write(fFd, p, left);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) return Fail("scrittura fallita");
+            p += w;
+            left -= size_t(w);
+        }
+        return true;
+    }
+
+    // Prossima riga ricevuta, senza terminatore; false se scade timeoutMs
+    bool ReadLine(std::string &line, int timeoutMs = 2000)
+    {
+        for (;;){
+            size_t nl = fBuf.find('\n', fPos);
+            if (nl != std::string::npos){
+                size_t end = nl > fPos && fBuf[nl - 1] == '\r' ? nl - 1 : nl;
+                line.assign(fBuf, fPos, end - fPos);
+                fPos = nl + 1;
+                if (fPos > 4096){
+                    fBuf.erase(0, fPos);
+                    fPos = 0;
+                }
+                return true;
+            }
+            pollfd pfd{fFd, POLLIN, 0};
+            int r = ::poll(&pfd, 1, timeoutMs);
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) return Fail("nessuna risposta entro il tempo limite");
+            char tmp[4096];
+            ssize_t n = ::read(fFd, tmp, sizeof(tmp));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return Fail("collegamento chiuso");
+            fBuf.append(tmp, size_t(n));
+        }
+    }
+
+    // Comando con risposta, senza pipeline
+    bool Query(const std::string &cmd, std::string &reply, int timeoutMs = 2000)
+    {
+        return Write(cmd + "\n") && ReadLine(reply, timeoutMs);
+    }
+
+private:
+    bool Fail(const char *what)
+    {
+        fError = what;
+        return false;
+    }
+
+    bool OpenTcp(const char *address)
+    {
+        std::string a = address;
+        size_t colon = a.rfind(':');
+        std::string host = colon == std::string::npos ? a : a.substr(0, colon);
+        std::string port = colon == std::string::npos ? "5025" : a.substr(colon + 1);
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo *res = nullptr;
+        if (::getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0 || !res) return Fail("indirizzo non valido");
+        for (addrinfo *p = res; p; p = p->ai_next){
+            int fd = ::socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+            if (fd < 0) continue;
+            if (::connect(fd, p->ai_addr, p->ai_addrlen) == 0){
+                int one = 1;   // comandi brevi: niente attesa di Nagle
+                ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                fFd = fd;
+                fSocket = true;
+                break;
+            }
+            ::close(fd);
+        }
+        ::freeaddrinfo(res);
+        return fFd >= 0 || Fail("connessione rifiutata");
+    }
+
+    bool OpenSerial(const char *address)
+    {
+        std::string a = address;
+        size_t at = a.find('@');
+        long baud = at == std::string::npos ? 9600 : std::atol(a.c_str() + at + 1);
+        std::string dev = a.substr(0, at);
+        speed_t speed;
+        switch (baud){
+        case 9600: speed = B9600; break;
+        case 19200: speed = B19200; break;
+        case 38400: speed = B38400; break;
+        case 57600: speed = B57600; break;
+        case 115200: speed = B115200; break;
+        default: return Fail("velocita' seriale non supportata");
+        }
+        fFd = ::open(dev.c_str(), O_RDWR | O_NOCTTY);
+        if (fFd < 0) return Fail("porta seriale non accessibile");
+        termios t{};
+        if (::tcgetattr(fFd, &t) != 0) return true;   // non e' un terminale (pipe, pty gia' configurata)
+        ::cfmakeraw(&t);
+        ::cfsetispeed(&t, speed);
+        ::cfsetospeed(&t, speed);
+        t.c_cflag |= CLOCAL | CREAD;
+        ::tcsetattr(fFd, TCSANOW, &t);
+        return true;
+    }
+
+    int fFd = -1;
+    bool fSocket = false;          // TCP: scritture con send
+    std::string fBuf;
+    size_t fPos = 0;
+    std::string fError;
+};
+
+struct AcquisitionConfig
+{
+    int depth = 16;                // comandi in volo al massimo
+    int timeoutMs = 2000;
+    ScopeModel scope;              // per gli errori delle letture
+    MeterModel meter;
+};
+
+struct AcquisitionStats
+{
+    int nReadings = 0;
+    double seconds = 0;            // tempo totale della curva
+    double meanLatencyUs = 0;      // dall'invio del comando alla risposta
+    double maxLatencyUs = 0;
+};
+
+// -----------------------------------------------------
+// Banco SCPI: imposta la corrente di base e misura le curve
+// -----------------------------------------------------
+class ScpiBench
+{
+public:
+    explicit ScpiBench(ScpiLink &link, const AcquisitionConfig &cfg = AcquisitionConfig()) : fLink(link), fCfg(cfg) {}
+
+    bool SetBaseCurrent(double ibMicroA)
+    {
+        char cmd[64];
+        std::snprintf(cmd, sizeof(cmd), "SOUR:BASE:CURR %.6g", ibMicroA);
+        return fLink.Write(std::string(cmd) + "\n") && CheckError();
+    }
+
+    // Nessun errore nella coda dello strumento
+    bool CheckError()
+    {
+        std::string reply;
+        if (!fLink.Query("SYST:ERR?", reply, fCfg.timeoutMs)) return Fail(fLink.GetError());
+        if (std::atoi(reply.c_str()) != 0) return Fail("errore dello strumento: " + reply);
+        return true;
+    }
+
+    // -----------------------------------------------------
+    // Misura una curva alle tensioni impostate setpoints (in pipeline) e la
+    // aggiunge a store; indice della curva o -1 (dopo un errore il
+    // collegamento va riaperto). meta.ib e' impostata a ib e,
+    // se meta.time e' 0, meta.time all'istante della prima risposta. In
+    // timestamps (se non nullo) l'istante di ogni lettura [us, tempo Unix].
+    // -----------------------------------------------------
+    template <typename Real>
+    int AcquireCurve(const std::vector<double> &setpoints, double ib, CurveMeta meta, CurveStore<Real> &store,
+                     std::vector<int64_t> *timestamps = nullptr, AcquisitionStats *stats = nullptr)
+    {
+        if (!SetBaseCurrent(ib)) return -1;
+        int n = int(setpoints.size());
+        std::vector<double> vce(n), ic(n), evce(n), eic(n);
+        if (timestamps) timestamps->assign(n, 0);
+        std::deque<int64_t> sent;   // istanti di invio dei comandi in volo
+        int64_t t0 = UnixMicros();
+        double latSum = 0, latMax = 0;
+        int next = 0;
+        std::string cmds, reply;
+        for (int i = 0; i < n; ++i){
+            // Riempie la pipeline con un'unica scrittura
+            cmds.clear();
+            int64_t now = UnixMicros();
+            while (next < n && next - i < std::max(1, fCfg.depth)){
+                char cmd[96];
+                std::snprintf(cmd, sizeof(cmd), "SOUR:VOLT %.4f;:MEAS:VOLT?;:MEAS:CURR?\n", setpoints[next]);
+                cmds += cmd;
+                sent.push_back(now);
+                ++next;
+            }
+            if ((!cmds.empty() && !fLink.Write(cmds)) || !fLink.ReadLine(reply, fCfg.timeoutMs)){
+                Fail(fLink.GetError());
+                return -1;
+            }
+            int64_t t = UnixMicros();
+            double lat = double(t - sent.front());
+            sent.pop_front();
+            latSum += lat;
+            latMax = std::max(latMax, lat);
+            if (timestamps) (*timestamps)[i] = t;
+            if (std::sscanf(reply.c_str(), "%lf;%lf", &vce[i], &ic[i]) != 2){
+                Fail("risposta non valida: " + reply);
+                return -1;
+            }
+            evce[i] = std::round(fCfg.scope.Error(vce[i], fCfg.scope.ChooseScale(vce[i])) * 1000) / 1000;
+            eic[i] = std::round(fCfg.meter.Error(ic[i]) * 1000) / 1000;
+            if (i == 0 && meta.time == 0) meta.time = t / 1000000;
+        }
+        if (stats){
+            stats->nReadings = n;
+            stats->seconds = (UnixMicros() - t0) * 1e-6;
+            stats->meanLatencyUs = n > 0 ? latSum / n : 0;
+            stats->maxLatencyUs = latMax;
+        }
+        meta.ib = ib;
+        return store.AddCurve(vce.data(), ic.data(), evce.data(), eic.data(), n, meta);
+    }
+
+    const std::string &GetError() const { return fError; }
+
+private:
+    bool Fail(const std::string &what)
+    {
+        fError = what;
+        return false;
+    }
+
+    ScpiLink &fLink;
+    AcquisitionConfig fCfg;
+    std::string fError;
+};
+
+} // namespace bjt
+
+#endif
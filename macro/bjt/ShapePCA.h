@@ -0,0 +1,437 @@
+/*
+ * Ricerca di dispositivi con curve di forma anomala con l'analisi delle
+ * componenti principali (PCA).
+ *
+ * V_A e beta non vedono gradini, rotture premature o correnti di perdita.
+ * Le curve Ic(Vce) sono ricampionate su una griglia comune di tensioni; il
+ * campione di un dispositivo e' la concatenazione delle sue curve alle Ib
+ * della ShapeLayout, divisa per la media, cosi' conta solo la forma e non la
+ * scala (beta). Mettere insieme le curve a Ib diverse serve: una corrente di
+ * perdita su una sola curva e' indistinguibile dall'effetto Early, ma non
+ * scala con Ib come lui. Con la lista di Ib vuota ogni curva e' un campione.
+ *
+ * Sul lotto si accumulano media e covarianza dei campioni (MomentAccumulator,
+ * memoria O(d^2) qualunque sia il numero di curve, stati per thread
+ * combinabili); gli autovettori della covarianza (Jacobi) danno la base delle
+ * forme normali. Il punteggio di un campione e' l'errore di ricostruzione con
+ * le prime k componenti, in unita' degli errori di misura:
+ *   score = sum_j (r_j / sigma_j)^2 / (d - k)
+ *
+ * d e' al piu' qualche centinaio, quindi la covarianza si diagonalizza
+ * esattamente: una SVD randomizzata servirebbe solo con d molto grande.
+ */
+
+#ifndef BJT_SHAPEPCA_H
+#define BJT_SHAPEPCA_H
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Arena.h"
+#include "Batch.h"
+#include "CurveStore.h"
+#include "EarlyFit.h"
+
+namespace bjt
+{
+
+// Griglia di ricampionamento: n tensioni equispaziate in [vMin, vMax]
+struct ShapeGrid
+{
+    double vMin = 0.8;             // oltre il ginocchio e coperto da tutti i file [V]
+    double vMax = 3.9;             // margine per l'ultima lettura, nominalmente 4 V
+    int n = 32;
+
+    double V(int j) const { return vMin + (vMax - vMin) * j / (n - 1); }
+};
+
+// Griglia e correnti di base del campione di un dispositivo
+struct ShapeLayout
+{
+    ShapeGrid grid;
+    std::vector<double> ibs;           // vuota: un campione per curva
+
+    int GetCurvesPerSample() const { return ibs.empty() ? 1 : int(ibs.size()); }
+    int GetDim() const { return grid.n * GetCurvesPerSample(); }
+};
+
+// -----------------------------------------------------
+// Ic e il suo errore sulla griglia, senza normalizzazione. La curva puo'
+// essere in ordine crescente o decrescente di Vce e deve coprire tutta la
+// griglia; false altrimenti.
+// -----------------------------------------------------
+template <typename Real>
+bool ResampleIc(const CurveView<Real> &c, const ShapeGrid &g, double *x, double *sx)
+{
+    if (c.n < 2) return false;
+    bool desc = c.vce[0] > c.vce[c.n - 1];
+    auto at = [&](int k){ return desc ? c.n - 1 - k : k; };   // indice in ordine crescente
+    if (c.vce[at(0)] > g.vMin || c.vce[at(c.n - 1)] < g.vMax) return false;
+
+    int k = 0;
+    for (int j = 0; j < g.n; ++j){
+        double v = g.V(j);
+        while (k < c.n - 2 && c.vce[at(k + 1)] < v) ++k;
+        int i0 = at(k), i1 = at(k + 1);
+        double dv = double(c.vce[i1]) - c.vce[i0];
+        double w = dv > 0 ? (v - c.vce[i0]) / dv : 0;
+        w = std::min(std::max(w, 0.0), 1.0);
+        x[j] = (1 - w) * c.ic[i0] + w * c.ic[i1];
+        sx[j] = std::sqrt((1 - w) * (1 - w) * double(c.errIc[i0]) * c.errIc[i0] +
+                          w * w * double(c.errIc[i1]) * c.errIc[i1]);
+    }
+    return true;
+}
+
+// Campioni del lotto: GetCurvesPerSample() indici di curva per campione,
+// nell'ordine delle Ib della ShapeLayout
+struct ShapeSamples
+{
+    int perSample = 1;
+    std::vector<int> curves;
+    std::vector<unsigned> device;
+
+    int GetN() const { return int(device.size()); }
+    const int *Curves(int s) const { return curves.data() + size_t(s) * perSample; }
+};
+
+// Raggruppa le curve per dispositivo; i dispositivi senza tutte le Ib della
+// ShapeLayout sono esclusi
+template <typename Real>
+ShapeSamples GroupSamples(const CurveStore<Real> &store, const ShapeLayout &layout)
+{
+    ShapeSamples s;
+    s.perSample = layout.GetCurvesPerSample();
+    int n = store.GetNCurves();
+    if (layout.ibs.empty()){
+        s.curves.resize(n);
+        s.device.resize(n);
+        for (int i = 0; i < n; ++i){
+            s.curves[i] = i;
+            s.device[i] = store.GetDevice(i);
+        }
+        return s;
+    }
+    std::unordered_map<unsigned, int> slot;      // dispositivo -> campione
+    std::vector<int> curves;
+    for (int i = 0; i < n; ++i){
+        int j = int(std::find(layout.ibs.begin(), layout.ibs.end(), store.GetIb(i)) - layout.ibs.begin());
+        if (j == s.perSample) continue;
+        auto it = slot.emplace(store.GetDevice(i), int(s.device.size()));
+        if (it.second){
+            s.device.push_back(store.GetDevice(i));
+            curves.resize(curves.size() + s.perSample, -1);
+        }
+        curves[size_t(it.first->second) * s.perSample + j] = i;
+    }
+    // Solo i dispositivi completi
+    size_t m = 0;
+    for (size_t k = 0; k < s.device.size(); ++k){
+        const int *c = curves.data() + k * s.perSample;
+        if (std::find(c, c + s.perSample, -1) != c + s.perSample) continue;
+        s.device[m] = s.device[k];
+        std::copy(c, c + s.perSample, curves.begin() + m * s.perSample);
+        ++m;
+    }
+    s.device.resize(m);
+    curves.resize(m * s.perSample);
+    s.curves = std::move(curves);
+    return s;
+}
+
+// Vettore di forma del campione s (d = layout.GetDim() valori), diviso per
+// la sua media; false se una curva non copre la griglia
+template <typename Store>
+bool ResampleSample(const Store &store, const ShapeSamples &samples, int s, const ShapeLayout &layout, double *x,
+                    double *sx)
+{
+    int n = layout.grid.n;
+    const int *c = samples.Curves(s);
+    for (int j = 0; j < samples.perSample; ++j)
+        if (!ResampleIc(store.Curve(c[j]), layout.grid, x + j * n, sx + j * n)) return false;
+    int d = n * samples.perSample;
+    double sum = 0;
+    for (int j = 0; j < d; ++j) sum += x[j];
+    double ref = sum / d;
+    if (!(ref > 0)) return false;
+    for (int j = 0; j < d; ++j){
+        x[j] /= ref;
+        sx[j] /= ref;
+    }
+    return true;
+}
+
+// -----------------------------------------------------
+// Media e covarianza incrementali (Welford), con unione di due
+// accumulatori (Chan et al.) per i calcoli su piu' thread o piu' lotti
+// -----------------------------------------------------
+class MomentAccumulator
+{
+public:
+    explicit MomentAccumulator(int d = 0) : fD(d), fMean(d, 0.0), fC(size_t(d) * d, 0.0), fDelta(d, 0.0) {}
+
+    void Add(const double *x)
+    {
+        fN += 1;
+        double *delta = fDelta.data();
+        for (int a = 0; a < fD; ++a){
+            delta[a] = x[a] - fMean[a];
+            fMean[a] += delta[a] / fN;
+        }
+        // C += delta (x - media nuova)^T, solo il triangolo superiore
+        for (int a = 0; a < fD; ++a){
+            double *row = fC.data() + size_t(a) * fD;
+            for (int b = a; b < fD; ++b) row[b] += delta[a] * (x[b] - fMean[b]);
+        }
+    }
+
+    void Merge(const MomentAccumulator &o)
+    {
+        if (o.fN == 0) return;
+        if (fN == 0){
+            *this = o;
+            return;
+        }
+        double n = fN + o.fN;
+        for (int a = 0; a < fD; ++a){
+            double da = o.fMean[a] - fMean[a];
+            double *row = fC.data() + size_t(a) * fD;
+            const double *orow = o.fC.data() + size_t(a) * fD;
+            for (int b = a; b < fD; ++b) row[b] += orow[b] + da * (o.fMean[b] - fMean[b]) * fN * o.fN / n;
+        }
+        for (int a = 0; a < fD; ++a) fMean[a] += (o.fMean[a] - fMean[a]) * o.fN / n;
+        fN = n;
+    }
+
+    int GetDim() const { return fD; }
+    double GetN() const { return fN; }
+    const std::vector<double> &GetMean() const { return fMean; }
+
+    // Covarianza campionaria, matrice d x d completa
+    std::vector<double> Covariance() const
+    {
+        std::vector<double> cov(size_t(fD) * fD, 0.0);
+        if (fN < 2) return cov;
+        for (int a = 0; a < fD; ++a)
+            for (int b = a; b < fD; ++b) cov[a * fD + b] = cov[b * fD + a] = fC[size_t(a) * fD + b] / (fN - 1);
+        return cov;
+    }
+
+private:
+    int fD;
+    double fN = 0;
+    std::vector<double> fMean, fC;
+    std::vector<double> fDelta;
+};
+
+// -----------------------------------------------------
+// Autovalori e autovettori di una matrice simmetrica d x d (Jacobi ciclico).
+// In uscita gli autovalori sono in ordine decrescente e la riga k di vecs e'
+// l'autovettore k.
+// -----------------------------------------------------
+inline void JacobiEigen(std::vector<double> A, int d, std::vector<double> &vals, std::vector<double> &vecs)
+{
+    std::vector<double> V(size_t(d) * d, 0.0);
+    for (int i = 0; i < d; ++i) V[i * d + i] = 1;
+    for (int sweep = 0; sweep < 100; ++sweep){
+        double off = 0, diag = 0;
+        for (int p = 0; p < d; ++p){
+            diag += A[p * d + p] * A[p * d + p];
+            for (int q = p + 1; q < d; ++q) off += A[p * d + q] * A[p * d + q];
+        }
+        if (off <= 1e-30 * diag || off == 0) break;
+        for (int p = 0; p < d; ++p)
+            for (int q = p + 1; q < d; ++q){
+                double apq = A[p * d + q];
+                if (apq == 0) continue;
+                double theta = (A[q * d + q] - A[p * d + p]) / (2 * apq);
+                double t = (theta >= 0 ? 1 : -1) / (std::fabs(theta) + std::sqrt(theta * theta + 1));
+                double c = 1 / std::sqrt(t * t + 1), s = t * c;
+                for (int k = 0; k < d; ++k){
+                    double akp = A[k * d + p], akq = A[k * d + q];
+                    A[k * d + p] = c * akp - s * akq;
+                    A[k * d + q] = s * akp + c * akq;
+                }
+                for (int k = 0; k < d; ++k){
+                    double apk = A[p * d + k], aqk = A[q * d + k];
+                    A[p * d + k] = c * apk - s * aqk;
+                    A[q * d + k] = s * apk + c * aqk;
+                }
+                for (int k = 0; k < d; ++k){
+                    double vkp = V[k * d + p], vkq = V[k * d + q];
+                    V[k * d + p] = c * vkp - s * vkq;
+                    V[k * d + q] = s * vkp + c * vkq;
+                }
+            }
+    }
+    std::vector<int> order(d);
+    for (int i = 0; i < d; ++i) order[i] = i;
+    std::sort(order.begin(), order.end(), [&](int a, int b){ return A[a * d + a] > A[b * d + b]; });
+    vals.resize(d);
+    vecs.resize(size_t(d) * d);
+    for (int k = 0; k < d; ++k){
+        vals[k] = A[order[k] * d + order[k]];
+        for (int i = 0; i < d; ++i) vecs[k * d + i] = V[i * d + order[k]];
+    }
+}
+
+// Base delle forme normali del lotto
+struct ShapeModel
+{
+    ShapeLayout layout;
+    int k = 0;                          // componenti usate
+    std::vector<double> mean;           // d
+    std::vector<double> basis;          // k x d, righe ortonormali
+    std::vector<double> eigenvalues;    // d, decrescenti
+
+    int GetDim() const { return layout.GetDim(); }
+
+    double ExplainedVariance(int m) const
+    {
+        double tot = 0, part = 0;
+        for (int i = 0; i < int(eigenvalues.size()); ++i){
+            tot += eigenvalues[i];
+            if (i < m) part += eigenvalues[i];
+        }
+        return tot > 0 ? part / tot : 0;
+    }
+
+    // Coordinate di x (ricampionato) sulla base; coeffs ha k elementi
+    void Project(const double *x, double *coeffs) const
+    {
+        int d = GetDim();
+        for (int c = 0; c < k; ++c){
+            double s = 0;
+            for (int j = 0; j < d; ++j) s += basis[c * d + j] * (x[j] - mean[j]);
+            coeffs[c] = s;
+        }
+    }
+
+    // Errore di ricostruzione in unita' degli errori, diviso per d - k
+    double Score(const double *x, const double *sx) const
+    {
+        int d = GetDim();
+        double coeffs[64];
+        int kk = std::min(k, 64);
+        for (int c = 0; c < kk; ++c){
+            double s = 0;
+            for (int j = 0; j < d; ++j) s += basis[c * d + j] * (x[j] - mean[j]);
+            coeffs[c] = s;
+        }
+        double chi2 = 0;
+        for (int j = 0; j < d; ++j){
+            double r = x[j] - mean[j];
+            for (int c = 0; c < kk; ++c) r -= coeffs[c] * basis[c * d + j];
+            chi2 += r * r / (sx[j] * sx[j]);
+        }
+        return chi2 / std::max(d - kk, 1);
+    }
+};
+
+// Modello con le prime k componenti della covarianza accumulata
+inline ShapeModel BuildShapeModel(const MomentAccumulator &acc, const ShapeLayout &layout, int k)
+{
+    ShapeModel m;
+    m.layout = layout;
+    int d = acc.GetDim();
+    m.k = std::max(0, std::min(k, std::min(d, 64)));
+    m.mean = acc.GetMean();
+    std::vector<double> vecs;
+    JacobiEigen(acc.Covariance(), d, m.eigenvalues, vecs);
+    m.basis.assign(vecs.begin(), vecs.begin() + size_t(m.k) * d);
+    return m;
+}
+
+// -----------------------------------------------------
+// Accumulo della covarianza su tutti i campioni, in parallelo. Restituisce il
+// numero di campioni usati (quelli che coprono la griglia). Con score non
+// nullo si usano solo i campioni con punteggio <= maxScore: un secondo
+// passaggio senza le anomalie del primo evita che le componenti principali
+// si adattino anche a loro.
+// -----------------------------------------------------
+template <typename Store>
+double AccumulateShapes(const Store &store, const ShapeSamples &samples, const ShapeLayout &layout,
+                        MomentAccumulator &acc, int nThreads = 1, const std::vector<double> *score = nullptr,
+                        double maxScore = 0)
+{
+    double before = acc.GetN();
+    int d = layout.GetDim();
+    MomentAccumulator init(d);
+    ParallelReduce(samples.GetN(), nThreads, kChunk, false, init,
+                   [&](int s, MonotonicArena &arena, MomentAccumulator &local){
+                       if (score && !((*score)[s] <= maxScore)) return;
+                       ArenaScope scope(arena);
+                       double *x = arena.Allocate<double>(d);
+                       double *sx = arena.Allocate<double>(d);
+                       if (ResampleSample(store, samples, s, layout, x, sx)) local.Add(x);
+                   },
+                   [](MomentAccumulator &a, const MomentAccumulator &b){ a.Merge(b); });
+    acc.Merge(init);
+    return acc.GetN() - before;
+}
+
+// -----------------------------------------------------
+// Fit di Early di ogni curva (come AnalyzeBatch, senza bootstrap) e accumulo
+// delle forme nello stesso passaggio sui dati: il campione di un dispositivo
+// e' accumulato insieme alla sua prima curva
+// -----------------------------------------------------
+template <typename Store>
+void AnalyzeBatchWithShapes(const Store &store, const BatchConfig &cfg, ResultTable &out,
+                            const ShapeSamples &samples, const ShapeLayout &layout, MomentAccumulator &acc)
+{
+    int n = store.GetNCurves();
+    out.Resize(n);
+    std::vector<int> first(n, -1);
+    for (int s = 0; s < samples.GetN(); ++s) first[*std::min_element(samples.Curves(s), samples.Curves(s) + samples.perSample)] = s;
+    int d = layout.GetDim();
+    MomentAccumulator init(d);
+    ParallelReduce(n, cfg.nThreads, kChunk, cfg.passthrough, init,
+                   [&](int i, MonotonicArena &arena, MomentAccumulator &local){
+                       ArenaScope scope(arena);
+                       out.Set(i, FitWindowEarly(SelectWindow(store.Curve(i), cfg.vMin, cfg.vMax, arena)));
+                       if (first[i] < 0) return;
+                       double *x = arena.Allocate<double>(d);
+                       double *sx = arena.Allocate<double>(d);
+                       if (ResampleSample(store, samples, first[i], layout, x, sx)) local.Add(x);
+                   },
+                   [](MomentAccumulator &a, const MomentAccumulator &b){ a.Merge(b); });
+    acc.Merge(init);
+}
+
+// Punteggio di ogni campione; NAN per quelli che non coprono la griglia
+template <typename Store>
+void ScoreShapes(const Store &store, const ShapeSamples &samples, const ShapeModel &model, std::vector<double> &score,
+                 int nThreads = 1)
+{
+    int n = samples.GetN();
+    int d = model.GetDim();
+    score.assign(n, NAN);
+    ParallelChunks(n, nThreads, kChunk, false, [&](int s, MonotonicArena &arena){
+        ArenaScope scope(arena);
+        double *x = arena.Allocate<double>(d);
+        double *sx = arena.Allocate<double>(d);
+        if (ResampleSample(store, samples, s, model.layout, x, sx)) score[s] = model.Score(x, sx);
+    });
+}
+
+// Soglia robusta: mediana + nSigma * 1.4826 * MAD dei punteggi finiti
+inline double RobustThreshold(const std::vector<double> &score, double nSigma = 5)
+{
+    std::vector<double> s;
+    for (double v : score)
+        if (std::isfinite(v)) s.push_back(v);
+    if (s.empty()) return NAN;
+    size_t h = s.size() / 2;
+    std::nth_element(s.begin(), s.begin() + h, s.end());
+    double med = s[h];
+    for (double &v : s) v = std::fabs(v - med);
+    std::nth_element(s.begin(), s.begin() + h, s.end());
+    return med + nSigma * 1.4826 * s[h];
+}
+
+} // namespace bjt
+
+#endif
@@ -0,0 +1,388 @@
+/*
+ * Risultati per dispositivo in memoria condivisa (shm_open), letti senza
+ * lock da un numero qualsiasi di processi (cruscotti, SPC, selezione in
+ * classi) mentre l'analisi continua a scriverli.
+ *
+ * Il segmento e' una tabella hash ad indirizzamento aperto con chiave il
+ * numero del dispositivo:
+ *   intestazione   SharedResultsHeader (64 byte)
+ *   slot           capacity SharedSlot da 384 byte (6 linee di cache)
+ * Ogni slot contiene un SharedRecord: lotto, istante e fino a kSharedPoints
+ * correnti di base, ciascuna con V_A, conduttanza, beta, errori e chi2.
+ *
+ * Concorrenza: un solo scrittore, lettori senza limite. Ogni slot ha un
+ * contatore di sequenza (seqlock): lo scrittore lo rende dispari, scrive il
+ * record e lo rende pari; il lettore copia il record e lo accetta solo se il
+ * contatore era pari e non e' cambiato, altrimenti ripete. Lo scrittore non
+ * aspetta mai i lettori. La chiave di uno slot nuovo e' scritta dopo il
+ * record, quindi un lettore che la trova vede un record completo. Il record
+ * e' memorizzato in parole atomiche (accessi relaxed, ordinati dalle
+ * barriere del seqlock), cosi' anche la lettura concorrente e' definita.
+ *
+ * Su glibc precedenti alla 2.34 serve -lrt per shm_open.
+ */
+
+#ifndef BJT_SHAREDRESULTS_H
+#define BJT_SHAREDRESULTS_H
+
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "AnalysisGraph.h"
+#include "Batch.h"
+#include "CurveStore.h"
+#include "EarlyFit.h"
+
+namespace bjt
+{
+
+constexpr int kSharedPoints = 4;                       // correnti di base per dispositivo
+constexpr const char *kDefaultSharedName = "/bjt_risultati";
+
+struct SharedPoint
+{
+    double ib;                      // [uA]
+    double V_A, err_V_A;            // [V]
+    double cond, err_cond;          // [mA/V]
+    double beta, err_beta;          // 0 se non calcolato
+    double chi2;
+    int32_t ndf;
+    int32_t ok;
+};
+
+struct SharedRecord
+{
+    uint32_t device;
+    uint32_t lot;
+    int64_t time;                   // istante dell'ultima misura [s], tempo Unix
+    int32_t nPoints;
+    int32_t reserved;
+    SharedPoint point[kSharedPoints];
+
+    // Punto alla corrente di base ib, nullptr se non c'e'
+    const SharedPoint *Find(double ib) const
+    {
+        for (int k = 0; k < nPoints; ++k)
+            if (std::fabs(point[k].ib - ib) < 1e-6 * std::fabs(ib) + 1e-9) return &point[k];
+        return nullptr;
+    }
+
+    SharedPoint *Find(double ib)
+    {
+        return const_cast<SharedPoint *>(static_cast<const SharedRecord *>(this)->Find(ib));
+    }
+};
+static_assert(sizeof(SharedRecord) % 8 == 0, "record in parole da 8 byte");
+
+constexpr int kRecordWords = int(sizeof(SharedRecord) / 8);
+constexpr uint64_t kEmptyKey = ~uint64_t(0);
+
+struct alignas(64) SharedSlot
+{
+    std::atomic<uint64_t> key;      // numero del dispositivo, kEmptyKey se libero
+    std::atomic<uint64_t> seq;      // pari: stabile; dispari: in scrittura
+    std::atomic<uint64_t> words[kRecordWords];
+};
+static_assert(sizeof(SharedSlot) == 384, "slot di 6 linee di cache");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "parole atomiche senza lock");
+
+struct SharedResultsHeader
+{
+    char magic[8];                  // "BJTRES01"
+    uint32_t version;
+    uint32_t capacity;              // slot, potenza di 2
+    std::atomic<uint32_t> nDevices; // slot occupati
+    uint32_t writerPid;
+    std::atomic<uint64_t> nPublished;   // aggiornamenti scritti
+    uint64_t reserved[4];
+};
+static_assert(sizeof(SharedResultsHeader) == 64, "intestazione di 64 byte");
+
+constexpr char kSharedMagic[8] = {'B', 'J', 'T', 'R', 'E', 'S', '0', '1'};
+constexpr uint32_t kSharedVersion = 1;
+
+inline size_t SharedSegmentSize(uint32_t capacity)
+{
+    return sizeof(SharedResultsHeader) + size_t(capacity) * sizeof(SharedSlot);
+}
+
+inline uint32_t SharedHash(uint64_t key, uint32_t mask)
+{
+    return uint32_t((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+}
+
+// -----------------------------------------------------
+// Mappatura del segmento, comune a scrittore e lettore
+// -----------------------------------------------------
+class SharedSegment
+{
+public:
+    SharedSegment() = default;
+    SharedSegment(const SharedSegment &) = delete;
+    SharedSegment &operator=(const SharedSegment &) = delete;
+    ~SharedSegment() { Unmap(); }
+
+    bool IsOpen() const { return fHeader != nullptr; }
+    uint32_t GetCapacity() const { return fHeader ? fHeader->capacity : 0; }
+    int GetNDevices() const { return fHeader ? int(fHeader->nDevices.load(std::memory_order_relaxed)) : 0; }
+    uint64_t GetNPublished() const { return fHeader ? fHeader->nPublished.load(std::memory_order_relaxed) : 0; }
+
+protected:
+    bool Map(int fd, size_t size, bool writable)
+    {
+        void *p = ::mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) return false;
+        fHeader = static_cast<SharedResultsHeader *>(p);
+        fSlots = reinterpret_cast<SharedSlot *>(static_cast<char *>(p) + sizeof(SharedResultsHeader));
+        fSize = size;
+        return true;
+    }
+
+    void Unmap()
+    {
+        if (fHeader) ::munmap(fHeader, fSize);
+        fHeader = nullptr;
+        fSlots = nullptr;
+        fSize = 0;
+    }
+
+    // Slot con la chiave key, oppure (se insert) il primo libero lungo la
+    // sequenza di sondaggio; -1 se assente o tabella piena
+    int Probe(uint64_t key, bool insert) const
+    {
+        uint32_t mask = fHeader->capacity - 1;
+        uint32_t h = SharedHash(key, mask);
+        for (uint32_t k = 0; k <= mask; ++k){
+            uint32_t s = (h + k) & mask;
+            uint64_t kk = fSlots[s].key.load(std::memory_order_acquire);
+            if (kk == key) return int(s);
+            if (kk == kEmptyKey) return insert ? int(s) : -1;
+        }
+        return -1;
+    }
+
+    SharedResultsHeader *fHeader = nullptr;
+    SharedSlot *fSlots = nullptr;
+    size_t fSize = 0;
+};
+
+// -----------------------------------------------------
+// Scrittore (uno solo per segmento)
+// -----------------------------------------------------
+class SharedResultsWriter : public SharedSegment
+{
+public:
+    ~SharedResultsWriter() { Close(); }
+
+    // Crea (o ricrea vuoto) il segmento name per almeno maxDevices dispositivi;
+    // la tabella e' tenuta piena al piu' per tre quarti
+    bool Create(const char *name = kDefaultSharedName, int maxDevices = 1 << 14)
+    {
+        Close();
+        uint32_t capacity = 16;
+        while (capacity < uint32_t(maxDevices) + uint32_t(maxDevices) / 3 + 1) capacity <<= 1;
+        ::shm_unlink(name);
+        int fd = ::shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd < 0) return false;
+        size_t size = SharedSegmentSize(capacity);
+        if (::ftruncate(fd, off_t(size)) != 0){
+            ::close(fd);
+            ::shm_unlink(name);
+            return false;
+        }
+        if (!Map(fd, size, true)){
+            ::shm_unlink(name);
+            return false;
+        }
+        fName = name;
+        // Il segmento nuovo e' azzerato: restano da marcare le chiavi libere
+        for (uint32_t s = 0; s < capacity; ++s) fSlots[s].key.store(kEmptyKey, std::memory_order_relaxed);
+        fHeader->version = kSharedVersion;
+        fHeader->capacity = capacity;
+        fHeader->nDevices.store(0, std::memory_order_relaxed);
+        fHeader->writerPid = uint32_t(::getpid());
+        fHeader->nPublished.store(0, std::memory_order_relaxed);
+        fMaxDevices = capacity / 4 * 3;
+        // L'identificativo per ultimo: i lettori accettano il segmento solo dopo
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(fHeader->magic, kSharedMagic, sizeof(kSharedMagic));
+        return true;
+    }
+
+    // Smonta il segmento; se unlink lo rimuove (i lettori gia' collegati
+    // continuano a vedere l'ultimo contenuto)
+    void Close(bool unlink = false)
+    {
+        Unmap();
+        if (unlink && !fName.empty()) ::shm_unlink(fName.c_str());
+        fName.clear();
+    }
+
+    // Scrive il punto (ib, r, beta) del dispositivo meta.device, sostituendo
+    // quello con la stessa ib; false se la tabella o il record sono pieni
+    bool Publish(const CurveMeta &meta, const EarlyResult &r, double beta = 0, double err_beta = 0)
+    {
+        uint64_t key = meta.device;
+        int s = Probe(key, true);
+        if (s < 0) return false;
+        SharedSlot &slot = fSlots[s];
+        bool isNew = slot.key.load(std::memory_order_relaxed) == kEmptyKey;
+        if (isNew && fHeader->nDevices.load(std::memory_order_relaxed) >= fMaxDevices) return false;
+        SharedRecord rec = Current(slot);   // azzerato se lo slot e' nuovo
+        rec.device = meta.device;
+        rec.lot = meta.lot;
+        rec.time = std::max(rec.time, meta.time);
+        SharedPoint *p = rec.Find(meta.ib);
+        if (!p){
+            if (rec.nPoints == kSharedPoints) return false;
+            p = &rec.point[rec.nPoints++];
+        }
+        *p = {meta.ib, r.V_A, r.err_V_A, r.cond, r.err_cond, beta, err_beta, r.chi2, r.ndf, r.ok};
+        Store(slot, rec);
+        if (isNew){
+            // Prima il record e poi la chiave: chi trova la chiave vede il record
+            slot.key.store(key, std::memory_order_release);
+            fHeader->nDevices.fetch_add(1, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    // Tutte le curve di un archivio, con i risultati di AnalyzeBatch; il
+    // numero di curve scritte
+    template <typename Store>
+    int PublishBatch(const Store &store, const ResultTable &res)
+    {
+        int n = 0;
+        for (int i = 0; i < res.GetN(); ++i) n += Publish(MetaOf(store, i), res.Get(i));
+        return n;
+    }
+
+    // Come sopra, con beta dalla GraphTable di AnalyzeBatchGraph
+    template <typename Store>
+    int PublishBatch(const Store &store, const GraphTable &t)
+    {
+        int n = 0;
+        for (int i = 0; i < t.GetN(); ++i) n += Publish(MetaOf(store, i), t.res.Get(i), t.beta[i], t.err_beta[i]);
+        return n;
+    }
+
+private:
+    // Lo scrittore e' l'unico a modificare lo slot: lettura diretta
+    static SharedRecord Current(const SharedSlot &slot)
+    {
+        uint64_t w[kRecordWords];
+        for (int k = 0; k < kRecordWords; ++k) w[k] = slot.words[k].load(std::memory_order_relaxed);
+        SharedRecord rec;
+        std::memcpy(&rec, w, sizeof(rec));
+        return rec;
+    }
+
+    void Store(SharedSlot &slot, const SharedRecord &rec)
+    {
+        uint64_t w[kRecordWords];
+        std::memcpy(w, &rec, sizeof(rec));
+        uint64_t s = slot.seq.load(std::memory_order_relaxed);
+        slot.seq.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (int k = 0; k < kRecordWords; ++k) slot.words[k].store(w[k], std::memory_order_relaxed);
+        slot.seq.store(s + 2, std::memory_order_release);
+        fHeader->nPublished.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    template <typename Store>
+    static CurveMeta MetaOf(const Store &store, int i)
+    {
+        CurveMeta m;
+        m.ib = store.GetIb(i);
+        m.device = store.GetDevice(i);
+        m.lot = store.GetLot(i);
+        m.time = store.GetTime(i);
+        return m;
+    }
+
+    std::string fName;
+    uint32_t fMaxDevices = 0;
+};
+
+// -----------------------------------------------------
+// Lettore: qualsiasi numero, in qualsiasi processo
+// -----------------------------------------------------
+class SharedResultsReader : public SharedSegment
+{
+public:
+    static constexpr int kMaxRetries = 1 << 20;
+
+    ~SharedResultsReader() { Unmap(); }
+
+    bool Open(const char *name = kDefaultSharedName)
+    {
+        Unmap();
+        int fd = ::shm_open(name, O_RDONLY, 0);
+        if (fd < 0) return false;
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(SharedResultsHeader)){
+            ::close(fd);
+            return false;
+        }
+        if (!Map(fd, size_t(st.st_size), false)) return false;
+        bool ok = std::memcmp(fHeader->magic, kSharedMagic, sizeof(kSharedMagic)) == 0;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        ok = ok && fHeader->version == kSharedVersion && SharedSegmentSize(fHeader->capacity) == fSize;
+        if (!ok) Unmap();
+        return ok;
+    }
+
+    void Close() { Unmap(); }
+
+    // Copia coerente del record del dispositivo; false se non c'e' (o se lo
+    // scrittore si e' fermato a meta' di una scrittura). In
+    // *version il numero di aggiornamenti del record, per riconoscere i
+    // cambiamenti senza confrontare i dati; in *retries i tentativi ripetuti
+    // perche' il record era in scrittura.
+    bool Find(uint32_t device, SharedRecord &out, uint64_t *version = nullptr, int *retries = nullptr) const
+    {
+        int s = Probe(device, false);
+        if (s < 0) return false;
+        const SharedSlot &slot = fSlots[s];
+        uint64_t w[kRecordWords];
+        int nRetry = 0;
+        for (;; ++nRetry){
+            if (nRetry == kMaxRetries) return false;
+            // Scrittore sospeso a meta' (meno core che processi): cede il processore
+            if (nRetry > 0 && nRetry % 64 == 0) ::sched_yield();
+            uint64_t s1 = slot.seq.load(std::memory_order_acquire);
+            if (s1 & 1) continue;
+            for (int k = 0; k < kRecordWords; ++k) w[k] = slot.words[k].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.seq.load(std::memory_order_relaxed) == s1){
+                if (version) *version = s1 / 2;
+                break;
+            }
+        }
+        std::memcpy(&out, w, sizeof(out));
+        if (retries) *retries = nRetry;
+        return true;
+    }
+
+    // Numero di aggiornamenti del record (0 se assente), senza copiarlo
+    uint64_t GetVersion(uint32_t device) const
+    {
+        int s = Probe(device, false);
+        return s < 0 ? 0 : fSlots[s].seq.load(std::memory_order_acquire) / 2;
+    }
+};
+
+} // namespace bjt
+
+#endif
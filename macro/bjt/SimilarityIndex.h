@@ -0,0 +1,510 @@
+/*
+ * Indice per la ricerca dei dispositivi piu' simili (k vicini) in un archivio
+ * grande, per confrontare un reso dal campo con il resto della produzione.
+ *
+ * Il vettore di un dispositivo unisce la forma delle sue curve e i parametri
+ * estratti dai fit:
+ *   - le coordinate del campione (bjt/ShapePCA.h, curve a tutte le Ib) sulle
+ *     prime k componenti principali, divise per la radice dell'autovalore;
+ *   - V_A e conduttanza medie sulle curve, beta tra la prima e l'ultima Ib a
+ *     Vce = betaVce, standardizzati con media e deviazione del lotto.
+ * La distanza e' quella euclidea su questo vettore.
+ *
+ * La struttura e' a liste invertite (IVF): k-means su un sottoinsieme dei
+ * vettori da' nList centroidi, ogni dispositivo va nella lista del centroide
+ * piu' vicino e una ricerca esamina solo le nProbe liste con i centroidi piu'
+ * vicini alla richiesta. Rispetto a un grafo (HNSW) la costruzione e' un
+ * passaggio lineare, la memoria e' quella dei soli vettori e il file si legge
+ * con un solo fread per sezione; con vettori di una decina di dimensioni una
+ * lista di un migliaio di dispositivi si scorre in pochi microsecondi.
+ *
+ * L'indice si salva accanto all'archivio (IndexPathFor) insieme alla base PCA
+ * e alle medie usate, cosi' un reso si confronta senza rileggere il lotto:
+ *   intestazione   IndexHeader (64 byte)
+ *   forma          Ib (nIb), media (d), base (k x d), autovalori (k), double
+ *   parametri      media e deviazione dei 3 parametri, double
+ *   centroidi      nList x dim, float
+ *   liste          inizio di ogni lista (nList + 1, nessuno se vuoto), uint64
+ *   dispositivi    numero del dispositivo di ogni riga, uint32
+ *   vettori        n x dim, float, ordinati per lista
+ */
+
+#ifndef BJT_SIMILARITYINDEX_H
+#define BJT_SIMILARITYINDEX_H
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <queue>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Arena.h"
+#include "Batch.h"
+#include "Beta.h"
+#include "CurveStore.h"
+#include "ShapePCA.h"
+
+namespace bjt
+{
+
+constexpr int kNSimilarityParams = 3;   // V_A, beta, conduttanza
+
+struct SimilarityConfig
+{
+    int nList = 0;                 // liste invertite (0 = radice del numero di dispositivi)
+    int nIter = 15;                // iterazioni di k-means
+    int trainPerList = 64;         // vettori di addestramento per lista
+    double betaVce = 3.0;          // Vce per beta [V]
+    double paramWeight = 1.0;      // peso dei parametri rispetto alla forma
+    uint64_t seed = 1;
+    int nThreads = 0;              // 0 = std::thread::hardware_concurrency()
+};
+
+struct SimilarityNeighbor
+{
+    unsigned device = 0;
+    float distance = 0;
+};
+
+struct IndexHeader
+{
+    char magic[8];                  // "BJTIDX01"
+    uint32_t version;
+    uint32_t dim;
+    uint64_t n;
+    uint32_t nList;
+    uint32_t nShape;                // componenti di forma
+    uint32_t gridN;
+    uint32_t nIb;
+    double gridMin, gridMax;
+    double paramWeight;
+};
+static_assert(sizeof(IndexHeader) == 64, "intestazione di 64 byte");
+
+// File dell'indice accanto all'archivio: "lotto.bjta" -> "lotto.bjti"
+inline std::string IndexPathFor(const std::string &archivePath)
+{
+    std::string p = archivePath;
+    size_t dot = p.rfind('.');
+    if (dot != std::string::npos && p.find('/', dot) == std::string::npos) p.resize(dot);
+    return p + ".bjti";
+}
+
+class SimilarityIndex
+{
+public:
+    int GetDim() const { return fDim; }
+    int GetN() const { return int(fDevice.size()); }
+    int GetNList() const { return fNList; }
+    const ShapeModel &GetModel() const { return fModel; }
+
+    // -----------------------------------------------------
+    // Costruzione dai campioni di un lotto: model e' la base delle forme
+    // (BuildShapeModel, se ne usano tutte le k componenti), results i fit di
+    // Early delle curve di store (AnalyzeBatch). I dispositivi le cui curve non
+    // coprono la griglia o senza fit riusciti sono esclusi. Restituisce il
+    // numero di dispositivi indicizzati; con 0 l'indice resta vuoto.
+    // -----------------------------------------------------
+    template <typename Real>
+    int Build(const CurveStore<Real> &store, const ShapeSamples &samples, const ShapeModel &model,
+              const ResultTable &results, const SimilarityConfig &cfg = SimilarityConfig())
+    {
+        fModel = model;
+        fBetaVce = cfg.betaVce;
+        fWeight = cfg.paramWeight;
+        fDim = fModel.k + kNSimilarityParams;
+        int ns = samples.GetN();
+
+        // Forma (gia' nella scala finale) e parametri grezzi di ogni campione
+        std::vector<float> raw(size_t(ns) * fDim);
+        std::vector<char> ok(ns, 0);
+        ParallelChunks(ns, cfg.nThreads, kChunk, false, [&](int s, MonotonicArena &arena){
+            ok[s] = RawFeatures(store, samples, s, results, raw.data() + size_t(s) * fDim, arena);
+        });
+
+        // Media e deviazione dei parametri sui campioni validi
+        for (int p = 0; p < kNSimilarityParams; ++p){
+            double sum = 0, sum2 = 0, n = 0;
+            for (int s = 0; s < ns; ++s){
+                if (!ok[s]) continue;
+                double v = raw[size_t(s) * fDim + fModel.k + p];
+                sum += v;
+                sum2 += v * v;
+                ++n;
+            }
+            fParMean[p] = n > 0 ? sum / n : 0;
+            double var = n > 1 ? (sum2 - sum * sum / n) / (n - 1) : 0;
+            fParStd[p] = var > 0 ? std::sqrt(var) : 1;
+        }
+
+        std::vector<float> vecs;
+        std::vector<unsigned> devices;
+        vecs.reserve(raw.size());
+        for (int s = 0; s < ns; ++s){
+            if (!ok[s]) continue;
+            float *v = raw.data() + size_t(s) * fDim;
+            StandardizeParams(v);
+            vecs.insert(vecs.end(), v, v + fDim);
+            devices.push_back(samples.device[s]);
+        }
+        std::vector<float>().swap(raw);
+
+        int n = int(devices.size());
+        if (n == 0){
+            // Nessun campione utilizzabile: indice vuoto
+            fNList = 0;
+            fCentroids.clear();
+            fOffset.clear();
+            fDevice.clear();
+            fVectors.clear();
+            return 0;
+        }
+        fNList = cfg.nList > 0 ? cfg.nList : std::max(1, int(std::lround(std::sqrt(double(n)))));
+        fNList = std::max(1, std::min(fNList, n));
+        TrainCentroids(vecs, n, cfg);
+
+        // Assegnazione alle liste e ordinamento per lista
+        std::vector<int> list(n);
+        ParallelChunks(n, cfg.nThreads, kChunk, false, [&](int i, MonotonicArena &){
+            list[i] = NearestCentroid(vecs.data() + size_t(i) * fDim);
+        });
+        fOffset.assign(fNList + 1, 0);
+        for (int i = 0; i < n; ++i) ++fOffset[list[i] + 1];
+        for (int l = 0; l < fNList; ++l) fOffset[l + 1] += fOffset[l];
+        std::vector<uint64_t> pos(fOffset.begin(), fOffset.end() - 1);
+        fVectors.resize(size_t(n) * fDim);
+        fDevice.resize(n);
+        for (int i = 0; i < n; ++i){
+            uint64_t r = pos[list[i]]++;
+            std::copy(vecs.data() + size_t(i) * fDim, vecs.data() + size_t(i + 1) * fDim,
+                      fVectors.data() + r * fDim);
+            fDevice[r] = devices[i];
+        }
+        return n;
+    }
+
+    // Vettore del campione s di un altro archivio (ad es. un reso), con la
+    // base e le medie dell'indice; false se le curve non coprono la griglia o
+    // non hanno fit riusciti. Le Ib dell'archivio devono essere quelle della
+    // ShapeLayout dell'indice (GroupSamples con GetModel().layout).
+    template <typename Real>
+    bool Features(const CurveStore<Real> &store, const ShapeSamples &samples, int s, const ResultTable &results,
+                  float *v) const
+    {
+        MonotonicArena &arena = ScratchArena();
+        ArenaScope scope(arena);
+        if (!RawFeatures(store, samples, s, results, v, arena)) return false;
+        StandardizeParams(v);
+        return true;
+    }
+
+    // -----------------------------------------------------
+    // I k dispositivi piu' vicini a q esaminando le nProbe liste piu' vicine,
+    // in ordine di distanza crescente
+    // -----------------------------------------------------
+    std::vector<SimilarityNeighbor> Search(const float *q, int k, int nProbe = 8) const
+    {
+        if (k <= 0 || fNList == 0) return {};
+        nProbe = std::max(1, std::min(nProbe, fNList));
+        std::vector<std::pair<float, int>> lists(fNList);
+        for (int l = 0; l < fNList; ++l) lists[l] = {Distance2(q, fCentroids.data() + size_t(l) * fDim), l};
+        std::partial_sort(lists.begin(), lists.begin() + nProbe, lists.end());
+        Heap heap;
+        for (int p = 0; p < nProbe; ++p){
+            int l = lists[p].second;
+            ScanRows(q, k, fOffset[l], fOffset[l + 1], heap);
+        }
+        return Sorted(heap);
+    }
+
+    // Ricerca esaustiva su tutti i dispositivi, per verificare Search
+    std::vector<SimilarityNeighbor> SearchExact(const float *q, int k) const
+    {
+        if (k <= 0) return {};
+        Heap heap;
+        ScanRows(q, k, 0, fDevice.size(), heap);
+        return Sorted(heap);
+    }
+
+    // -----------------------------------------------------
+    // Lettura e scrittura del file dell'indice
+    // -----------------------------------------------------
+    // Un indice vuoto (Build con 0 dispositivi) si salva e si rilegge; uno mai
+    // costruito no
+    bool Save(const char *path) const
+    {
+        if (fDim != fModel.k + kNSimilarityParams) return false;
+        FILE *f = std::fopen(path, "wb");
+        if (!f) return false;
+        const ShapeLayout &layout = fModel.layout;
+        IndexHeader h;
+        std::memset(&h, 0, sizeof(h));
+        std::memcpy(h.magic, "BJTIDX01", 8);
+        h.version = 1;
+        h.dim = uint32_t(fDim);
+        h.n = fDevice.size();
+        h.nList = uint32_t(fNList);
+        h.nShape = uint32_t(fModel.k);
+        h.gridN = uint32_t(layout.grid.n);
+        h.nIb = uint32_t(layout.ibs.size());
+        h.gridMin = layout.grid.vMin;
+        h.gridMax = layout.grid.vMax;
+        h.paramWeight = fWeight;
+        double betaVce = fBetaVce;
+        bool ok = std::fwrite(&h, sizeof(h), 1, f) == 1 && Write(f, layout.ibs.data(), layout.ibs.size()) &&
+                  Write(f, fModel.mean.data(), fModel.mean.size()) &&
+                  Write(f, fModel.basis.data(), fModel.basis.size()) &&
+                  Write(f, fModel.eigenvalues.data(), size_t(fModel.k)) && Write(f, fParMean, kNSimilarityParams) &&
+                  Write(f, fParStd, kNSimilarityParams) && Write(f, &betaVce, 1) &&
+                  Write(f, fCentroids.data(), fCentroids.size()) && Write(f, fOffset.data(), fOffset.size()) &&
+                  Write(f, fDevice.data(), fDevice.size()) && Write(f, fVectors.data(), fVectors.size());
+        return std::fclose(f) == 0 && ok;
+    }
+
+    bool Load(const char *path)
+    {
+        FILE *f = std::fopen(path, "rb");
+        if (!f) return false;
+        IndexHeader h;
+        struct stat st;
+        bool ok = ::fstat(::fileno(f), &st) == 0 && std::fread(&h, sizeof(h), 1, f) == 1 &&
+                  std::memcmp(h.magic, "BJTIDX01", 8) == 0 && h.version == 1 &&
+                  uint64_t(h.dim) == uint64_t(h.nShape) + kNSimilarityParams && (h.nList > 0 || h.n == 0) &&
+                  h.nList <= h.n && h.gridN >= 2 && h.gridMin < h.gridMax && FitsFile(h, uint64_t(st.st_size));
+        if (ok){
+            ShapeModel m;
+            m.layout.grid.vMin = h.gridMin;
+            m.layout.grid.vMax = h.gridMax;
+            m.layout.grid.n = int(h.gridN);
+            m.layout.ibs.resize(h.nIb);
+            m.k = int(h.nShape);
+            size_t d = size_t(m.GetDim());
+            m.mean.resize(d);
+            m.basis.resize(size_t(m.k) * d);
+            m.eigenvalues.resize(m.k);
+            fDim = int(h.dim);
+            fNList = int(h.nList);
+            fWeight = h.paramWeight;
+            fCentroids.resize(size_t(fNList) * fDim);
+            fOffset.resize(fNList > 0 ? fNList + 1 : 0);
+            fDevice.resize(h.n);
+            fVectors.resize(h.n * fDim);
+            ok = Read(f, m.layout.ibs.data(), h.nIb) && Read(f, m.mean.data(), d) &&
+                 Read(f, m.basis.data(), m.basis.size()) && Read(f, m.eigenvalues.data(), size_t(m.k)) &&
+                 Read(f, fParMean, kNSimilarityParams) && Read(f, fParStd, kNSimilarityParams) &&
+                 Read(f, &fBetaVce, 1) && Read(f, fCentroids.data(), fCentroids.size()) &&
+                 Read(f, fOffset.data(), fOffset.size()) && Read(f, fDevice.data(), fDevice.size()) &&
+                 Read(f, fVectors.data(), fVectors.size()) && ValidOffsets(h.n);
+            fModel = std::move(m);
+        }
+        std::fclose(f);
+        if (!ok) *this = SimilarityIndex();
+        return ok;
+    }
+
+private:
+    using Heap = std::priority_queue<std::pair<float, unsigned>>;   // distanza^2, riga; in cima la peggiore
+
+    template <typename T>
+    static bool Write(FILE *f, const T *p, size_t n)
+    {
+        return n == 0 || std::fwrite(p, sizeof(T), n, f) == n;
+    }
+
+    template <typename T>
+    static bool Read(FILE *f, T *p, size_t n)
+    {
+        return n == 0 || std::fread(p, sizeof(T), n, f) == n;
+    }
+
+    // Dimensioni dell'intestazione uguali a quelle del file, prima di allocare
+    // qualcosa: ogni numero e' limitato dalla dimensione, quindi i prodotti non
+    // traboccano
+    static bool FitsFile(const IndexHeader &h, uint64_t size)
+    {
+        uint64_t words = size / 4;
+        uint64_t nIb = h.nIb, k = h.nShape, dim = h.dim, nList = h.nList;
+        if (nIb > words || h.gridN > words || k > words || h.n > words) return false;
+        uint64_t d = uint64_t(h.gridN) * std::max<uint64_t>(nIb, 1);
+        if (d > words || d > uint64_t(INT_MAX) || k > d || (k > 0 && d > words / k)) return false;
+        if (nList > words / dim || h.n > words / (dim + 1)) return false;
+        uint64_t expected = sizeof(IndexHeader) + 8 * (nIb + d + k * d + k + 2 * kNSimilarityParams + 1) +
+                            4 * nList * dim + 8 * (nList > 0 ? nList + 1 : 0) + 4 * h.n * (dim + 1);
+        return expected == size;
+    }
+
+    // Liste da 0 a n, non decrescenti: Search non esce da fVectors
+    bool ValidOffsets(uint64_t n) const
+    {
+        if (fOffset.empty()) return n == 0 && fNList == 0;
+        if (fOffset.front() != 0 || fOffset.back() != n) return false;
+        for (size_t l = 1; l < fOffset.size(); ++l)
+            if (fOffset[l] < fOffset[l - 1] || fOffset[l] > n) return false;
+        return true;
+    }
+
+    float Distance2(const float *a, const float *b) const
+    {
+        float s = 0;
+        for (int j = 0; j < fDim; ++j){
+            float d = a[j] - b[j];
+            s += d * d;
+        }
+        return s;
+    }
+
+    int NearestCentroid(const float *v) const
+    {
+        int best = 0;
+        float dBest = INFINITY;
+        for (int l = 0; l < fNList; ++l){
+            float d = Distance2(v, fCentroids.data() + size_t(l) * fDim);
+            if (d < dBest){
+                dBest = d;
+                best = l;
+            }
+        }
+        return best;
+    }
+
+    void ScanRows(const float *q, int k, uint64_t begin, uint64_t end, Heap &heap) const
+    {
+        for (uint64_t r = begin; r < end; ++r){
+            float d = Distance2(q, fVectors.data() + r * fDim);
+            if (int(heap.size()) < k)
+                heap.push({d, unsigned(r)});
+            else if (d < heap.top().first){
+                heap.pop();
+                heap.push({d, unsigned(r)});
+            }
+        }
+    }
+
+    std::vector<SimilarityNeighbor> Sorted(Heap &heap) const
+    {
+        std::vector<SimilarityNeighbor> out(heap.size());
+        for (size_t i = out.size(); i-- > 0; heap.pop()){
+            out[i].device = fDevice[heap.top().second];
+            out[i].distance = std::sqrt(heap.top().first);
+        }
+        return out;
+    }
+
+    // Coordinate di forma (divise per la radice degli autovalori) e
+    // parametri non ancora standardizzati
+    template <typename Real>
+    bool RawFeatures(const CurveStore<Real> &store, const ShapeSamples &samples, int s, const ResultTable &results,
+                     float *v, MonotonicArena &arena) const
+    {
+        int d = fModel.GetDim();
+        double *x = arena.Allocate<double>(d);
+        double *sx = arena.Allocate<double>(d);
+        double *coeffs = arena.Allocate<double>(std::max(fModel.k, 1));
+        if (!ResampleSample(store, samples, s, fModel.layout, x, sx)) return false;
+        fModel.Project(x, coeffs);
+        for (int c = 0; c < fModel.k; ++c){
+            double ev = fModel.eigenvalues[c];
+            v[c] = float(ev > 0 ? coeffs[c] / std::sqrt(ev) : 0);
+        }
+
+        const int *curves = samples.Curves(s);
+        double VA = 0, cond = 0;
+        int nOk = 0;
+        for (int j = 0; j < samples.perSample; ++j){
+            int i = curves[j];
+            if (!results.ok[i]) continue;
+            VA += results.V_A[i];
+            cond += results.cond[i];
+            ++nOk;
+        }
+        if (nOk == 0) return false;
+        double beta = 0;
+        if (samples.perSample > 1){
+            BetaResult b = ComputeBeta(store.Curve(curves[0]), store.Curve(curves[samples.perSample - 1]), fBetaVce);
+            if (!b.ok) return false;
+            beta = b.beta;
+        }
+        float *p = v + fModel.k;
+        p[0] = float(VA / nOk);
+        p[1] = float(beta);
+        p[2] = float(cond / nOk);
+        return std::isfinite(p[0]) && std::isfinite(p[1]) && std::isfinite(p[2]);
+    }
+
+    void StandardizeParams(float *v) const
+    {
+        float *p = v + fModel.k;
+        for (int j = 0; j < kNSimilarityParams; ++j) p[j] = float(fWeight * (p[j] - fParMean[j]) / fParStd[j]);
+    }
+
+    // k-means (Lloyd) su un sottoinsieme casuale di vettori
+    void TrainCentroids(const std::vector<float> &vecs, int n, const SimilarityConfig &cfg)
+    {
+        std::mt19937_64 rng(cfg.seed);
+        int nTrain = int(std::min<int64_t>(n, int64_t(fNList) * cfg.trainPerList));
+        std::vector<int> perm(n);
+        for (int i = 0; i < n; ++i) perm[i] = i;
+        for (int i = 0; i < nTrain; ++i){   // Fisher-Yates parziale
+            int j = i + int(rng() % uint64_t(n - i));
+            std::swap(perm[i], perm[j]);
+        }
+        auto train = [&](int t){ return vecs.data() + size_t(perm[t]) * fDim; };
+
+        fCentroids.resize(size_t(fNList) * fDim);
+        for (int l = 0; l < fNList; ++l) std::copy(train(l), train(l) + fDim, fCentroids.data() + size_t(l) * fDim);
+
+        struct Sums
+        {
+            std::vector<double> sum;
+            std::vector<int> count;
+        };
+        for (int it = 0; it < cfg.nIter; ++it){
+            Sums init{std::vector<double>(size_t(fNList) * fDim, 0.0), std::vector<int>(fNList, 0)};
+            ParallelReduce(nTrain, cfg.nThreads, kChunk, false, init,
+                           [&](int t, MonotonicArena &, Sums &local){
+                               const float *v = train(t);
+                               int l = NearestCentroid(v);
+                               double *s = local.sum.data() + size_t(l) * fDim;
+                               for (int j = 0; j < fDim; ++j) s[j] += v[j];
+                               ++local.count[l];
+                           },
+                           [&](Sums &a, const Sums &b){
+                               for (size_t j = 0; j < a.sum.size(); ++j) a.sum[j] += b.sum[j];
+                               for (int l = 0; l < fNList; ++l) a.count[l] += b.count[l];
+                           });
+            for (int l = 0; l < fNList; ++l){
+                float *c = fCentroids.data() + size_t(l) * fDim;
+                if (init.count[l] == 0){   // lista vuota: nuovo centroide a caso
+                    const float *v = train(int(rng() % uint64_t(nTrain)));
+                    std::copy(v, v + fDim, c);
+                    continue;
+                }
+                for (int j = 0; j < fDim; ++j) c[j] = float(init.sum[size_t(l) * fDim + j] / init.count[l]);
+            }
+        }
+    }
+
+    ShapeModel fModel;
+    int fDim = 0;
+    int fNList = 0;
+    double fBetaVce = 3.0;
+    double fWeight = 1.0;
+    double fParMean[kNSimilarityParams] = {0, 0, 0};
+    double fParStd[kNSimilarityParams] = {1, 1, 1};
+    std::vector<float> fCentroids;        // nList x dim
+    std::vector<uint64_t> fOffset;        // nList + 1
+    std::vector<unsigned> fDevice;        // per riga
+    std::vector<float> fVectors;          // n x dim, per lista
+};
+
+} // namespace bjt
+
+#endif
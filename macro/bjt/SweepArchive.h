@@ -0,0 +1,328 @@
+/*
+ * Archivio binario su disco delle curve, con catalogo separato dai dati.
+ *
+ * Struttura del file (byte nativi, little-endian sulle macchine del
+ * laboratorio):
+ *   intestazione   ArchiveHeader (64 byte)
+ *   corpi          per ogni curva le 4 colonne Vce, Ic, errVce, errIc in
+ *                  double, una dopo l'altra (n valori ciascuna)
+ *   catalogo       un CatalogEntry per curva
+ *
+ * Il catalogo contiene i metadati e alcune statistiche riassuntive di ogni
+ * curva (Ic sulla griglia di tensioni kGridStep, range di Vce, Ic massima):
+ * basta leggere il catalogo per selezionare le curve (bjt/Query.h) e poi si
+ * leggono dal disco solo i corpi selezionati. I dati sono conservati in double
+ * cosi' come letti, qualunque sia il tipo dell'archivio in memoria; le
+ * tarature degli strumenti (bjt/Calibration.h) si applicano alla lettura.
+ */
+
+#ifndef BJT_SWEEPARCHIVE_H
+#define BJT_SWEEPARCHIVE_H
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "Beta.h"
+#include "Calibration.h"
+#include "CurveStore.h"
+
+namespace bjt
+{
+
+// Griglia di tensioni del catalogo: 0, 0.5, ..., 5 V
+constexpr int kGridN = 11;
+constexpr double kGridStep = 0.5;
+
+struct ArchiveHeader
+{
+    char magic[8];                  // "BJTSWP01"
+    uint32_t version;
+    uint32_t nCurves;
+    uint64_t catalogOffset;         // inizio del catalogo [byte]
+    uint32_t gridN;
+    uint32_t reserved0;
+    double gridStep;
+    uint64_t reserved[3];
+};
+static_assert(sizeof(ArchiveHeader) == 64, "intestazione di 64 byte");
+
+struct CatalogEntry
+{
+    uint64_t offset;                // inizio del corpo [byte]
+    int32_t n;
+    uint32_t device;
+    uint32_t lot;
+    uint32_t scopeSerial;
+    uint32_t meterSerial;
+    uint32_t reserved;
+    int64_t time;                   // istante della misura [s], tempo Unix
+    double ib;                      // [uA]
+    double temperature;             // [gradi C]
+    double vMin, vMax;              // range di Vce [V]
+    double icMax;                   // [mA]
+    double icGrid[kGridN];          // Ic interpolata a k*kGridStep [mA], NAN fuori range
+
+    // Le statistiche sono calcolate sui dati grezzi, senza tarature
+
+    CurveMeta Meta() const
+    {
+        CurveMeta m;
+        m.ib = ib;
+        m.device = device;
+        m.temperature = temperature;
+        m.lot = lot;
+        m.scopeSerial = scopeSerial;
+        m.meterSerial = meterSerial;
+        m.time = time;
+        return m;
+    }
+};
+
+constexpr char kArchiveMagic[8] = {'B', 'J', 'T', 'S', 'W', 'P', '0', '1'};
+constexpr uint32_t kArchiveVersion = 2;   // 2: strumenti e istante nel catalogo
+
+// Statistiche riassuntive di una curva per il catalogo
+template <typename Real>
+void FillCatalogStats(const CurveView<Real> &c, CatalogEntry &e)
+{
+    e.n = c.n;
+    e.vMin = e.vMax = e.icMax = NAN;
+    for (int i = 0; i < c.n; ++i){
+        if (i == 0 || c.vce[i] < e.vMin) e.vMin = c.vce[i];
+        if (i == 0 || c.vce[i] > e.vMax) e.vMax = c.vce[i];
+        if (i == 0 || c.ic[i] > e.icMax) e.icMax = c.ic[i];
+    }
+    for (int k = 0; k < kGridN; ++k){
+        double ic, err;
+        e.icGrid[k] = InterpolateIc(c, k * kGridStep, ic, err) ? ic : NAN;
+    }
+}
+
+// -----------------------------------------------------
+// Scrittura: i corpi sono scritti man mano, catalogo e intestazione in Close
+// -----------------------------------------------------
+class ArchiveWriter
+{
+public:
+    ~ArchiveWriter() { Close(); }
+
+    bool Open(const char *path)
+    {
+        Close();
+        fFile = std::fopen(path, "wb");
+        if (!fFile) return false;
+        ArchiveHeader h = {};
+        fOk = std::fwrite(&h, sizeof(h), 1, fFile) == 1;
+        fPos = sizeof(h);
+        fCatalog.clear();
+        return fOk;
+    }
+
+    template <typename Real>
+    bool Add(const CurveView<Real> &c, const CurveMeta &meta)
+    {
+        if (!fFile || !fOk) return false;
+        CatalogEntry e = {};
+        e.offset = fPos;
+        e.device = meta.device;
+        e.lot = meta.lot;
+        e.scopeSerial = meta.scopeSerial;
+        e.meterSerial = meta.meterSerial;
+        e.time = meta.time;
+        e.ib = meta.ib;
+        e.temperature = meta.temperature;
+        FillCatalogStats(c, e);
+        const Real *cols[4] = {c.vce, c.ic, c.errVce, c.errIc};
+        fBuf.resize(c.n);
+        for (const Real *col : cols){
+            std::copy(col, col + c.n, fBuf.begin());
+            if (c.n > 0 && std::fwrite(fBuf.data(), sizeof(double), c.n, fFile) != size_t(c.n)) fOk = false;
+        }
+        fPos += 4 * sizeof(double) * size_t(c.n);
+        fCatalog.push_back(e);
+        return fOk;
+    }
+
+    template <typename Store>
+    bool AddStore(const Store &store)
+    {
+        for (int i = 0; i < store.GetNCurves(); ++i)
+            if (!Add(store.Curve(i), store.GetMeta(i))) return false;
+        return true;
+    }
+
+    // Scrive catalogo e intestazione; false se qualche scrittura e' fallita
+    bool Close()
+    {
+        if (!fFile) return fOk;
+        if (fOk && !fCatalog.empty())
+            fOk = std::fwrite(fCatalog.data(), sizeof(CatalogEntry), fCatalog.size(), fFile) == fCatalog.size();
+        ArchiveHeader h = {};
+        std::memcpy(h.magic, kArchiveMagic, sizeof(h.magic));
+        h.version = kArchiveVersion;
+        h.nCurves = uint32_t(fCatalog.size());
+        h.catalogOffset = fPos;
+        h.gridN = kGridN;
+        h.gridStep = kGridStep;
+        if (fOk) fOk = std::fseek(fFile, 0, SEEK_SET) == 0 && std::fwrite(&h, sizeof(h), 1, fFile) == 1;
+        if (std::fclose(fFile) != 0) fOk = false;
+        fFile = nullptr;
+        return fOk;
+    }
+
+private:
+    std::FILE *fFile = nullptr;
+    bool fOk = false;
+    uint64_t fPos = 0;
+    std::vector<CatalogEntry> fCatalog;
+    std::vector<double> fBuf;
+};
+
+template <typename Store>
+bool WriteArchive(const char *path, const Store &store)
+{
+    ArchiveWriter w;
+    return w.Open(path) && w.AddStore(store) && w.Close();
+}
+
+// -----------------------------------------------------
+// Lettura: Open carica solo intestazione e catalogo (controllati contro la
+// dimensione del file: catalogo e corpi devono starci); i corpi sono letti su
+// richiesta con pread, quindi un SweepArchive aperto puo' essere letto da
+// piu' thread contemporaneamente.
+// -----------------------------------------------------
+class SweepArchive
+{
+public:
+    SweepArchive() = default;
+    SweepArchive(const SweepArchive &) = delete;
+    SweepArchive &operator=(const SweepArchive &) = delete;
+    ~SweepArchive() { Close(); }
+
+    bool Open(const char *path)
+    {
+        Close();
+        fFd = ::open(path, O_RDONLY);
+        if (fFd < 0) return false;
+        ArchiveHeader h;
+        struct stat st;
+        if (::fstat(fFd, &st) != 0 || !ReadAt(&h, sizeof(h), 0) ||
+            std::memcmp(h.magic, kArchiveMagic, sizeof(h.magic)) != 0 || h.version != kArchiveVersion ||
+            h.gridN != kGridN || h.gridStep != kGridStep){
+            Close();
+            return false;
+        }
+        // Catalogo e corpi devono stare nel file, prima di allocare qualcosa
+        uint64_t size = uint64_t(st.st_size);
+        if (h.catalogOffset < sizeof(ArchiveHeader) || h.catalogOffset > size ||
+            uint64_t(h.nCurves) > (size - h.catalogOffset) / sizeof(CatalogEntry)){
+            Close();
+            return false;
+        }
+        fCatalog.resize(h.nCurves);
+        if (!ReadAt(fCatalog.data(), sizeof(CatalogEntry) * fCatalog.size(), h.catalogOffset)){
+            Close();
+            return false;
+        }
+        for (const CatalogEntry &e : fCatalog){
+            if (e.n < 0 || e.offset < sizeof(ArchiveHeader) || e.offset > h.catalogOffset ||
+                uint64_t(e.n) > (h.catalogOffset - e.offset) / (4 * sizeof(double))){
+                Close();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void Close()
+    {
+        if (fFd >= 0) ::close(fFd);
+        fFd = -1;
+        fCatalog.clear();
+    }
+
+    bool IsOpen() const { return fFd >= 0; }
+    int GetNCurves() const { return int(fCatalog.size()); }
+    const CatalogEntry &GetEntry(int i) const { return fCatalog[i]; }
+    const std::vector<CatalogEntry> &GetCatalog() const { return fCatalog; }
+
+    // Legge il corpo della curva i e lo aggiunge a store, corretto con le
+    // tarature di cal se indicato; indice nello store o -1. *calibrated dice se
+    // entrambe le tarature sono state trovate.
+    template <typename Real>
+    int ReadCurve(int i, CurveStore<Real> &store, std::vector<double> &buf, const CalibrationDB *cal = nullptr,
+                  bool *calibrated = nullptr) const
+    {
+        const CatalogEntry &e = fCatalog[i];
+        size_t n = size_t(e.n);
+        buf.resize(4 * n);
+        if (n > 0 && !ReadAt(buf.data(), 4 * n * sizeof(double), e.offset)) return -1;
+        double *b = buf.data();
+        CurveMeta meta = e.Meta();
+        bool ok = cal && cal->Apply(meta, b, b + n, b + 2 * n, b + 3 * n, e.n);
+        if (calibrated) *calibrated = ok;
+        return store.AddCurve(b, b + n, b + 2 * n, b + 3 * n, e.n, meta);
+    }
+
+    // Legge le curve indicate nell'ordine dato (gli indici crescenti prodotti
+    // da una Query corrispondono a letture sequenziali nel file). Restituisce
+    // quante curve ha letto; in *nUncalibrated quante non hanno entrambe le
+    // tarature in cal.
+    template <typename Real>
+    int ReadCurves(const std::vector<int> &indices, CurveStore<Real> &store, const CalibrationDB *cal = nullptr,
+                   int *nUncalibrated = nullptr) const
+    {
+        size_t nPoints = 0;
+        for (int i : indices) nPoints += fCatalog[i].n;
+        store.Reserve(store.GetNCurves() + int(indices.size()), store.GetNPoints() + nPoints);
+        std::vector<double> buf;
+        int nRead = 0, nMissing = 0;
+        for (int i : indices){
+            bool calibrated = false;
+            if (ReadCurve(i, store, buf, cal, &calibrated) < 0) continue;
+            ++nRead;
+            if (!calibrated) ++nMissing;
+        }
+        if (nUncalibrated) *nUncalibrated = nMissing;
+        return nRead;
+    }
+
+    // Legge tutte le curve dell'archivio
+    template <typename Real>
+    int ReadAll(CurveStore<Real> &store, const CalibrationDB *cal = nullptr, int *nUncalibrated = nullptr) const
+    {
+        std::vector<int> all(fCatalog.size());
+        for (size_t i = 0; i < all.size(); ++i) all[i] = int(i);
+        return ReadCurves(all, store, cal, nUncalibrated);
+    }
+
+private:
+    bool ReadAt(void *dst, size_t bytes, uint64_t offset) const
+    {
+        char *p = static_cast<char *>(dst);
+        while (bytes > 0){
+            ssize_t r = ::pread(fFd, p, bytes, off_t(offset));
+            if (r <= 0) return false;
+            p += r;
+            bytes -= size_t(r);
+            offset += uint64_t(r);
+        }
+        return true;
+    }
+
+    int fFd = -1;
+    std::vector<CatalogEntry> fCatalog;
+};
+
+} // namespace bjt
+
+#endif
@@ -0,0 +1,197 @@
+/*
+ * Generatore di caratteristiche sintetiche, per benchmark e prove su lotti
+ * grandi senza dati reali.
+ *
+ * Modello (grandezze cambiate di segno come nei file di misura):
+ *   Ic(Vce) = beta * Ib * (1 - exp(-Vce/Vk)) * (1 + Vce/V_A)
+ * con Ib in mA. Nella regione attiva Vce = -V_A + b*Ic, quindi il fit di
+ * EarlyFit.h restituisce a = -V_A. Errori dal modello strumentale di
+ * ErrorModel.h, letture arrotondate alla risoluzione degli strumenti.
+ *
+ * Una frazione anomalyFraction dei dispositivi puo' avere una curva di forma
+ * anomala (per provare bjt/ShapePCA.h): un gradino di Ic, una rottura
+ * prematura (moltiplicazione a valanga, fattore di Miller 1/(1 - (Vce/BV)^4))
+ * o una corrente di perdita proporzionale a Vce.
+ */
+
+#ifndef BJT_SYNTHETIC_H
+#define BJT_SYNTHETIC_H
+
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "CurveStore.h"
+#include "ErrorModel.h"
+
+namespace bjt
+{
+
+enum SyntheticAnomaly
+{
+    kAnomalyNone = 0,
+    kAnomalyKink,              // gradino di Ic
+    kAnomalyBreakdown,         // rottura prematura
+    kAnomalyLeakage,           // corrente di perdita
+    kNAnomalies
+};
+
+struct SyntheticDevice
+{
+    double beta = 190;
+    double VA = 20;            // [V]
+    double Vk = 0.05;          // tensione di ginocchio [V]
+    double temperature = 25;   // [gradi C]
+    int anomaly = kAnomalyNone;
+    double kinkV = 0;          // posizione del gradino [V]
+    double kinkFrac = 0;       // ampiezza relativa del gradino
+    double BV = 0;             // tensione di rottura [V]
+    double leakage = 0;        // [mA/V]
+};
+
+struct SyntheticConfig
+{
+    double noise = 0.15;       // rumore in unita' dell'errore tabulato
+    double betaSpread = 0.10;  // dispersione relativa di beta nel lotto
+    double VASpread = 0.15;    // dispersione relativa di V_A nel lotto
+    int lotSize = 1000;        // dispositivi per lotto di produzione
+    unsigned scopeSerial = 0;  // strumenti usati (numeri di serie)
+    unsigned meterSerial = 0;
+    int64_t startTime = 0;     // istante della prima misura [s], tempo Unix
+    int64_t deviceTime = 0;    // tempo tra due dispositivi [s]
+    double anomalyFraction = 0; // frazione di dispositivi con curve anomale
+    ScopeModel scope;
+    MeterModel meter;
+};
+
+// Tensioni della scansione: fitta vicino alla saturazione, passo 0.1 V oltre
+inline std::vector<double> SweepSetpoints()
+{
+    std::vector<double> v;
+    for (int i = 3; i <= 20; ++i) v.push_back(0.02 * i);
+    for (int i = 5; i <= 40; ++i) v.push_back(0.1 * i);
+    return v;
+}
+
+inline double IdealIc(const SyntheticDevice &d, double ib, double vce)
+{
+    double ic = d.beta * ib * 1e-3 * (1 - std::exp(-vce / d.Vk)) * (1 + vce / d.VA);
+    switch (d.anomaly){
+    case kAnomalyKink: return ic * (1 + d.kinkFrac / (1 + std::exp(-(vce - d.kinkV) / 0.05)));
+    case kAnomalyBreakdown: return ic / (1 - std::pow(vce / d.BV, 4));
+    case kAnomalyLeakage: return ic + d.leakage * vce;
+    default: return ic;
+    }
+}
+
+// Una lettura alla tensione impostata v [V] del dispositivo d a corrente di
+// base ib [uA], con rumore e arrotondamento alla risoluzione degli strumenti
+template <typename Rng>
+void MeasurePoint(const SyntheticDevice &d, double ib, double v, const SyntheticConfig &cfg, Rng &rng,
+                  std::normal_distribution<double> &gaus, double &vm, double &im, double &errVm, double &errIm)
+{
+    double i = IdealIc(d, ib, v);
+    double ev = cfg.scope.Error(v, cfg.scope.ChooseScale(v));
+    double ei = cfg.meter.Error(i);
+    vm = std::round((v + cfg.noise * ev * gaus(rng)) * 100) / 100;
+    im = std::round((i + cfg.noise * ei * gaus(rng)) * 100) / 100;
+    errVm = std::round(cfg.scope.Error(vm, cfg.scope.ChooseScale(vm)) * 1000) / 1000;
+    errIm = std::round(cfg.meter.Error(im) * 1000) / 1000;
+}
+
+// Una curva misurata del dispositivo d a corrente di base ib [uA]
+template <typename Rng>
+void GenerateCurve(const SyntheticDevice &d, double ib, const std::vector<double> &setpoints,
+                   const SyntheticConfig &cfg, Rng &rng, std::vector<double> &vce, std::vector<double> &ic,
+                   std::vector<double> &errVce, std::vector<double> &errIc)
+{
+    std::normal_distribution<double> gaus(0, 1);
+    vce.clear();
+    ic.clear();
+    errVce.clear();
+    errIc.clear();
+    for (double v : setpoints){
+        double vm, im, ev, ei;
+        MeasurePoint(d, ib, v, cfg, rng, gaus, vm, im, ev, ei);
+        vce.push_back(vm);
+        ic.push_back(im);
+        errVce.push_back(ev);
+        errIc.push_back(ei);
+    }
+}
+
+// Banco simulato: un dispositivo a corrente di base fissata, misurato a
+// richiesta a qualunque tensione
+struct SimulatedBench
+{
+    SyntheticDevice device;
+    double ib = 100;               // [uA]
+    SyntheticConfig cfg;
+    std::mt19937_64 rng;
+    std::normal_distribution<double> gaus{0, 1};
+
+    SimulatedBench(const SyntheticDevice &d, double ib_, const SyntheticConfig &c = SyntheticConfig(),
+                   uint64_t seed = 1)
+        : device(d), ib(ib_), cfg(c), rng(seed)
+    {
+    }
+
+    void Measure(double v, double &vm, double &im, double &errVm, double &errIm)
+    {
+        MeasurePoint(device, ib, v, cfg, rng, gaus, vm, im, errVm, errIm);
+    }
+};
+
+// Dispositivo casuale del lotto
+template <typename Rng>
+SyntheticDevice RandomDevice(const SyntheticConfig &cfg, Rng &rng)
+{
+    std::normal_distribution<double> gaus(0, 1);
+    SyntheticDevice d;
+    d.beta *= 1 + cfg.betaSpread * gaus(rng);
+    d.VA *= 1 + cfg.VASpread * gaus(rng);
+    if (d.VA < 2) d.VA = 2;
+    if (cfg.anomalyFraction > 0 && std::uniform_real_distribution<double>(0, 1)(rng) < cfg.anomalyFraction){
+        std::uniform_real_distribution<double> u(0, 1);
+        d.anomaly = 1 + int(u(rng) * (kNAnomalies - 1)) % (kNAnomalies - 1);
+        d.kinkV = 1 + 2.5 * u(rng);
+        d.kinkFrac = 0.05 + 0.10 * u(rng);
+        d.BV = 5 + 3 * u(rng);
+        d.leakage = 0.3 + 0.5 * u(rng);
+    }
+    return d;
+}
+
+// -----------------------------------------------------
+// Riempie l'archivio con nDevices dispositivi, una curva per ogni Ib.
+// Il dispositivo k ha identificativo k, appartiene al lotto k / lotSize ed e'
+// misurato all'istante startTime + k * deviceTime. Se anomalies non e'
+// nullptr vi si aggiunge il tipo di anomalia (SyntheticAnomaly) di ogni
+// dispositivo.
+// -----------------------------------------------------
+template <typename Real>
+void FillSyntheticLot(CurveStore<Real> &store, int nDevices, const std::vector<double> &ibs,
+                      unsigned long seed = 1, const SyntheticConfig &cfg = SyntheticConfig(),
+                      std::vector<int> *anomalies = nullptr)
+{
+    std::mt19937_64 rng(seed);
+    std::vector<double> setpoints = SweepSetpoints();
+    std::vector<double> vce, ic, evce, eic;
+    store.Reserve(store.GetNCurves() + nDevices * int(ibs.size()),
+                  store.GetNPoints() + size_t(nDevices) * ibs.size() * setpoints.size());
+    for (int k = 0; k < nDevices; ++k){
+        SyntheticDevice d = RandomDevice(cfg, rng);
+        if (anomalies) anomalies->push_back(d.anomaly);
+        for (double ib : ibs){
+            GenerateCurve(d, ib, setpoints, cfg, rng, vce, ic, evce, eic);
+            store.AddCurve(vce.data(), ic.data(), evce.data(), eic.data(), int(vce.size()),
+                           {ib, unsigned(k), d.temperature, unsigned(k / cfg.lotSize), cfg.scopeSerial,
+                            cfg.meterSerial, cfg.startTime + k * cfg.deviceTime});
+        }
+    }
+}
+
+} // namespace bjt
+
+#endif
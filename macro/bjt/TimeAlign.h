@@ -0,0 +1,293 @@
+/*
+ * Allineamento nel tempo delle letture di Vce (oscilloscopio) e Ic
+ * (multimetro), in streaming.
+ *
+ * I file a 4 colonne accoppiano le letture riga per riga, come se i due
+ * strumenti misurassero nello stesso istante. In realta' campionano a tempi
+ * diversi e non sincronizzati: durante una rampa o una deriva termica la
+ * riga k unisce Vce e Ic di momenti diversi. Qui le due sequenze di letture
+ * con istante (TimedReading) sono unite "as-of": una sequenza fa da
+ * riferimento (anchor) e ogni sua lettura diventa una riga, con il valore
+ * dell'altra interpolato linearmente tra le due letture che la racchiudono.
+ *
+ * Errori. Una lettura interpolata con peso f ha errore (1 - f) e0 + f e1:
+ * l'errore del multimetro e dell'oscilloscopio e' soprattutto la percentuale
+ * del costruttore, comune alle letture vicine, quindi si somma linearmente.
+ * L'istante di ogni lettura e' noto con un'incertezza (jitter, rms): una
+ * lettura presa dt prima o dopo il suo istante nominale sposta il valore di
+ * (dx/dt) dt. A ogni grandezza si somma in quadratura (dx/dt) * jitter del
+ * suo strumento, con dx/dt stimata dalle letture vicine; senza variazioni
+ * nel tempo il contributo e' nullo.
+ *
+ * Costo O(1) ammortizzato per lettura: i due flussi sono scorsi una sola
+ * volta, e i buffer hanno dimensione massima maxPending. Se un flusso si
+ * ferma le letture dell'altro oltre questo limite sono scartate (contate in
+ * AlignStats). Le righe escono appena arriva la lettura che chiude
+ * l'intervallo, nel formato di processDataset in fit_lineare.C (Vce, Ic,
+ * errVce, errIc): con CurveCollector finiscono in un CurveStore, con
+ * WriteAlignedRow in un file di testo come quelli di data/.
+ */
+
+#ifndef BJT_TIMEALIGN_H
+#define BJT_TIMEALIGN_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "CurveStore.h"
+
+namespace bjt
+{
+
+struct TimedReading
+{
+    int64_t t = 0;                 // istante [us]
+    double x = 0, err = 0;
+};
+
+struct AlignedRow
+{
+    int64_t t = 0;                 // istante della lettura di riferimento [us]
+    double vce = 0, ic = 0;        // [V], [mA]
+    double errVce = 0, errIc = 0;
+};
+
+enum AlignAnchor
+{
+    kAnchorVoltage = 0,            // una riga per lettura dell'oscilloscopio
+    kAnchorCurrent                 // una riga per lettura del multimetro
+};
+
+struct AlignConfig
+{
+    int anchor = kAnchorCurrent;   // di solito lo strumento piu' lento
+    double jitterVUs = 0;          // jitter degli istanti dell'oscilloscopio [us, rms]
+    double jitterIUs = 0;          // jitter degli istanti del multimetro [us, rms]
+    int64_t maxGapUs = 2000000;    // letture che racchiudono la riga piu' distanti: riga scartata
+    int maxPending = 4096;         // letture in attesa per flusso
+};
+
+struct AlignStats
+{
+    long nRows = 0;
+    long nUnbracketed = 0;         // riferimento fuori dall'intervallo dell'altro flusso
+    long nGap = 0;                 // letture che la racchiudono troppo distanti
+    long nOverflow = 0;            // scartate per buffer pieno
+    long nOutOfOrder = 0;          // istante precedente all'ultima lettura del flusso
+};
+
+namespace detail
+{
+
+// Coda circolare di capacita' fissa
+class ReadingRing
+{
+public:
+    void Init(int capacity)
+    {
+        fData.assign(size_t(capacity > 0 ? capacity : 1), TimedReading());
+        fHead = fCount = 0;
+    }
+
+    int Size() const { return fCount; }
+    bool Full() const { return fCount == int(fData.size()); }
+    const TimedReading &operator[](int k) const { return fData[(fHead + k) % fData.size()]; }
+
+    void Push(const TimedReading &r)
+    {
+        fData[(fHead + fCount) % fData.size()] = r;
+        ++fCount;
+    }
+
+    void Pop()
+    {
+        fHead = (fHead + 1) % int(fData.size());
+        --fCount;
+    }
+
+private:
+    std::vector<TimedReading> fData;
+    int fHead = 0, fCount = 0;
+};
+
+} // namespace detail
+
+// -----------------------------------------------------
+// Unione as-of di due flussi ordinati nel tempo
+// -----------------------------------------------------
+class StreamAligner
+{
+public:
+    explicit StreamAligner(const AlignConfig &cfg = AlignConfig()) : fCfg(cfg) { Reset(); }
+
+    void Reset()
+    {
+        fAnchor.Init(fCfg.maxPending);
+        fOther.Init(fCfg.maxPending);
+        fHasPrev = false;
+        fLastAnchorT = fLastOtherT = INT64_MIN;
+        fStats = AlignStats();
+    }
+
+    // Nuove letture; sink(const AlignedRow &) riceve le righe pronte
+    template <typename Sink>
+    void PushVoltage(const TimedReading &r, Sink &&sink)
+    {
+        Push(fCfg.anchor == kAnchorVoltage, r);
+        Drain(sink);
+    }
+
+    template <typename Sink>
+    void PushCurrent(const TimedReading &r, Sink &&sink)
+    {
+        Push(fCfg.anchor == kAnchorCurrent, r);
+        Drain(sink);
+    }
+
+    // Fine dei flussi: le letture di riferimento ancora in attesa non hanno
+    // una lettura successiva dell'altro strumento e sono scartate
+    void Finish()
+    {
+        while (fAnchor.Size() > 0){
+            ++fStats.nUnbracketed;
+            fAnchor.Pop();
+        }
+    }
+
+    const AlignStats &GetStats() const { return fStats; }
+    int GetPending() const { return fAnchor.Size() + fOther.Size(); }
+
+private:
+    void Push(bool isAnchor, const TimedReading &r)
+    {
+        int64_t &last = isAnchor ? fLastAnchorT : fLastOtherT;
+        if (r.t < last){
+            ++fStats.nOutOfOrder;
+            return;
+        }
+        last = r.t;
+        detail::ReadingRing &q = isAnchor ? fAnchor : fOther;
+        if (q.Full()){
+            ++fStats.nOverflow;
+            if (isAnchor) Advance(q[0]);
+            q.Pop();
+        }
+        q.Push(r);
+    }
+
+    template <typename Sink>
+    void Drain(Sink &sink)
+    {
+        while (fAnchor.Size() > 0){
+            const TimedReading &a = fAnchor[0];
+            // Tiene come prima lettura dell'altro flusso l'ultima con t <= a.t:
+            // i riferimenti successivi hanno istanti maggiori
+            while (fOther.Size() >= 2 && fOther[1].t <= a.t) fOther.Pop();
+            if (fOther.Size() == 0) return;
+            const TimedReading &o0 = fOther[0];
+            if (o0.t > a.t){
+                ++fStats.nUnbracketed;   // prima dell'inizio dell'altro flusso
+            }
+            else if (o0.t == a.t){
+                Emit(a, o0, fOther.Size() >= 2 ? fOther[1] : o0, 0, sink);
+            }
+            else{
+                if (fOther.Size() < 2) return;   // in attesa della lettura successiva
+                const TimedReading &o1 = fOther[1];
+                if (o1.t - o0.t > fCfg.maxGapUs)
+                    ++fStats.nGap;
+                else
+                    Emit(a, o0, o1, double(a.t - o0.t) / double(o1.t - o0.t), sink);
+            }
+            Advance(a);
+            fAnchor.Pop();
+        }
+    }
+
+    template <typename Sink>
+    void Emit(const TimedReading &a, const TimedReading &o0, const TimedReading &o1, double f, Sink &sink)
+    {
+        bool anchorV = fCfg.anchor == kAnchorVoltage;
+        double jitA = anchorV ? fCfg.jitterVUs : fCfg.jitterIUs;
+        double jitO = anchorV ? fCfg.jitterIUs : fCfg.jitterVUs;
+
+        // Derivate nel tempo: riferimento dalla lettura precedente, altro
+        // flusso dalle due letture che racchiudono la riga
+        double slopeA = 0, slopeO = 0;
+        if (fHasPrev && a.t > fPrev.t && a.t - fPrev.t <= fCfg.maxGapUs) slopeA = (a.x - fPrev.x) / double(a.t - fPrev.t);
+        if (o1.t > o0.t) slopeO = (o1.x - o0.x) / double(o1.t - o0.t);
+
+        double xo = o0.x + f * (o1.x - o0.x);
+        double eo = (1 - f) * o0.err + f * o1.err;
+        double errA = std::sqrt(a.err * a.err + slopeA * slopeA * jitA * jitA);
+        double errO = std::sqrt(eo * eo + slopeO * slopeO * jitO * jitO);
+
+        AlignedRow row;
+        row.t = a.t;
+        row.vce = anchorV ? a.x : xo;
+        row.ic = anchorV ? xo : a.x;
+        row.errVce = anchorV ? errA : errO;
+        row.errIc = anchorV ? errO : errA;
+        ++fStats.nRows;
+        sink(row);
+    }
+
+    void Advance(const TimedReading &a)
+    {
+        fPrev = a;
+        fHasPrev = true;
+    }
+
+    AlignConfig fCfg;
+    detail::ReadingRing fAnchor, fOther;
+    TimedReading fPrev;                // lettura di riferimento precedente
+    bool fHasPrev = false;
+    int64_t fLastAnchorT = INT64_MIN, fLastOtherT = INT64_MIN;
+    AlignStats fStats;
+};
+
+// -----------------------------------------------------
+// Raccoglie le righe di una curva e la aggiunge a un CurveStore
+// -----------------------------------------------------
+struct CurveCollector
+{
+    std::vector<double> vce, ic, errVce, errIc;
+    int64_t firstT = 0;
+
+    void operator()(const AlignedRow &r)
+    {
+        if (vce.empty()) firstT = r.t;
+        vce.push_back(r.vce);
+        ic.push_back(r.ic);
+        errVce.push_back(r.errVce);
+        errIc.push_back(r.errIc);
+    }
+
+    void Clear()
+    {
+        vce.clear();
+        ic.clear();
+        errVce.clear();
+        errIc.clear();
+    }
+
+    // Indice della curva; se meta.time e' 0 vale l'istante della prima riga
+    template <typename Real>
+    int AddTo(CurveStore<Real> &store, CurveMeta meta) const
+    {
+        if (meta.time == 0) meta.time = firstT / 1000000;
+        return store.AddCurve(vce.data(), ic.data(), errVce.data(), errIc.data(), int(vce.size()), meta);
+    }
+};
+
+// Una riga nel formato dei file di data/ (Vce Ic errVce errIc)
+inline void WriteAlignedRow(FILE *f, const AlignedRow &r)
+{
+    std::fprintf(f, "%.2f\t%.2f\t%.3f\t%.3f\n", r.vce, r.ic, r.errVce, r.errIc);
+}
+
+} // namespace bjt
+
+#endif
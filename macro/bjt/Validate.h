@@ -0,0 +1,351 @@
+/*
+ * Controllo di qualita' delle curve durante la lettura, con quarantena.
+ *
+ * Il fit pesa i punti con 1/sigma^2 e il TGraphErrors accetta qualsiasi cosa
+ * sia scritta nel file: errori nulli o negativi, punti fuori ordine o letture
+ * sbagliate finiscono nel fit senza avvisi. SweepValidator esamina i punti uno
+ * alla volta, nello stesso ciclo della lettura del file, e controlla:
+ *   - valori finiti ed errori > 0
+ *   - Vce monotona (in un verso qualsiasi, i file sono decrescenti); uno
+ *     scambio di due letture entro orderSigma errori e' solo un avviso
+ *   - Vce ripetute (in data/100.txt 0.08 V compare due volte: avviso)
+ *   - coerenza dei cambi di scala dell'oscilloscopio: dall'errore tabulato si
+ *     ricava il fondo scala col modello di bjt/ErrorModel.h; deve essere uno
+ *     di quelli dello strumento, contenere la lettura sullo schermo e non
+ *     diminuire al crescere di |Vce|
+ *   - punti anomali: Ic deve crescere con Vce, un picco isolato che supera
+ *     outlierSigma errori da entrambi i lati e' un errore di lettura
+ *   - righe del file ignorate perche' non contengono 4 numeri (avviso)
+ * Le curve con errori vanno in una Quarantine con i motivi e i dati letti,
+ * quelle con soli avvisi sono accettate e il rapporto resta disponibile.
+ */
+
+#ifndef BJT_VALIDATE_H
+#define BJT_VALIDATE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "CurveStore.h"
+#include "ErrorModel.h"
+
+namespace bjt
+{
+
+enum ValidationCheck
+{
+    kCheckMissing = 0,     // file non trovato o senza punti
+    kCheckTooFew,          // meno di minPoints punti
+    kCheckNonFinite,       // valore non finito
+    kCheckBadError,        // errore <= 0 o non finito
+    kCheckOrder,           // Vce non monotona
+    kCheckSwap,            // Vce fuori ordine entro gli errori
+    kCheckDuplicate,       // Vce ripetuta
+    kCheckRange,           // errore su Vce incoerente con i fondo scala
+    kCheckOutlier,         // picco isolato di Ic
+    kCheckSkippedLine,     // riga del file ignorata
+    kNChecks
+};
+
+inline const char *CheckName(int c)
+{
+    static const char *const kNames[kNChecks] = {
+        "file mancante o vuoto", "punti insufficienti", "valore non finito", "errore non positivo",
+        "Vce non monotona", "Vce scambiata entro gli errori", "Vce ripetuta", "fondo scala incoerente", "punto anomalo", "riga ignorata"};
+    return c >= 0 && c < kNChecks ? kNames[c] : "?";
+}
+
+struct ValidatorConfig
+{
+    int minPoints = 3;
+    double outlierSigma = 5;            // soglia dei picchi [errori]
+    double orderSigma = 3;              // scambi di Vce tollerati [errori]
+    double errResolution = 0.001;       // risoluzione degli errori tabulati [V]
+    double vResolution = 0.01;          // risoluzione delle letture di Vce [V]
+    ScopeModel scope;
+    // Controlli che mandano la curva in quarantena; gli altri sono avvisi
+    unsigned rejectMask = ~((1u << kCheckSwap) | (1u << kCheckDuplicate) | (1u << kCheckSkippedLine));
+};
+
+struct ValidationReport
+{
+    unsigned flags = 0;                 // bit (1 << ValidationCheck)
+    int nPoints = 0;
+    int count[kNChecks] = {};
+    int firstLine[kNChecks] = {};       // riga (o punto, da 1) della prima occorrenza
+
+    bool Has(int c) const { return flags & (1u << c); }
+    bool Rejected(const ValidatorConfig &cfg) const { return flags & cfg.rejectMask; }
+
+    void Flag(int c, int line)
+    {
+        if (!count[c]++) firstLine[c] = line;
+        flags |= 1u << c;
+    }
+
+    // "Vce ripetuta (1x, riga 62); ..."
+    std::string Describe() const
+    {
+        std::string s;
+        for (int c = 0; c < kNChecks; ++c){
+            if (!Has(c)) continue;
+            char buf[96];
+            std::snprintf(buf, sizeof(buf), "%s%s (%dx, riga %d)", s.empty() ? "" : "; ", CheckName(c), count[c],
+                          firstLine[c]);
+            s += buf;
+        }
+        return s.empty() ? "ok" : s;
+    }
+};
+
+// -----------------------------------------------------
+// Validatore a un passaggio: Push per ogni punto nell'ordine del file, poi
+// Finish. Tiene solo gli ultimi due punti e lo stato dei fondo scala.
+// -----------------------------------------------------
+class SweepValidator
+{
+public:
+    explicit SweepValidator(const ValidatorConfig &cfg = ValidatorConfig()) : fCfg(cfg)
+    {
+        for (int s = 0; s < kNScopeScales; ++s){
+            double r = cfg.scope.ReadingError(kScopeScales[s]);
+            fReading2[s] = r * r;
+            fScreen[s] = cfg.scope.maxDivs * kScopeScales[s];
+        }
+    }
+
+    void Begin()
+    {
+        fReport = ValidationReport();
+        fDir = 0;
+        fN = 0;
+        fScaleLo = 0;
+        fScaleHi = kNScopeScales - 1;
+    }
+
+    void Push(double v, double i, double ev, double ei, int line)
+    {
+        ValidationReport &r = fReport;
+        ++r.nPoints;
+        if (!std::isfinite(v) || !std::isfinite(i)){
+            r.Flag(kCheckNonFinite, line);
+            return;
+        }
+        if (!(ev > 0) || !(ei > 0) || !std::isfinite(ev) || !std::isfinite(ei)){
+            r.Flag(kCheckBadError, line);
+            return;
+        }
+
+        // Ordine e ripetizioni
+        if (fN > 0){
+            double dv = v - fV[1];
+            if (dv == 0)
+                r.Flag(kCheckDuplicate, line);
+            else {
+                int dir = dv > 0 ? 1 : -1;
+                if (fDir == 0)
+                    StartDirection(dir);
+                else if (dir != fDir)
+                    r.Flag(dv * dv > fCfg.orderSigma * fCfg.orderSigma * (ev * ev + fEV * fEV) ? kCheckOrder : kCheckSwap,
+                           line);
+            }
+        }
+
+        CheckScale(v, ev, line);
+
+        // Picco isolato nel punto precedente (serve il successivo)
+        if (fN >= 2 && v != fV[1] && fV[1] != fV[0]){
+            double d1 = fI[1] - fI[0], d2 = i - fI[1];
+            // Confronti sui quadrati: niente radici nel ciclo di lettura
+            double k2 = fCfg.outlierSigma * fCfg.outlierSigma;
+            if (d1 * d2 < 0 && d1 * d1 > k2 * (fEI[1] * fEI[1] + fEI[0] * fEI[0]) &&
+                d2 * d2 > k2 * (ei * ei + fEI[1] * fEI[1]))
+                r.Flag(kCheckOutlier, fLine);
+        }
+
+        fV[0] = fV[1];
+        fI[0] = fI[1];
+        fEI[0] = fEI[1];
+        fV[1] = v;
+        fI[1] = i;
+        fEI[1] = ei;
+        fEV = ev;
+        fLine = line;
+        if (fN == 0) fFirstScale[0] = fPointLo, fFirstScale[1] = fPointHi;
+        ++fN;
+    }
+
+    // Riga del file non letta come punto
+    void Skip(int line) { fReport.Flag(kCheckSkippedLine, line); }
+
+    const ValidationReport &Finish()
+    {
+        if (fReport.nPoints == 0)
+            fReport.Flag(kCheckMissing, 0);
+        else if (fReport.nPoints < fCfg.minPoints)
+            fReport.Flag(kCheckTooFew, 0);
+        return fReport;
+    }
+
+    const ValidationReport &GetReport() const { return fReport; }
+    const ValidatorConfig &GetConfig() const { return fCfg; }
+
+private:
+    // Fondo scala compatibili con l'errore ev della lettura v, come intervallo
+    // di indici in kScopeScales; false se nessuno. L'errore tabulato e'
+    // arrotondato a errResolution: il fondo scala s e' compatibile se
+    // (ev -+ errResolution/2)^2 comprende sigma_l(s)^2 + sigma_c(v)^2.
+    bool ScaleRange(double v, double ev, int &lo, int &hi) const
+    {
+        double c = fCfg.scope.CalibError(v);
+        double eLo = std::max(ev - fCfg.errResolution / 2, 0.0), eHi = ev + fCfg.errResolution / 2;
+        double lo2 = eLo * eLo - c * c, hi2 = eHi * eHi - c * c;
+        double vMax = std::fabs(v) - fCfg.vResolution / 2;
+        lo = kNScopeScales;
+        hi = -1;
+        for (int s = 0; s < kNScopeScales; ++s){
+            if (fReading2[s] < lo2 * (1 - 1e-9) || fReading2[s] > hi2 * (1 + 1e-9) || vMax > fScreen[s]) continue;
+            if (s < lo) lo = s;
+            hi = s;
+        }
+        return lo <= hi;
+    }
+
+    // Al crescere di |Vce| il fondo scala non puo' diminuire: con Vce
+    // crescente si tiene il fondo scala minimo ammesso, con Vce decrescente
+    // il massimo
+    void CheckScale(double v, double ev, int line)
+    {
+        int lo, hi;
+        if (!ScaleRange(v, ev, lo, hi)){
+            fReport.Flag(kCheckRange, line);
+            fPointLo = 0;
+            fPointHi = kNScopeScales - 1;
+            return;
+        }
+        fPointLo = lo;
+        fPointHi = hi;
+        bool increasing = v >= 0 ? fDir >= 0 : fDir <= 0;
+        if (fDir == 0) return;
+        if (increasing){
+            if (hi < fScaleLo)
+                fReport.Flag(kCheckRange, line);
+            else
+                fScaleLo = std::max(fScaleLo, lo);
+        } else {
+            if (lo > fScaleHi)
+                fReport.Flag(kCheckRange, line);
+            else
+                fScaleHi = std::min(fScaleHi, hi);
+        }
+    }
+
+    void StartDirection(int dir)
+    {
+        fDir = dir;
+        fScaleLo = fFirstScale[0];
+        fScaleHi = fFirstScale[1];
+    }
+
+    ValidatorConfig fCfg;
+    double fReading2[kNScopeScales];    // sigma_l^2 di ogni fondo scala
+    double fScreen[kNScopeScales];      // lettura massima sullo schermo
+    ValidationReport fReport;
+    int fDir = 0;                       // verso di Vce: +1, -1, 0 se non ancora noto
+    int fN = 0;
+    double fV[2] = {}, fI[2] = {}, fEI[2] = {}, fEV = 0;
+    int fLine = 0;
+    int fScaleLo = 0, fScaleHi = kNScopeScales - 1;
+    int fPointLo = 0, fPointHi = kNScopeScales - 1;
+    int fFirstScale[2] = {0, kNScopeScales - 1};
+};
+
+// -----------------------------------------------------
+// Curve scartate, con i motivi e i dati come letti
+// -----------------------------------------------------
+class Quarantine
+{
+public:
+    struct Entry
+    {
+        std::string source;
+        CurveMeta meta;
+        ValidationReport report;
+        std::vector<double> vce, ic, errVce, errIc;
+    };
+
+    void Add(Entry e) { fEntries.push_back(std::move(e)); }
+    int GetN() const { return int(fEntries.size()); }
+    const Entry &Get(int i) const { return fEntries[i]; }
+    void Clear() { fEntries.clear(); }
+
+    void Print(FILE *out = stdout) const
+    {
+        for (const Entry &e : fEntries)
+            std::fprintf(out, "  %s (Ib = -%g uA): %s\n", e.source.c_str(), e.meta.ib, e.report.Describe().c_str());
+    }
+
+private:
+    std::vector<Entry> fEntries;
+};
+
+// -----------------------------------------------------
+// Lettura di un file di misura con validazione nello stesso ciclo. La curva
+// e' aggiunta a store se supera i controlli, altrimenti va in quarantine.
+// Restituisce l'indice della curva o -1; il rapporto e' copiato in *report.
+// -----------------------------------------------------
+template <typename Real>
+int LoadFileValidated(CurveStore<Real> &store, const char *path, const CurveMeta &meta, Quarantine &quarantine,
+                      const ValidatorConfig &cfg = ValidatorConfig(), ValidationReport *report = nullptr)
+{
+    SweepValidator val(cfg);
+    val.Begin();
+    std::vector<double> vce, ic, evce, eic;
+    if (FILE *f = std::fopen(path, "r")){
+        char line[512];
+        int nLine = 0;
+        while (std::fgets(line, sizeof(line), f)){
+            ++nLine;
+            double v[4];
+            if (!ParseSweepLine(line, v)){
+                // Le righe vuote non sono un problema
+                const char *p = line;
+                while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') ++p;
+                if (*p) val.Skip(nLine);
+                continue;
+            }
+            val.Push(v[0], v[1], v[2], v[3], nLine);
+            vce.push_back(v[0]);
+            ic.push_back(v[1]);
+            evce.push_back(v[2]);
+            eic.push_back(v[3]);
+        }
+        std::fclose(f);
+    }
+    const ValidationReport &r = val.Finish();
+    if (report) *report = r;
+    if (r.Rejected(cfg)){
+        quarantine.Add({path, meta, r, std::move(vce), std::move(ic), std::move(evce), std::move(eic)});
+        return -1;
+    }
+    return store.AddCurve(vce.data(), ic.data(), evce.data(), eic.data(), int(vce.size()), meta);
+}
+
+// Validazione di una curva gia' in memoria (righe = punti, da 1)
+template <typename Real>
+ValidationReport ValidateCurve(const CurveView<Real> &c, const ValidatorConfig &cfg = ValidatorConfig())
+{
+    SweepValidator val(cfg);
+    val.Begin();
+    for (int i = 0; i < c.n; ++i) val.Push(c.vce[i], c.ic[i], c.errVce[i], c.errIc[i], i + 1);
+    return val.Finish();
+}
+
+} // namespace bjt
+
+#endif
@@ -0,0 +1,312 @@
+/*
+ * Cartella osservata: le curve che arrivano durante la giornata (ad esempio
+ * in macro/data/) sono lette e analizzate appena il file e' completo, invece
+ * che nel lotto notturno.
+ *
+ * FolderWatcher usa inotify: un file e' pronto quando chi lo scrive lo ha
+ * chiuso (IN_CLOSE_WRITE) o rinominato nella cartella (IN_MOVED_TO) e poi e'
+ * rimasto fermo per quietMs, cosi' chi scrive a pezzi (apre, aggiunge righe,
+ * chiude, riapre) non fa leggere mezza curva. Un file la cui ultima riga e'
+ * troncata (senza a capo e con meno di quattro colonne), o vuoto, e'
+ * considerato ancora in scrittura; se resta cosi' per incompleteMs senza
+ * altri eventi (scrittore interrotto a meta' riga) e' consegnato lo stesso e
+ * la validazione lo mette in quarantena. I file modificati e mai chiusi
+ * (scrittori che tengono il file aperto) sono consegnati dopo idleMs senza
+ * modifiche. File nascosti, temporanei (~, .tmp) e con estensione diversa
+ * da suffix sono ignorati.
+ *
+ * WatchIngest legge e valida ogni file consegnato (LoadFileValidated), ne
+ * esegue il fit e aggiunge curva e risultato in fondo all'archivio e alla
+ * ResultTable; ogni risultato e' pubblicato subito come riga del file dei
+ * risultati (TSV, una riga per curva, scritta e svuotata a ogni fit).
+ */
+
+#ifndef BJT_WATCHFOLDER_H
+#define BJT_WATCHFOLDER_H
+
+#include <dirent.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Batch.h"
+#include "CurveStore.h"
+#include "EarlyFit.h"
+#include "Validate.h"
+
+namespace bjt
+{
+
+struct WatchConfig
+{
+    int quietMs = 100;             // attesa dopo la chiusura, per le scritture a pezzi
+    int idleMs = 5000;             // file modificati e mai chiusi; 0 = solo dopo la chiusura
+    int incompleteMs = 5000;       // file con l'ultima riga incompleta, consegnati comunque
+    std::string suffix = ".txt";
+    bool scanExisting = false;     // consegna anche i file gia' presenti all'avvio
+};
+
+// Ib [uA] dall'ultimo numero nel nome del file ("50.txt", "caratteristica_100.txt");
+// 0 se non c'e'
+inline double IbFromFileName(const std::string &name)
+{
+    size_t slash = name.find_last_of('/');
+    std::string stem = name.substr(slash == std::string::npos ? 0 : slash + 1);
+    stem = stem.substr(0, stem.find_last_of('.'));
+    size_t end = stem.size();
+    while (end > 0 && !std::isdigit((unsigned char)stem[end - 1])) --end;
+    size_t begin = end;
+    while (begin > 0 && std::isdigit((unsigned char)stem[begin - 1])) --begin;
+    return begin < end ? std::atof(stem.substr(begin, end - begin).c_str()) : 0;
+}
+
+// -----------------------------------------------------
+// Osservazione di una cartella con inotify e consegna dei file completi
+// -----------------------------------------------------
+class FolderWatcher
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    FolderWatcher() = default;
+    FolderWatcher(const FolderWatcher &) = delete;
+    FolderWatcher &operator=(const FolderWatcher &) = delete;
+    ~FolderWatcher() { Close(); }
+
+    bool Open(const char *dir, const WatchConfig &cfg = WatchConfig())
+    {
+        Close();
+        fCfg = cfg;
+        fDir = dir;
+        if (!fDir.empty() && fDir.back() == '/') fDir.pop_back();
+        fFd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fFd < 0) return false;
+        if (::inotify_add_watch(fFd, fDir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MODIFY | IN_CREATE) < 0){
+            Close();
+            return false;
+        }
+        if (cfg.scanExisting){
+            if (DIR *d = ::opendir(fDir.c_str())){
+                auto now = Clock::now() - std::chrono::milliseconds(fCfg.quietMs);
+                while (dirent *e = ::readdir(d))
+                    if (Accept(e->d_name)) fPending[e->d_name] = {now, true};
+                ::closedir(d);
+            }
+        }
+        return true;
+    }
+
+    void Close()
+    {
+        if (fFd >= 0) ::close(fFd);
+        fFd = -1;
+        fPending.clear();
+    }
+
+    bool IsOpen() const { return fFd >= 0; }
+    int GetPending() const { return int(fPending.size()); }
+
+    // Attende al piu' timeoutMs (-1: indefinitamente) e chiama fn(percorso, t)
+    // per ogni file diventato pronto, con t l'istante dell'ultimo evento (la
+    // chiusura); restituisce il numero di file consegnati
+    template <typename Fn>
+    int Poll(int timeoutMs, Fn fn)
+    {
+        if (fFd < 0) return 0;
+        pollfd pfd{fFd, POLLIN, 0};
+        int wait = NextDeadlineMs();
+        if (wait < 0 || (timeoutMs >= 0 && timeoutMs < wait)) wait = timeoutMs;
+        int r = ::poll(&pfd, 1, wait);
+        if (r > 0) ReadEvents();
+
+        int delivered = 0;
+        auto now = Clock::now();
+        for (auto it = fPending.begin(); it != fPending.end();){
+            if (!Ready(it->second, now)){
+                ++it;
+                continue;
+            }
+            std::string path = fDir + "/" + it->first;
+            if (!it->second.incomplete && !LastLineComplete(path)){
+                // Ultima riga incompleta: si aspetta un'altra scrittura, al
+                // piu' incompleteMs dall'ultimo evento
+                it->second.incomplete = true;
+                ++it;
+                continue;
+            }
+            Clock::time_point last = it->second.last;
+            it = fPending.erase(it);
+            fn(path, last);
+            ++delivered;
+        }
+        return delivered;
+    }
+
+private:
+    struct Pending
+    {
+        Clock::time_point last;    // ultimo evento
+        bool closed = false;       // chiuso dopo l'ultima modifica
+        bool incomplete = false;   // pronto ma con l'ultima riga incompleta
+    };
+
+    bool Accept(const char *name) const
+    {
+        size_t n = std::strlen(name), s = fCfg.suffix.size();
+        if (n == 0 || name[0] == '.' || name[n - 1] == '~') return false;
+        if (n >= 4 && std::strcmp(name + n - 4, ".tmp") == 0) return false;
+        return n > s && fCfg.suffix.compare(0, s, name + n - s) == 0;
+    }
+
+    bool Ready(const Pending &p, Clock::time_point now) const
+    {
+        auto idle = std::chrono::duration_cast<std::chrono::milliseconds>(now - p.last).count();
+        if (p.incomplete) return idle >= fCfg.incompleteMs;
+        if (p.closed) return idle >= fCfg.quietMs;
+        return fCfg.idleMs > 0 && idle >= fCfg.idleMs;
+    }
+
+    // Millisecondi al prossimo file pronto, -1 se nessuno in attesa
+    int NextDeadlineMs() const
+    {
+        long best = -1;
+        auto now = Clock::now();
+        for (const auto &kv : fPending){
+            const Pending &pd = kv.second;
+            int limit = pd.incomplete ? fCfg.incompleteMs : pd.closed ? fCfg.quietMs : fCfg.idleMs;
+            if (!pd.incomplete && !pd.closed && fCfg.idleMs <= 0) continue;
+            long ms = limit - long(std::chrono::duration_cast<std::chrono::milliseconds>(now - pd.last).count());
+            ms = std::max(0L, ms);
+            if (best < 0 || ms < best) best = ms;
+        }
+        return int(best);
+    }
+
+    void ReadEvents()
+    {
+        alignas(inotify_event) char buf[16384];
+        for (;;){
+            ssize_t n = ::read(fFd, buf, sizeof(buf));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            auto now = Clock::now();
+            for (char *p = buf; p < buf + n;){
+                inotify_event *e = (inotify_event *)p;
+                p += sizeof(inotify_event) + e->len;
+                if (e->len == 0 || !Accept(e->name)) continue;
+                Pending &pd = fPending[e->name];
+                pd.last = now;
+                pd.closed = (e->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) != 0;
+                pd.incomplete = false;
+            }
+        }
+    }
+
+    // Ultima riga completa: termina con '\n' oppure (file senza a capo finale,
+    // come quelli di data/) contiene tutte e quattro le colonne
+    static bool LastLineComplete(const std::string &path)
+    {
+        FILE *f = std::fopen(path.c_str(), "rb");
+        if (!f) return false;
+        char tail[512];
+        long size = std::fseek(f, 0, SEEK_END) == 0 ? std::ftell(f) : -1;
+        long k = std::min(size, long(sizeof(tail) - 1));
+        bool ok = k > 0 && std::fseek(f, size - k, SEEK_SET) == 0 && std::fread(tail, 1, size_t(k), f) == size_t(k);
+        std::fclose(f);
+        if (!ok) return false;
+        if (tail[k - 1] == '\n') return true;
+        tail[k] = 0;
+        const char *last = std::strrchr(tail, '\n');
+        double v[4];
+        return ParseSweepLine(last ? last + 1 : tail, v);
+    }
+
+    WatchConfig fCfg;
+    std::string fDir;
+    int fFd = -1;
+    std::map<std::string, Pending> fPending;
+};
+
+// -----------------------------------------------------
+// Lettura, fit e pubblicazione dei file consegnati
+// -----------------------------------------------------
+template <typename Real>
+class WatchIngest
+{
+public:
+    WatchIngest(const BatchConfig &cfg = BatchConfig(), const ValidatorConfig &vcfg = ValidatorConfig())
+        : fCfg(cfg), fValidator(vcfg)
+    {
+    }
+
+    ~WatchIngest() { ClosePublish(); }
+
+    // File dei risultati in aggiunta; l'intestazione e' scritta se e' vuoto
+    bool OpenPublish(const char *path)
+    {
+        ClosePublish();
+        fPublish = std::fopen(path, "a");
+        if (!fPublish) return false;
+        if (std::ftell(fPublish) == 0)
+            std::fprintf(fPublish, "time\tfile\tib\tV_A\terr_V_A\tcond\terr_cond\tchi2\tndf\n");
+        std::fflush(fPublish);
+        return true;
+    }
+
+    void ClosePublish()
+    {
+        if (fPublish) std::fclose(fPublish);
+        fPublish = nullptr;
+    }
+
+    // Curva dal file path (Ib dal nome); indice nell'archivio e nella
+    // ResultTable, -1 se il file e' in quarantena
+    int Ingest(const std::string &path)
+    {
+        CurveMeta meta;
+        meta.ib = IbFromFileName(path);
+        struct stat st;
+        meta.time = ::stat(path.c_str(), &st) == 0 ? int64_t(st.st_mtime) : 0;
+        int i = LoadFileValidated(fStore, path.c_str(), meta, fQuarantine, fValidator);
+        if (i < 0) return -1;
+        EarlyResult r = FitEarly(fStore.Curve(i), fCfg.vMin, fCfg.vMax);
+        fResults.Append(r);
+        fSources.push_back(path);
+        if (fPublish){
+            std::fprintf(fPublish, "%lld\t%s\t%g\t%.6g\t%.4g\t%.6g\t%.4g\t%.4g\t%d\n", (long long)meta.time,
+                         path.c_str(), meta.ib, r.V_A, r.err_V_A, r.cond, r.err_cond, r.chi2, r.ndf);
+            std::fflush(fPublish);
+        }
+        return i;
+    }
+
+    const CurveStore<Real> &GetStore() const { return fStore; }
+    const ResultTable &GetResults() const { return fResults; }
+    const Quarantine &GetQuarantine() const { return fQuarantine; }
+    const std::string &GetSource(int i) const { return fSources[i]; }
+
+private:
+    BatchConfig fCfg;
+    ValidatorConfig fValidator;
+    CurveStore<Real> fStore;
+    ResultTable fResults;
+    Quarantine fQuarantine;
+    std::vector<std::string> fSources;
+    FILE *fPublish = nullptr;
+};
+
+} // namespace bjt
+
+#endif
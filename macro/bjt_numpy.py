@@ -0,0 +1,203 @@
+"""
+Interfaccia numpy all'analisi BJT tramite PyROOT.
+
+Le colonne dell'archivio di curve (bjt::CurveStore) e della tabella dei
+risultati (bjt::ResultTable) sono esposte come array numpy che puntano alla
+memoria C++, senza copie; nell'altro verso l'analisi in blocco
+(bjt::AnalyzeBatch) lavora direttamente sugli array numpy passati da Python.
+Il costo di un trasferimento e' quindi quello di creare una vista, non di
+convertire i dati.
+
+Le viste restano valide finche' l'oggetto C++ da cui provengono esiste e non
+viene modificato: gli oggetti restituiti da questo modulo tengono un
+riferimento all'oggetto C++ per questo motivo.
+
+Esempio:
+    import numpy as np
+    import bjt_numpy as bn
+    res = bn.analyze(vce, ic, err_vce, err_ic, offsets)   # array numpy
+    print(res.V_A, res.err_V_A)
+
+Eseguire la dimostrazione con: python3 bjt_numpy.py
+"""
+
+import os
+
+import numpy as np
+import ROOT
+
+_dir = os.path.dirname(os.path.abspath(__file__))
+ROOT.gInterpreter.AddIncludePath(_dir)
+ROOT.gInterpreter.Declare('#include "bjt/Batch.h"')
+ROOT.gInterpreter.Declare('#include "bjt/CurveStore.h"')
+ROOT.gInterpreter.Declare('#include "bjt/Synthetic.h"')
+
+bjt = ROOT.bjt
+
+# Colonne di bjt::ResultTable con il relativo tipo numpy
+RESULT_COLUMNS = {
+    "a": np.float64, "err_a": np.float64, "b": np.float64, "err_b": np.float64,
+    "cov_ab": np.float64, "V_A": np.float64, "err_V_A": np.float64,
+    "cond": np.float64, "err_cond": np.float64, "chi2": np.float64,
+    "ndf": np.int32, "nPoints": np.int32, "ok": np.int32,
+    "VA_lo": np.float64, "VA_hi": np.float64,
+    "cond_lo": np.float64, "cond_hi": np.float64,
+    "maxCook": np.float64, "vceMaxCook": np.float64,
+    "maxShiftVA": np.float64, "vceMaxShiftVA": np.float64,
+    "jack_err_V_A": np.float64, "jack_err_cond": np.float64,
+}
+
+
+def _view(ptr, n, dtype):
+    """Array numpy di n elementi sulla memoria puntata da ptr (nessuna copia)."""
+    if n == 0:
+        return np.empty(0, dtype=dtype)
+    ptr.reshape((n,))
+    return np.frombuffer(ptr, dtype=dtype, count=n)
+
+
+class Results:
+    """Colonne di una bjt::ResultTable come array numpy (viste, non copie)."""
+
+    def __init__(self, table):
+        self.table = table
+        n = table.GetN()
+        for name, dtype in RESULT_COLUMNS.items():
+            setattr(self, name, _view(getattr(table, name).data(), n, dtype))
+
+    def __len__(self):
+        return self.table.GetN()
+
+    def as_dict(self):
+        return {name: getattr(self, name) for name in RESULT_COLUMNS}
+
+
+class StoreColumns:
+    """Colonne di un bjt::CurveStore come array numpy (viste, non copie).
+
+    vce, ic, err_vce, err_ic comprendono il padding tra una curva e l'altra:
+    la curva i occupa [offsets[i], offsets[i] + n[i]). curve(i) restituisce
+    le viste della sola curva i.
+    """
+
+    def __init__(self, store):
+        self.store = store
+        size = store.GetColumnSize()
+        real_size = store.GetColumnBytes() // (4 * size) if size else 8
+        dtype = np.float32 if real_size == 4 else np.float64
+        ncurves = store.GetNCurves()
+        self.vce = _view(store.GetVce(), size, dtype)
+        self.ic = _view(store.GetIc(), size, dtype)
+        self.err_vce = _view(store.GetErrVce(), size, dtype)
+        self.err_ic = _view(store.GetErrIc(), size, dtype)
+        self.offsets = _view(store.GetOffsets(), ncurves, np.uint64)
+        self.n = _view(store.GetNs(), ncurves, np.int32)
+        self.ib = _view(store.GetIbs(), ncurves, np.float64)
+
+    def curve(self, i):
+        o, n = int(self.offsets[i]), int(self.n[i])
+        s = slice(o, o + n)
+        return self.vce[s], self.ic[s], self.err_vce[s], self.err_ic[s]
+
+
+def _config(v_min, v_max, n_threads, n_bootstrap, seed, influence=False):
+    cfg = bjt.BatchConfig()
+    cfg.vMin = v_min
+    cfg.vMax = v_max
+    cfg.nThreads = n_threads
+    cfg.nBootstrap = n_bootstrap
+    cfg.seed = seed
+    cfg.influence = influence
+    return cfg
+
+
+def analyze(vce, ic, err_vce, err_ic, offsets, counts=None, v_min=1.0, v_max=3.5,
+            n_threads=0, n_bootstrap=0, seed=1, influence=False):
+    """Fit di Early di tutte le curve date come array numpy contigui.
+
+    Le colonne devono essere tutte float64 o tutte float32. Senza counts,
+    offsets (int64, lunghezza n_curve + 1) delimita le curve; con counts
+    (int32), la curva i ha counts[i] punti a partire da offsets[i], come nel
+    layout con padding di StoreColumns. Gli array sono letti in place dal
+    C++: la conversione avviene solo se tipo o layout non sono gia' quelli
+    richiesti.
+    """
+    dtype = np.float32 if np.asarray(vce).dtype == np.float32 else np.float64
+    cols = [np.ascontiguousarray(c, dtype=dtype) for c in (vce, ic, err_vce, err_ic)]
+    offsets = np.ascontiguousarray(offsets, dtype=np.int64)
+    # Il C++ non controlla nulla: ogni indice fuori dalle colonne e' un crash
+    npoints = len(cols[0])
+    if any(len(c) != npoints for c in cols[1:]):
+        raise ValueError("vce, ic, err_vce ed err_ic devono avere la stessa lunghezza")
+    if counts is None:
+        ncurves = len(offsets) - 1
+        ok = ncurves >= 0 and (ncurves == 0 or (offsets[0] >= 0 and offsets[-1] <= npoints and
+                                                  bool(np.all(np.diff(offsets) >= 0))))
+    else:
+        counts = np.ascontiguousarray(counts, dtype=np.int32)
+        ncurves = len(counts)
+        starts = offsets[:ncurves]
+        ok = len(offsets) >= ncurves and (ncurves == 0 or (
+            bool(np.all(starts >= 0)) and bool(np.all(counts >= 0)) and (starts + counts).max() <= npoints))
+    if not ok:
+        raise ValueError("offsets non compatibili con le colonne")
+
+    table = bjt.ResultTable()
+    cfg = _config(v_min, v_max, n_threads, n_bootstrap, seed, influence)
+    fn = bjt.AnalyzeColumnsF if dtype == np.float32 else bjt.AnalyzeColumnsD
+    fn(*cols, offsets, counts if counts is not None else ROOT.nullptr, ncurves, cfg, table)
+    return Results(table)
+
+
+def analyze_store(store, v_min=1.0, v_max=3.5, n_threads=0, n_bootstrap=0, seed=1,
+                  influence=False):
+    """Fit di Early di tutte le curve di un bjt::CurveStore."""
+    table = bjt.ResultTable()
+    bjt.AnalyzeBatch(store, _config(v_min, v_max, n_threads, n_bootstrap, seed, influence), table)
+    return Results(table)
+
+
+def load_sweeps(paths, ibs, float32=False):
+    """Legge i file di misura in un nuovo CurveStore; restituisce (store, colonne)."""
+    store = bjt.CurveStoreF() if float32 else bjt.CurveStoreD()
+    for path, ib in zip(paths, ibs):
+        meta = bjt.CurveMeta()
+        meta.ib = ib
+        if store.LoadFile(path, meta) < 0:
+            raise IOError("file non trovato o vuoto: " + path)
+    return store, StoreColumns(store)
+
+
+if __name__ == "__main__":
+    import time
+
+    # Dati reali
+    store, cols = load_sweeps([os.path.join(_dir, "data/50.txt"),
+                               os.path.join(_dir, "data/100.txt")], [50, 100])
+    res = analyze_store(store)
+    for i in range(len(res)):
+        print("Ib = -%g uA: V_A = %.4g +/- %.3g V, g = %.4g +/- %.3g mA/V"
+              % (cols.ib[i], res.V_A[i], res.err_V_A[i], res.cond[i], res.err_cond[i]))
+
+    # Lotto sintetico: viste C++ -> numpy e analisi numpy -> C++
+    lot = bjt.CurveStoreD()
+    vec = ROOT.std.vector["double"]()
+    vec.push_back(50)
+    vec.push_back(100)
+    bjt.FillSyntheticLot(lot, 500000, vec)
+
+    t0 = time.perf_counter()
+    cols = StoreColumns(lot)
+    t1 = time.perf_counter()
+    nbytes = 4 * cols.vce.nbytes
+    print("viste su %d curve (%.0f MB): %.1f us" % (len(cols.n), nbytes / 1e6, (t1 - t0) * 1e6))
+
+    t0 = time.perf_counter()
+    checksum = sum(float(c.sum()) for c in (cols.vce, cols.ic, cols.err_vce, cols.err_ic))
+    t1 = time.perf_counter()
+    print("lettura delle colonne da numpy: %.1f GB/s (checksum %.6g)" % (nbytes / (t1 - t0) / 1e9, checksum))
+
+    t0 = time.perf_counter()
+    res = analyze(cols.vce, cols.ic, cols.err_vce, cols.err_ic, cols.offsets.view(np.int64), cols.n)
+    t1 = time.perf_counter()
+    print("analisi da numpy: %.0f curve/s, V_A medio %.3f V" % (len(res) / (t1 - t0), res.V_A.mean()))
@@ -0,0 +1,137 @@
+/*
+ * Implementazione dell'API C (bjt_c.h) sopra le intestazioni di macro/bjt.
+ *
+ * Ogni contesto ha il proprio archivio di curve e la propria arena di lavoro:
+ * nessuna variabile globale, nessuna dipendenza da ROOT. Le eccezioni C++ non
+ * attraversano mai il confine C.
+ */
+
+#include "bjt_c.h"
+
+#include <new>
+
+#include "bjt/Arena.h"
+#include "bjt/Beta.h"
+#include "bjt/CurveStore.h"
+#include "bjt/EarlyFit.h"
+
+struct bjt_context
+{
+    bjt_config cfg;
+    bjt::CurveStoreD store;
+    bjt::MonotonicArena arena{size_t(1) << 16};
+};
+
+int bjt_api_version(void)
+{
+    return BJT_API_VERSION;
+}
+
+const char *bjt_status_string(int status)
+{
+    switch (status){
+    case BJT_OK: return "ok";
+    case BJT_ERR_ARGUMENT: return "argomento non valido";
+    case BJT_ERR_NO_POINTS: return "punti insufficienti nella finestra di fit";
+    case BJT_ERR_FIT: return "il fit non converge";
+    case BJT_ERR_RANGE: return "Vce fuori dal range delle misure";
+    case BJT_ERR_MEMORY: return "memoria insufficiente";
+    case BJT_ERR_INTERNAL: return "errore interno";
+    default: return "codice sconosciuto";
+    }
+}
+
+void bjt_config_default(bjt_config *cfg)
+{
+    if (!cfg) return;
+    cfg->v_min = 1.0;
+    cfg->v_max = 3.5;
+}
+
+bjt_context *bjt_context_create(const bjt_config *cfg)
+{
+    bjt_context *ctx = new (std::nothrow) bjt_context;
+    if (!ctx) return nullptr;
+    if (cfg)
+        ctx->cfg = *cfg;
+    else
+        bjt_config_default(&ctx->cfg);
+    return ctx;
+}
+
+void bjt_context_destroy(bjt_context *ctx)
+{
+    delete ctx;
+}
+
+void bjt_context_clear(bjt_context *ctx)
+{
+    if (!ctx) return;
+    ctx->store.Clear();
+    ctx->arena.Reset();
+}
+
+int bjt_push_curve(bjt_context *ctx, double ib, const double *vce, const double *ic,
+                   const double *err_vce, const double *err_ic, int n)
+{
+    if (!ctx || !vce || !ic || !err_vce || !err_ic || n < 0) return BJT_ERR_ARGUMENT;
+    try {
+        return ctx->store.AddCurve(vce, ic, err_vce, err_ic, n, {ib});
+    } catch (const std::bad_alloc &) {
+        return BJT_ERR_MEMORY;
+    } catch (...) {
+        return BJT_ERR_INTERNAL;
+    }
+}
+
+int bjt_analyze(bjt_context *ctx, bjt_curve_result *results, int capacity, int *n_results)
+{
+    if (!ctx || (!results && capacity > 0) || capacity < 0) return BJT_ERR_ARGUMENT;
+    int n = ctx->store.GetNCurves();
+    if (n_results) *n_results = n;
+    int status = BJT_OK;
+    try {
+        for (int i = 0; i < n && i < capacity; ++i){
+            bjt::EarlyResult r = bjt::FitEarly(ctx->store.Curve(i), ctx->cfg.v_min, ctx->cfg.v_max, ctx->arena);
+            bjt_curve_result &out = results[i];
+            out.ib = ctx->store.GetIb(i);
+            out.a = r.a;
+            out.err_a = r.err_a;
+            out.b = r.b;
+            out.err_b = r.err_b;
+            out.cov_ab = r.cov_ab;
+            out.V_A = r.V_A;
+            out.err_V_A = r.err_V_A;
+            out.cond = r.cond;
+            out.err_cond = r.err_cond;
+            out.chi2 = r.chi2;
+            out.ndf = r.ndf;
+            out.n_points = r.nPoints;
+            out.status = r.ok ? BJT_OK : (r.nPoints < 2 ? BJT_ERR_NO_POINTS : BJT_ERR_FIT);
+            if (out.status != BJT_OK && status == BJT_OK) status = out.status;
+        }
+    } catch (const std::bad_alloc &) {
+        return BJT_ERR_MEMORY;
+    } catch (...) {
+        return BJT_ERR_INTERNAL;
+    }
+    return status;
+}
+
+int bjt_beta(bjt_context *ctx, int curve_a, int curve_b, double vce, bjt_beta_result *out)
+{
+    if (!ctx || !out) return BJT_ERR_ARGUMENT;
+    int n = ctx->store.GetNCurves();
+    if (curve_a < 0 || curve_b < 0 || curve_a >= n || curve_b >= n || curve_a == curve_b)
+        return BJT_ERR_ARGUMENT;
+    bjt::BetaResult r = bjt::ComputeBeta(ctx->store.Curve(curve_a), ctx->store.Curve(curve_b), vce);
+    out->vce = vce;
+    out->ic_a = r.icA;
+    out->err_ic_a = r.errIcA;
+    out->ic_b = r.icB;
+    out->err_ic_b = r.errIcB;
+    out->beta = r.beta;
+    out->err_beta = r.err_beta;
+    out->status = r.ok ? BJT_OK : BJT_ERR_RANGE;
+    return out->status;
+}
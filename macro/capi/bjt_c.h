@@ -0,0 +1,113 @@
+/*
+ * API C per l'analisi BJT (tensione di Early, conduttanza, beta).
+ *
+ * Pensata per essere chiamata dal software del tester parametrico senza
+ * avviare ROOT: nessuno stato globale, un contesto per dispositivo (o per
+ * thread). Contesti diversi possono essere usati in parallelo da thread
+ * diversi; lo stesso contesto non deve essere usato da due thread insieme.
+ *
+ * Uso tipico, per ogni dispositivo:
+ *   bjt_context *ctx = bjt_context_create(NULL);
+ *   bjt_push_curve(ctx, 50, vce50, ic50, evce50, eic50, n50);
+ *   bjt_push_curve(ctx, 100, vce100, ic100, evce100, eic100, n100);
+ *   bjt_analyze(ctx, results, 2, &nres);
+ *   bjt_beta(ctx, 0, 1, 3.0, &beta);   (beta a Vce = 3 V)
+ *   bjt_context_clear(ctx);          (dispositivo successivo)
+ *   ...
+ *   bjt_context_destroy(ctx);
+ *
+ * Convenzioni come nell'analisi in macro/: grandezze cambiate di segno (primo
+ * quadrante), Vce in V, Ic in mA, Ib in uA.
+ *
+ * Compilazione della libreria (dalla cartella macro/capi):
+ *   g++ -std=c++17 -O2 -shared -fPIC -I.. bjt_c.cpp -o libbjt.so
+ *
+ * Le dimensioni delle strutture fanno parte dell'interfaccia binaria:
+ * bjt_analyze scrive results[i] e bjt_context_create copia *cfg con le
+ * dimensioni della libreria. Ogni modifica a una struttura alza
+ * BJT_API_VERSION e richiede di ricompilare il chiamante, che all'avvio
+ * controlla bjt_api_version() == BJT_API_VERSION.
+ */
+
+#ifndef BJT_C_H
+#define BJT_C_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BJT_API_VERSION 1
+
+typedef struct bjt_context bjt_context;
+
+/* Codici di ritorno */
+enum
+{
+    BJT_OK = 0,
+    BJT_ERR_ARGUMENT = -1,     /* puntatore nullo o dimensione non valida */
+    BJT_ERR_NO_POINTS = -2,    /* meno di 2 punti nella finestra di fit */
+    BJT_ERR_FIT = -3,          /* il fit non converge */
+    BJT_ERR_RANGE = -4,        /* Vce richiesta fuori dalle curve */
+    BJT_ERR_MEMORY = -5,
+    BJT_ERR_INTERNAL = -6
+};
+
+typedef struct
+{
+    double v_min;              /* finestra di fit [V], default 1.0 */
+    double v_max;              /* default 3.5 */
+} bjt_config;
+
+typedef struct
+{
+    double ib;                 /* corrente di base [uA] */
+    double a, err_a;           /* V = a + b*I: intercetta [V] */
+    double b, err_b;           /* pendenza [V/mA] */
+    double cov_ab;
+    double V_A, err_V_A;       /* tensione di Early [V] */
+    double cond, err_cond;     /* conduttanza [mA/V] */
+    double chi2;
+    int ndf;
+    int n_points;              /* punti nella finestra */
+    int status;                /* BJT_OK o codice di errore */
+} bjt_curve_result;
+
+typedef struct
+{
+    double vce;                /* [V] */
+    double ic_a, err_ic_a;     /* [mA] */
+    double ic_b, err_ic_b;
+    double beta, err_beta;
+    int status;
+} bjt_beta_result;
+
+int bjt_api_version(void);
+const char *bjt_status_string(int status);
+
+void bjt_config_default(bjt_config *cfg);
+
+/* cfg = NULL per la configurazione di default; NULL se manca memoria */
+bjt_context *bjt_context_create(const bjt_config *cfg);
+void bjt_context_destroy(bjt_context *ctx);
+
+/* Elimina le curve caricate, mantenendo configurazione e memoria */
+void bjt_context_clear(bjt_context *ctx);
+
+/* Copia una curva nel contesto; restituisce il suo indice (>= 0) o un errore */
+int bjt_push_curve(bjt_context *ctx, double ib, const double *vce, const double *ic,
+                   const double *err_vce, const double *err_ic, int n);
+
+/* Fit di tutte le curve: results[i] per la curva i, fino a capacity curve.
+ * n_results (facoltativo) riceve il numero di curve. Restituisce BJT_OK se
+ * tutti i fit sono riusciti, altrimenti il primo errore (i dettagli sono in
+ * results[i].status). */
+int bjt_analyze(bjt_context *ctx, bjt_curve_result *results, int capacity, int *n_results);
+
+/* beta tra le curve di indice curve_a e curve_b alla tensione vce */
+int bjt_beta(bjt_context *ctx, int curve_a, int curve_b, double vce, bjt_beta_result *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,78 @@
+/*
+ * Esempio d'uso dell'API C: analizza data/50.txt e data/100.txt come un
+ * dispositivo e misura la latenza per dispositivo.
+ *
+ * Compilazione ed esecuzione (dalla cartella macro/capi):
+ *   g++ -std=c++17 -O2 -shared -fPIC -I.. bjt_c.cpp -o libbjt.so
+ *   gcc -O2 esempio_c.c -L. -lbjt -Wl,-rpath,. -o esempio_c
+ *   ./esempio_c ../data/50.txt ../data/100.txt
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "bjt_c.h"
+
+#define MAX_POINTS 256
+
+typedef struct
+{
+    double vce[MAX_POINTS], ic[MAX_POINTS], evce[MAX_POINTS], eic[MAX_POINTS];
+    int n;
+} sweep;
+
+static int read_sweep(const char *path, sweep *s)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    s->n = 0;
+    while (s->n < MAX_POINTS &&
+           fscanf(f, "%lf %lf %lf %lf", &s->vce[s->n], &s->ic[s->n], &s->evce[s->n], &s->eic[s->n]) == 4)
+        ++s->n;
+    fclose(f);
+    return s->n;
+}
+
+int main(int argc, char **argv)
+{
+    const char *p50 = argc > 2 ? argv[1] : "../data/50.txt";
+    const char *p100 = argc > 2 ? argv[2] : "../data/100.txt";
+    static sweep s50, s100;
+    if (read_sweep(p50, &s50) <= 0 || read_sweep(p100, &s100) <= 0){
+        fprintf(stderr, "Errore: file non trovati o vuoti.\n");
+        return 1;
+    }
+
+    if (bjt_api_version() != BJT_API_VERSION){
+        fprintf(stderr, "Errore: libbjt di versione %d, compilato con la %d.\n", bjt_api_version(), BJT_API_VERSION);
+        return 1;
+    }
+    bjt_context *ctx = bjt_context_create(NULL);
+    bjt_curve_result res[2];
+    bjt_beta_result beta;
+    int nres = 0, st = BJT_OK;
+
+    const int reps = 10000;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int k = 0; k < reps; ++k){
+        bjt_context_clear(ctx);
+        bjt_push_curve(ctx, 50, s50.vce, s50.ic, s50.evce, s50.eic, s50.n);
+        bjt_push_curve(ctx, 100, s100.vce, s100.ic, s100.evce, s100.eic, s100.n);
+        st = bjt_analyze(ctx, res, 2, &nres);
+        bjt_beta(ctx, 0, 1, 3.0, &beta);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double us = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / 1e3 / reps;
+
+    printf("stato: %s\n", bjt_status_string(st));
+    for (int i = 0; i < nres; ++i)
+        printf("Ib = -%g uA: V_A = %g +/- %g V, conduttanza = %g +/- %g mA/V, chi2/ndf = %g/%d\n",
+               res[i].ib, res[i].V_A, res[i].err_V_A, res[i].cond, res[i].err_cond, res[i].chi2, res[i].ndf);
+    if (beta.status == BJT_OK)
+        printf("beta (V_CE = %g V) = %g +/- %g\n", beta.vce, beta.beta, beta.err_beta);
+    printf("latenza per dispositivo: %.2f us\n", us);
+
+    bjt_context_destroy(ctx);
+    return 0;
+}
@@ -0,0 +1,87 @@
+/*
+ * Modello di esempio caricabile a runtime (bjt/ModelPlugin.h).
+ *
+ *   Ic = Isat * tanh(Vce / Vk) * (1 + Vce / VA)
+ *
+ * descrive con un'unica funzione la saturazione e la regione attiva, quindi
+ * si fitta su tutta la curva invece che sulla sola finestra lineare.
+ *
+ * Compilazione (dalla cartella macro/modelli):
+ *   gcc -O2 -shared -fPIC -I../bjt early_tanh.c -o early_tanh.so -lm
+ * Il registro dei modelli carica da solo le librerie in macro/modelli.
+ */
+
+#include <math.h>
+
+#include "ModelPlugin.h"
+
+static void Evaluate(const double *p, const double *x, double *y, int n)
+{
+    for (int i = 0; i < n; ++i)
+        y[i] = p[0] * tanh(x[i] / p[1]) * (1 + x[i] / p[2]);
+}
+
+static void Jacobian(const double *p, const double *x, double *J, int n)
+{
+    for (int i = 0; i < n; ++i){
+        double t = tanh(x[i] / p[1]);
+        double s = 1 - t * t;
+        double lin = 1 + x[i] / p[2];
+        J[i] = t * lin;
+        J[n + i] = -p[0] * s * x[i] / (p[1] * p[1]) * lin;
+        J[2 * n + i] = -p[0] * t * x[i] / (p[2] * p[2]);
+    }
+}
+
+static void DerivativeX(const double *p, const double *x, double *dydx, int n)
+{
+    for (int i = 0; i < n; ++i){
+        double t = tanh(x[i] / p[1]);
+        dydx[i] = p[0] * ((1 - t * t) / p[1] * (1 + x[i] / p[2]) + t / p[2]);
+    }
+}
+
+/* Isat dal punto di corrente massima, Vk dal primo punto sopra tanh(1) Isat, VA fisso a 20 V */
+static int InitialGuess(const double *x, const double *y, const double *sy, int n, double *p)
+{
+    (void)sy;
+    if (n < 3) return 1;
+    double ymax = y[0];
+    int imax = 0;
+    for (int i = 1; i < n; ++i)
+        if (y[i] > ymax){
+            ymax = y[i];
+            imax = i;
+        }
+    if (!(ymax > 0)) return 1;
+    p[2] = 20;
+    p[0] = ymax / (1 + x[imax] / p[2]);
+    p[1] = x[imax];
+    for (int i = 0; i < n; ++i)       /* tanh(1) = 0.76; punti in ordine qualsiasi */
+        if (y[i] > 0.76 * ymax && x[i] > 0 && x[i] < p[1]) p[1] = x[i];
+    return p[1] > 0 ? 0 : 1;
+}
+
+static const char *const kNames[] = {"Isat", "Vk", "VA"};
+static const char *const kUnits[] = {"mA", "V", "V"};
+
+static const bjt_model_v1 kModel = {
+    BJT_MODEL_ABI_VERSION,
+    "early_tanh",
+    "Ic = Isat*tanh(Vce/Vk)*(1 + Vce/VA) (saturazione e regione attiva)",
+    BJT_AXES_IV,
+    3,
+    kNames,
+    kUnits,
+    0.0,
+    1e9,
+    Evaluate,
+    Jacobian,
+    DerivativeX,
+    InitialGuess,
+};
+
+const bjt_model_v1 *bjt_model_entry(int index)
+{
+    return index == 0 ? &kModel : 0;
+}
@@ -0,0 +1,79 @@
+/*
+ * Osserva una cartella di misure (bjt/WatchFolder.h) e analizza ogni curva
+ * appena il file e' completo: validazione, fit e una riga nel file dei
+ * risultati, scritta e svuotata subito. I file in quarantena sono segnalati
+ * con il motivo. Per ogni file e' stampato il tempo tra la chiusura e la
+ * pubblicazione del risultato.
+ *
+ * Opzioni:
+ *   -d cartella  cartella da osservare (.)
+ *   -o file      file dei risultati, in aggiunta (risultati_osservati.tsv)
+ *   -q ms        attesa dopo la chiusura del file (100)
+ *   -i ms        consegna dei file mai chiusi dopo ms senza modifiche (5000, 0 = mai)
+ *   -t ms        consegna dei file con l'ultima riga incompleta (troncati) dopo ms (5000)
+ *   -e           analizza anche i file gia' presenti
+ *
+ * Compilazione ed esecuzione (dalla cartella macro/strumenti):
+ *   g++ -std=c++17 -O2 -I.. osserva_cartella.cpp -o osserva_cartella
+ *   ./osserva_cartella -d ../data -o risultati.tsv
+ */
+
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "bjt/Batch.h"
+#include "bjt/WatchFolder.h"
+
+int main(int argc, char **argv)
+{
+    std::string dir = ".", out = "risultati_osservati.tsv";
+    bjt::WatchConfig wcfg;
+    int c;
+    while ((c = ::getopt(argc, argv, "d:o:q:i:t:e")) != -1){
+        switch (c){
+        case 'd': dir = optarg; break;
+        case 'o': out = optarg; break;
+        case 'q': wcfg.quietMs = std::atoi(optarg); break;
+        case 'i': wcfg.idleMs = std::atoi(optarg); break;
+        case 't': wcfg.incompleteMs = std::atoi(optarg); break;
+        case 'e': wcfg.scanExisting = true; break;
+        default:
+            std::fprintf(stderr, "uso: %s [-d cartella] [-o risultati] [-q ms] [-i ms] [-t ms] [-e]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    bjt::FolderWatcher watcher;
+    if (!watcher.Open(dir.c_str(), wcfg)){
+        std::perror(dir.c_str());
+        return 1;
+    }
+    bjt::WatchIngest<double> ingest;
+    if (!ingest.OpenPublish(out.c_str())){
+        std::perror(out.c_str());
+        return 1;
+    }
+    std::printf("Osservo %s, risultati in %s\n", dir.c_str(), out.c_str());
+    std::fflush(stdout);
+
+    for (;;){
+        watcher.Poll(-1, [&](const std::string &path, bjt::FolderWatcher::Clock::time_point closed){
+            int i = ingest.Ingest(path);
+            double ms = std::chrono::duration<double, std::milli>(bjt::FolderWatcher::Clock::now() - closed).count();
+            if (i < 0){
+                const bjt::Quarantine &q = ingest.GetQuarantine();
+                std::printf("%s: in quarantena, %s\n", path.c_str(), q.Get(q.GetN() - 1).report.Describe().c_str());
+            }
+            else{
+                bjt::EarlyResult r = ingest.GetResults().Get(ingest.GetResults().GetN() - 1);
+                std::printf("%s: V_A = %.3f +/- %.3f V, g = %.4f +/- %.4f mA/V (%.0f ms dalla chiusura)\n",
+                            path.c_str(), r.V_A, r.err_V_A, r.cond, r.err_cond, ms);
+            }
+            std::fflush(stdout);
+        });
+    }
+}
@@ -0,0 +1,239 @@
+/*
+ * Server di analisi: resta avviato e risponde ai lavori di fit su un socket
+ * Unix (protocollo in bjt/AnalysisService.h), cosi' ogni dispositivo costa
+ * il fit e non l'avvio di ROOT.
+ *
+ * Ogni client ha un thread; i lavori di client diversi sono eseguiti in
+ * parallelo, al piu' -j alla volta. Ogni thread tiene la propria arena
+ * (ScratchArena) e il proprio archivio per i file, riusati da un lavoro
+ * all'altro. Le richieste di un client possono arrivare in pipeline: tutte
+ * quelle gia' ricevute sono eseguite e le risposte partono in un'unica
+ * scrittura. La latenza di servizio di ogni lavoro e' nella risposta e le
+ * statistiche complessive si chiedono con STATS.
+ *
+ * Opzioni:
+ *   -s percorso  socket (/tmp/bjt_analisi.sock); un socket rimasto da
+ *                un'esecuzione precedente e' rimosso
+ *   -j n         lavori eseguiti insieme (numero di core)
+ *
+ * Compilazione ed esecuzione (dalla cartella macro/strumenti):
+ *   g++ -std=c++17 -O2 -I.. server_analisi.cpp -o server_analisi -lpthread
+ *   ./server_analisi -s /tmp/bjt_analisi.sock
+ */
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bjt/AnalysisService.h"
+#include "bjt/Arena.h"
+#include "bjt/CurveStore.h"
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    std::string path = bjt::kDefaultServicePath;
+    int jobs = 0;
+};
+
+// Limite ai lavori eseguiti insieme
+class JobSlots
+{
+public:
+    explicit JobSlots(int n) : fFree(n) {}
+
+    void Acquire()
+    {
+        std::unique_lock<std::mutex> lock(fMutex);
+        fCv.wait(lock, [&]{ return fFree > 0; });
+        --fFree;
+    }
+
+    void Release()
+    {
+        {
+            std::lock_guard<std::mutex> lock(fMutex);
+            ++fFree;
+        }
+        fCv.notify_one();
+    }
+
+private:
+    std::mutex fMutex;
+    std::condition_variable fCv;
+    int fFree;
+};
+
+bjt::LatencyStats gStats;
+const char *gSocketPath = nullptr;
+
+void OnSignal(int)
+{
+    if (gSocketPath) ::unlink(gSocketPath);
+    _exit(0);
+}
+
+// Esegue una richiesta completa; la risposta va in out
+void Execute(const std::string &line, const char *body, JobSlots &slots, std::string &out)
+{
+    static thread_local bjt::CurveStoreD store;
+    static thread_local std::vector<double> cols;
+    if (line == "STATS"){
+        out += gStats.Report();
+        return;
+    }
+    auto t0 = Clock::now();
+    bjt::AnalysisJob job;
+    bjt::JobReply rep;
+    std::string error;
+    if (!bjt::ParseJob(line, job, error)){
+        rep.id = job.id;
+        rep.error = error;
+    }
+    else{
+        slots.Acquire();
+        bjt::CurveView<double> c;
+        int k = 0;
+        if (!job.file.empty()){
+            store.Clear();
+            k = store.LoadFile(job.file.c_str(), {job.ib});
+            if (k >= 0) c = store.Curve(k);
+        }
+        else{
+            // Copia allineata del corpo: colonne Vce, Ic, errVce, errIc
+            cols.resize(4 * size_t(job.n));
+            std::memcpy(cols.data(), body, cols.size() * sizeof(double));
+            c.vce = cols.data();
+            c.ic = c.vce + job.n;
+            c.errVce = c.ic + job.n;
+            c.errIc = c.errVce + job.n;
+            c.n = job.n;
+            c.ib = job.ib;
+        }
+        if (k < 0){
+            rep.id = job.id;
+            rep.error = "file non leggibile: " + job.file;
+        }
+        else
+            rep = bjt::RunJob(job, c, bjt::ScratchArena());
+        slots.Release();
+    }
+    rep.serviceUs = std::chrono::duration<double, std::micro>(Clock::now() - t0).count();
+    gStats.Add(rep.serviceUs, !rep.ok);
+    out += bjt::FormatReply(rep, job);
+}
+
+// Serve un client fino alla chiusura della connessione
+void Serve(int fd, JobSlots &slots)
+{
+    std::string in, out;
+    size_t pos = 0;
+    std::vector<char> buf(1 << 16);
+    for (;;){
+        ssize_t n = ::read(fd, buf.data(), buf.size());
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        in.append(buf.data(), size_t(n));
+
+        // Tutte le richieste complete nel buffer (riga ed eventuale corpo)
+        bool desync = false;
+        for (;;){
+            size_t nl = in.find('\n', pos);
+            if (nl == std::string::npos) break;
+            std::string line = in.substr(pos, nl - pos);
+            size_t bodyBytes = 0;
+            if (line.compare(0, 4, "FIT ") == 0 && line.find(" file=") == std::string::npos){
+                int np = bjt::BodyPoints(line);
+                if (np < 0){
+                    // Lunghezza del corpo non valida: il corpo gia' inviato non si
+                    // puo' saltare, quindi dopo la risposta ERR si chiude
+                    Execute(line, nullptr, slots, out);
+                    desync = true;
+                    break;
+                }
+                bodyBytes = 4 * sizeof(double) * size_t(np);
+            }
+            if (in.size() - (nl + 1) < bodyBytes) break;   // corpo non ancora arrivato
+            Execute(line, in.data() + nl + 1, slots, out);
+            pos = nl + 1 + bodyBytes;
+        }
+        if (pos > 0){
+            in.erase(0, pos);
+            pos = 0;
+        }
+        const char *p = out.data();
+        size_t left = out.size();
+        while (left > 0){
+            ssize_t w = ::send(fd, p, left, MSG_NOSIGNAL);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) break;
+            p += w;
+            left -= size_t(w);
+        }
+        if (left > 0 || desync) break;
+        out.clear();
+    }
+    ::close(fd);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options opt;
+    int c;
+    while ((c = ::getopt(argc, argv, "s:j:")) != -1){
+        switch (c){
+        case 's': opt.path = optarg; break;
+        case 'j': opt.jobs = std::atoi(optarg); break;
+        default:
+            std::fprintf(stderr, "uso: %s [-s socket] [-j lavori]\n", argv[0]);
+            return 1;
+        }
+    }
+    int nJobs = bjt::ResolveThreads(opt.jobs);
+
+    int srv = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (opt.path.size() >= sizeof(addr.sun_path)){
+        std::fprintf(stderr, "server_analisi: percorso del socket troppo lungo\n");
+        return 1;
+    }
+    std::strcpy(addr.sun_path, opt.path.c_str());
+    ::unlink(opt.path.c_str());
+    if (::bind(srv, (sockaddr *)&addr, sizeof(addr)) != 0 || ::listen(srv, 64) != 0){
+        std::perror("server_analisi");
+        return 1;
+    }
+    gSocketPath = opt.path.c_str();
+    ::signal(SIGINT, OnSignal);
+    ::signal(SIGTERM, OnSignal);
+    ::signal(SIGPIPE, SIG_IGN);
+
+    JobSlots slots(nJobs);
+    std::printf("Server di analisi su %s (%d lavori insieme)\n", opt.path.c_str(), nJobs);
+    std::fflush(stdout);
+    for (;;){
+        int fd = ::accept(srv, nullptr, nullptr);
+        if (fd < 0) continue;
+        std::thread(Serve, fd, std::ref(slots)).detach();
+    }
+}
@@ -0,0 +1,246 @@
+/*
+ * Simulatore del banco di misura SCPI (bjt/Scpi.h), per provare
+ * l'acquisizione senza strumenti.
+ *
+ * Ascolta su TCP e serve un client alla volta. Ogni connessione misura un
+ * dispositivo sintetico (bjt/Synthetic.h) scelto con SIM:DEV; le letture
+ * hanno il rumore e gli arrotondamenti del generatore. Comandi (piu' comandi
+ * su una riga separati da ';', le risposte alle query di una riga sono
+ * unite da ';'):
+ *   *IDN?  *RST  SYST:ERR?
+ *   SOUR:BASE:CURR <uA>    SOUR:VOLT <V>    MEAS:VOLT?    MEAS:CURR?
+ *   SIM:DEV <n>            dispositivo n della sequenza del seme
+ * SOUR:VOLT esegue una lettura; MEAS:VOLT? e MEAS:CURR? ne restituiscono Vce
+ * [V] e Ic [mA].
+ *
+ * Opzioni:
+ *   -p porta     porta TCP (5025)
+ *   -r us        ritardo del collegamento in ciascun verso: le risposte
+ *                partono 2 * r dopo l'arrivo del comando, senza bloccare i
+ *                comandi successivi (come un collegamento lento)
+ *   -t us        tempo di misura dello strumento per SOUR:VOLT (sequenziale)
+ *   -s seme      seme dei dispositivi (1)
+ *
+ * Compilazione ed esecuzione (dalla cartella macro/strumenti):
+ *   g++ -std=c++17 -O2 -I.. simulatore_banco.cpp -o simulatore_banco
+ *   ./simulatore_banco -p 5025 -r 500
+ */
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "bjt/Synthetic.h"
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    int port = 5025;
+    int delayUs = 0;
+    int measureUs = 0;
+    unsigned long seed = 1;
+};
+
+class Session
+{
+public:
+    Session(const Options &opt) : fOpt(opt) { Reset(); }
+
+    // Esegue una riga di comandi; restituisce la risposta (vuota se la riga
+    // non contiene query)
+    std::string Execute(const std::string &line)
+    {
+        std::string reply;
+        size_t start = 0;
+        while (start <= line.size()){
+            size_t end = line.find(';', start);
+            if (end == std::string::npos) end = line.size();
+            std::string cmd = line.substr(start, end - start);
+            start = end + 1;
+            size_t b = cmd.find_first_not_of(" \t:");
+            if (b == std::string::npos) continue;
+            cmd.erase(0, b);
+            std::string head = cmd.substr(0, cmd.find(' '));
+            for (char &c : head) c = char(std::toupper((unsigned char)c));
+            const char *arg = cmd.size() > head.size() ? cmd.c_str() + head.size() + 1 : "";
+            std::string r;
+            if (!Command(head, arg, r)) fErrors.push_back("-113,\"Undefined header\"");
+            if (head.back() == '?'){
+                if (!reply.empty()) reply += ';';
+                reply += r;
+            }
+        }
+        return reply;
+    }
+
+private:
+    bool Command(const std::string &head, const char *arg, std::string &r)
+    {
+        char buf[64];
+        if (head == "*IDN?") r = "BJT-LAB,SIMULATORE-BANCO,0,1.0";
+        else if (head == "*RST") Reset();
+        else if (head == "SYST:ERR?" || head == "SYSTEM:ERROR?"){
+            r = fErrors.empty() ? "0,\"No error\"" : fErrors.front();
+            if (!fErrors.empty()) fErrors.pop_front();
+        }
+        else if (head == "SOUR:BASE:CURR") fIb = std::atof(arg);
+        else if (head == "SOUR:VOLT" || head == "SOURCE:VOLTAGE"){
+            if (fOpt.measureUs > 0) std::this_thread::sleep_for(std::chrono::microseconds(fOpt.measureUs));
+            double ev, ei;
+            bjt::MeasurePoint(fDevice, fIb, std::atof(arg), fCfg, fRng, fGaus, fVm, fIm, ev, ei);
+        }
+        else if (head == "MEAS:VOLT?" || head == "MEASURE:VOLTAGE?"){
+            std::snprintf(buf, sizeof(buf), "%.2f", fVm);
+            r = buf;
+        }
+        else if (head == "MEAS:CURR?" || head == "MEASURE:CURRENT?"){
+            std::snprintf(buf, sizeof(buf), "%.2f", fIm);
+            r = buf;
+        }
+        else if (head == "SIM:DEV") SelectDevice(std::atoi(arg));
+        else return false;
+        return true;
+    }
+
+    void Reset()
+    {
+        fIb = 0;
+        fVm = fIm = 0;
+        fErrors.clear();
+        SelectDevice(0);
+    }
+
+    void SelectDevice(int n)
+    {
+        std::mt19937_64 rng(fOpt.seed);
+        for (int k = 0; k <= n; ++k) fDevice = bjt::RandomDevice(fCfg, rng);
+        fRng.seed(fOpt.seed * 7919 + n);
+    }
+
+    const Options &fOpt;
+    bjt::SyntheticConfig fCfg;
+    bjt::SyntheticDevice fDevice;
+    std::mt19937_64 fRng;
+    std::normal_distribution<double> fGaus{0, 1};
+    double fIb = 0, fVm = 0, fIm = 0;
+    std::deque<std::string> fErrors;
+};
+
+// Serve un client fino alla chiusura della connessione
+void Serve(int fd, const Options &opt)
+{
+    Session session(opt);
+    std::string in;
+    std::deque<std::pair<Clock::time_point, std::string>> out;   // risposte in viaggio
+    char buf[4096];
+    bool open = true;
+    while (open || !out.empty()){
+        timespec ts{}, *timeout = nullptr;   // attesa al microsecondo fino alla prossima risposta
+        if (!out.empty()){
+            auto wait = std::chrono::duration_cast<std::chrono::nanoseconds>(out.front().first - Clock::now());
+            int64_t ns = std::max<int64_t>(0, wait.count());
+            ts.tv_sec = ns / 1000000000;
+            ts.tv_nsec = ns % 1000000000;
+            timeout = &ts;
+        }
+        pollfd pfd{fd, short(open ? POLLIN : 0), 0};
+        if (::ppoll(&pfd, 1, timeout, nullptr) < 0) break;
+        if (open && (pfd.revents & (POLLIN | POLLHUP))){
+            ssize_t n = ::read(fd, buf, sizeof(buf));
+            if (n <= 0)
+                open = false;
+            else
+                in.append(buf, size_t(n));
+            size_t nl;
+            while ((nl = in.find('\n')) != std::string::npos){
+                std::string line = in.substr(0, nl);
+                in.erase(0, nl + 1);
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                std::string reply = session.Execute(line);
+                if (!reply.empty())
+                    out.push_back({Clock::now() + std::chrono::microseconds(2 * opt.delayUs), reply + "\n"});
+            }
+        }
+        // Risposte il cui ritardo e' trascorso, in un'unica scrittura
+        std::string ready;
+        while (!out.empty() && out.front().first <= Clock::now()){
+            ready += out.front().second;
+            out.pop_front();
+        }
+        // Senza SIGPIPE: un client che chiude con risposte in volo non ferma il simulatore
+        const char *p = ready.data();
+        size_t left = ready.size();
+        while (left > 0){
+            ssize_t w = ::send(fd, p, left, MSG_NOSIGNAL);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) break;
+            p += w;
+            left -= size_t(w);
+        }
+        if (left > 0) break;
+        if (!open && out.empty()) break;
+    }
+    ::close(fd);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options opt;
+    int c;
+    while ((c = ::getopt(argc, argv, "p:r:t:s:")) != -1){
+        switch (c){
+        case 'p': opt.port = std::atoi(optarg); break;
+        case 'r': opt.delayUs = std::atoi(optarg); break;
+        case 't': opt.measureUs = std::atoi(optarg); break;
+        case 's': opt.seed = std::strtoul(optarg, nullptr, 10); break;
+        default:
+            std::fprintf(stderr, "uso: %s [-p porta] [-r ritardo_us] [-t misura_us] [-s seme]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    ::signal(SIGPIPE, SIG_IGN);
+    int srv = ::socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    ::setsockopt(srv, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(uint16_t(opt.port));
+    if (::bind(srv, (sockaddr *)&addr, sizeof(addr)) != 0 || ::listen(srv, 4) != 0){
+        std::perror("simulatore_banco");
+        return 1;
+    }
+    std::printf("Simulatore del banco su 127.0.0.1:%d (ritardo %d us, misura %d us)\n", opt.port, opt.delayUs,
+                opt.measureUs);
+    std::fflush(stdout);
+    for (;;){
+        int fd = ::accept(srv, nullptr, nullptr);
+        if (fd < 0) continue;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        Serve(fd, opt);
+    }
+}